@@ -38,6 +38,7 @@
 #include <vw/Image/ImageViewRef.h>
 #include <vw/Cartography/GeoReference.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
+#include <limits>
 #include <map>
 #include <string>
 
@@ -118,6 +119,12 @@ namespace asp {
   // Note: We use this constant in the python code as well
   const std::string ASP_POINT_OFFSET_TAG_STR = "POINT_OFFSET";
 
+  /// String we use in ASP written point cloud files to indicate that the
+  /// points are stored as integer multiples of this value, see
+  /// quantize_image_pixels().
+  // Note: We use this constant in the python code as well
+  const std::string ASP_POINT_SCALE_TAG_STR = "POINT_SCALE";
+
   // Specialized functions for reading/writing images with a shift.
   // The shift is meant to bring the pixel values closer to origin,
   // with goal of saving the pixels as float instead of double.
@@ -165,6 +172,46 @@ namespace asp {
   }
 
 
+  /// Subtract a given shift from the first 3 components of given vector
+  /// image, and store all components as integer multiples of the given
+  /// scale. This is more precise than rounding and casting to float
+  /// far from the shift, and compresses better. Pixels for which the
+  /// first 3 components are (0, 0, 0) stay so. A pixel having a
+  /// component which does not fit in 32 bits is set to zero, that is,
+  /// it becomes invalid.
+  template <class VecT>
+  struct QuantizeImagePixels:
+    public vw::ReturnFixedType< vw::Vector<vw::int32, vw::math::VectorSize<VecT>::value> > {
+    typedef vw::Vector<vw::int32, vw::math::VectorSize<VecT>::value> QuantizedT;
+    SubtractShift<VecT> m_subtract_shift;
+    double m_scale;
+    QuantizeImagePixels(vw::Vector3 const& shift, double scale):
+      m_subtract_shift(shift), m_scale(scale){
+      VW_ASSERT( m_scale > 0.0,
+                 vw::ArgumentErr() << "The point cloud scale must be positive.");
+    }
+    QuantizedT operator() (VecT const& pt) const {
+      VecT lpt = m_subtract_shift(pt);
+      QuantizedT result;
+      for (size_t i = 0; i < lpt.size(); i++) {
+        double val = round(lpt[i]/m_scale);
+        if ( !(val >= std::numeric_limits<vw::int32>::min() &&
+               val <= std::numeric_limits<vw::int32>::max()) ) // also catches NaN
+          return QuantizedT();
+        result[i] = vw::int32(val);
+      }
+      return result;
+    }
+  };
+  template <class ImageT>
+  vw::UnaryPerPixelView<ImageT, QuantizeImagePixels<typename ImageT::pixel_type> >
+  inline quantize_image_pixels( vw::ImageViewBase<ImageT> const& image,
+                                vw::Vector3 const& shift, double scale ) {
+    return vw::UnaryPerPixelView<ImageT, QuantizeImagePixels<typename ImageT::pixel_type> >
+      ( image.impl(), QuantizeImagePixels<typename ImageT::pixel_type>(shift, scale) );
+  }
+
+
   /// To help with compression, round to about 1mm, but
   /// use for rounding a number with few digits in binary.
   const double APPROX_ONE_MM = 1.0/1024.0;
@@ -0,0 +1,275 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file DemDiff.h
+///
+/// Resampling of one DEM onto the grid of another, as needed to take
+/// their difference.
+
+#ifndef __ASP_CORE_DEM_DIFF_H__
+#define __ASP_CORE_DEM_DIFF_H__
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelAccessors.h>
+#include <vw/Image/Interpolation.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/Algorithms.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Cartography/GeoTransform.h>
+
+namespace asp {
+
+  using namespace vw;
+
+  /// If the two georeferences have the same projection and pixel size,
+  /// so that a pixel in the first DEM is at a fixed shift from the
+  /// corresponding pixel in the second one, return true and that
+  /// shift, snapped to an integer if within numerical noise. The shift
+  /// is verified at a few pixels. If the DEMs would not overlap with
+  /// the shift, such as when their longitudes are offset by 360
+  /// degrees, return false.
+  inline bool dem_grid_shift(cartography::GeoReference const& georef1, BBox2i const& box1,
+                             cartography::GeoReference const& georef2, BBox2i const& box2,
+                             Vector2 & shift) {
+
+    shift = Vector2();
+    if (georef1.overall_proj4_str() != georef2.overall_proj4_str())
+      return false;
+
+    shift = georef2.point_to_pixel(georef1.pixel_to_point(Vector2()));
+    Vector2 probes[] = {Vector2(1, 0), Vector2(0, 1), Vector2(box1.width(), box1.height())};
+    for (int i = 0; i < 3; i++) {
+      Vector2 pix = georef2.point_to_pixel(georef1.pixel_to_point(probes[i]));
+      if (norm_2(pix - probes[i] - shift) > 1e-6)
+        return false;
+    }
+
+    // Snap to an integer shift if within numerical noise
+    Vector2 int_shift(floor(shift[0] + 0.5), floor(shift[1] + 0.5));
+    if (norm_2(shift - int_shift) < 1e-6)
+      shift = int_shift;
+
+    BBox2 box21(Vector2(box2.min()) - shift, Vector2(box2.max()) - shift);
+    box21.crop(BBox2(box1));
+    return !box21.empty();
+  }
+
+  /// The second DEM, resampled bilinearly onto the grid of the first
+  /// DEM. If the two DEMs have the same projection and the grids differ
+  /// only by a shift, the location in the second DEM of a pixel in the
+  /// first is found by adding that shift, and if the shift is an
+  /// integer no interpolation is done at all. Otherwise the pixels of
+  /// the first DEM are transformed to the second one only on a sparse
+  /// grid in each tile, with bilinear interpolation in between. If that
+  /// is not accurate enough in a tile, all its pixels are transformed.
+  class DemOnDemGridView: public ImageViewBase<DemOnDemGridView> {
+    ImageViewRef<PixelMask<double> > m_dem2;
+    int32        m_cols, m_rows;
+    cartography::GeoTransform m_gt;       // From pixels of the second DEM to the first one
+    bool         m_is_shift;
+    Vector2      m_shift;
+
+    /// Spacing of the grid on which pixels are transformed exactly
+    static const int GRID_SPACING = 16;
+
+    /// The largest allowed difference, in pixels, between the
+    /// interpolated and exact locations at the grid cell centers
+    static double grid_tolerance() { return 1e-3; }
+
+  public:
+    DemOnDemGridView(ImageViewRef<PixelMask<double> > const& dem2,
+                     int32 cols, int32 rows, cartography::GeoTransform const& gt,
+                     bool is_shift, Vector2 const& shift):
+      m_dem2(dem2), m_cols(cols), m_rows(rows), m_gt(gt),
+      m_is_shift(is_shift), m_shift(shift) {}
+
+    typedef PixelMask<double> pixel_type;
+    typedef pixel_type        result_type;
+    typedef ProceduralPixelAccessor<DemOnDemGridView> pixel_accessor;
+
+    inline int32 cols  () const { return m_cols; }
+    inline int32 rows  () const { return m_rows; }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+    inline result_type operator()( double/*i*/, double/*j*/, int32/*p*/ = 0 ) const {
+      vw_throw(NoImplErr() << "DemOnDemGridView::operator()(...) is not implemented");
+      return result_type();
+    }
+
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+      // Where each pixel of the tile lands in the second DEM
+      ImageView<Vector2> pos(bbox.width(), bbox.height());
+      if (m_is_shift) {
+        for (int col = 0; col < bbox.width(); col++) {
+          for (int row = 0; row < bbox.height(); row++)
+            pos(col, row) = Vector2(col + bbox.min().x(), row + bbox.min().y()) + m_shift;
+        }
+      } else if (!interp_positions(bbox, pos)) {
+        for (int col = 0; col < bbox.width(); col++) {
+          for (int row = 0; row < bbox.height(); row++)
+            exact_position(Vector2(col + bbox.min().x(), row + bbox.min().y()), pos(col, row));
+        }
+      }
+
+      // The region of the second DEM we need, with room for interpolation
+      BBox2 pos_box;
+      bool has_valid = false;
+      for (int col = 0; col < bbox.width(); col++) {
+        for (int row = 0; row < bbox.height(); row++) {
+          if (pos(col, row) == pos(col, row)) { // not NaN
+            pos_box.grow(pos(col, row));
+            has_valid = true;
+          }
+        }
+      }
+
+      ImageView<pixel_type> dem2_on_dem1(bbox.width(), bbox.height());
+      fill(dem2_on_dem1, pixel_type());
+      if (!has_valid)
+        return prerasterize_type(dem2_on_dem1, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+
+      BBox2i region((int)floor(pos_box.min().x()),   (int)floor(pos_box.min().y()),
+                    (int)floor(pos_box.width()) + 3, (int)floor(pos_box.height()) + 3);
+      region.crop(bounding_box(m_dem2));
+      if (region.empty())
+        return prerasterize_type(dem2_on_dem1, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+
+      ImageView<pixel_type> dem2_tile = crop(m_dem2, region);
+      InterpolationView<EdgeExtensionView<ImageView<pixel_type>, ValueEdgeExtension<pixel_type> >,
+                        BilinearInterpolation> interp_dem2
+        = interpolate(dem2_tile, BilinearInterpolation(),
+                      ValueEdgeExtension<pixel_type>(pixel_type()));
+
+      bool is_integer = m_is_shift && m_shift[0] == floor(m_shift[0]) &&
+        m_shift[1] == floor(m_shift[1]);
+      for (int col = 0; col < bbox.width(); col++) {
+        for (int row = 0; row < bbox.height(); row++) {
+          Vector2 p = pos(col, row);
+          if (p != p)
+            continue;
+          p -= region.min();
+          if (!is_integer) {
+            dem2_on_dem1(col, row) = interp_dem2(p.x(), p.y());
+            continue;
+          }
+          // An integer shift needs no interpolation
+          int x = (int)floor(p.x() + 0.5), y = (int)floor(p.y() + 0.5);
+          if (x >= 0 && y >= 0 && x < dem2_tile.cols() && y < dem2_tile.rows())
+            dem2_on_dem1(col, row) = dem2_tile(x, y);
+        }
+      }
+
+      return prerasterize_type(dem2_on_dem1, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+
+  private:
+
+    /// Transform a pixel of the first DEM to the second one. Set the
+    /// result to NaN if the projection fails.
+    bool exact_position(Vector2 const& pix, Vector2 & pos) const {
+      try {
+        pos = m_gt.reverse(pix);
+        return true;
+      } catch (...) {
+        double nan = std::numeric_limits<double>::quiet_NaN();
+        pos = Vector2(nan, nan);
+        return false;
+      }
+    }
+
+    /// Transform the pixels of the tile on a grid including its
+    /// boundary, and interpolate bilinearly in between. Return false if
+    /// some node fails to project or if the interpolation is off at some
+    /// cell center by more than the tolerance.
+    bool interp_positions(BBox2i const& bbox, ImageView<Vector2> & pos) const {
+
+      // The grid nodes, relative to the tile corner
+      std::vector<int> xs, ys;
+      for (int x = 0; x < bbox.width()  - 1; x += GRID_SPACING) xs.push_back(x);
+      for (int y = 0; y < bbox.height() - 1; y += GRID_SPACING) ys.push_back(y);
+      xs.push_back(bbox.width()  - 1);
+      ys.push_back(bbox.height() - 1);
+      int nx = xs.size(), ny = ys.size();
+
+      ImageView<Vector2> nodes(nx, ny);
+      for (int ix = 0; ix < nx; ix++) {
+        for (int iy = 0; iy < ny; iy++) {
+          if (!exact_position(Vector2(xs[ix] + bbox.min().x(), ys[iy] + bbox.min().y()),
+                              nodes(ix, iy)))
+            return false;
+        }
+      }
+
+      // Interpolate along the node rows
+      for (int iy = 0; iy < ny; iy++) {
+        for (int ix = 0; ix + 1 < nx; ix++) {
+          int x0 = xs[ix], x1 = xs[ix+1];
+          for (int x = x0; x <= x1; x++) {
+            double t = (x1 > x0) ? double(x - x0)/(x1 - x0) : 0.0;
+            pos(x, ys[iy]) = (1.0 - t)*nodes(ix, iy) + t*nodes(ix+1, iy);
+          }
+        }
+        if (nx == 1)
+          pos(0, ys[iy]) = nodes(0, iy);
+      }
+
+      // Then along the columns
+      for (int x = 0; x < bbox.width(); x++) {
+        for (int iy = 0; iy + 1 < ny; iy++) {
+          int y0 = ys[iy], y1 = ys[iy+1];
+          for (int y = y0 + 1; y < y1; y++) {
+            double t = double(y - y0)/(y1 - y0);
+            pos(x, y) = (1.0 - t)*pos(x, y0) + t*pos(x, y1);
+          }
+        }
+      }
+
+      // Compare with the exact locations at the cell centers, where the
+      // interpolation error is largest.
+      for (int ix = 0; ix + 1 < nx; ix++) {
+        for (int iy = 0; iy + 1 < ny; iy++) {
+          int x = (xs[ix] + xs[ix+1])/2, y = (ys[iy] + ys[iy+1])/2;
+          Vector2 exact;
+          if (!exact_position(Vector2(x + bbox.min().x(), y + bbox.min().y()), exact) ||
+              norm_2(exact - pos(x, y)) > grid_tolerance())
+            return false;
+        }
+      }
+
+      return true;
+    }
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_DEM_DIFF_H__
@@ -0,0 +1,150 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file DemSampler.h
+///
+/// Access to a DEM on disk for sparse lookups, such as when interpolating
+/// the DEM at a few thousand points. The DEM is read in blocks on demand,
+/// and only a limited number of recently used blocks are kept in memory,
+/// so memory use scales with the area actually touched, not with the
+/// size of the DEM.
+
+#ifndef __ASP_CORE_DEM_SAMPLER_H__
+#define __ASP_CORE_DEM_SAMPLER_H__
+
+#include <list>
+#include <map>
+#include <boost/shared_ptr.hpp>
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <vw/Core/Thread.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelAccessors.h>
+#include <vw/FileIO/DiskImageView.h>
+
+namespace asp {
+
+  /// A masked view of a DEM on disk whose pixels are served from an LRU
+  /// cache of blocks. It can be passed to interpolate() and wrapped in
+  /// an ImageViewRef. Copies share the same cache, and pixel access is
+  /// thread-safe. The cache is split into shards by block, each with
+  /// its own lock, so threads sampling different parts of the DEM do
+  /// not wait on each other.
+  template <class PixelT>
+  class CachedDemView : public vw::ImageViewBase< CachedDemView<PixelT> > {
+
+    typedef std::pair<int, int>                                   BlockIndex;
+    typedef boost::shared_ptr< vw::ImageView<PixelT> >            BlockPtr;
+    typedef std::pair<BlockIndex, BlockPtr>                       Block;
+    typedef typename std::list<Block>::iterator                   BlockIter;
+
+    static const int NUM_SHARDS = 16;
+
+    // The blocks whose index hashes to one shard
+    struct Shard {
+      std::list<Block>                 blocks; // most recently used first
+      std::map<BlockIndex, BlockIter>  index;
+      vw::Mutex                        mutex;
+    };
+
+    // The state shared among copies of this view
+    struct Cache {
+      vw::DiskImageView<PixelT> dem;
+      Shard                     shards[NUM_SHARDS];
+      Cache(std::string const& dem_file): dem(dem_file){}
+    };
+
+    boost::shared_ptr<Cache> m_cache;
+    double m_nodata;
+    int    m_block_size;
+    size_t m_max_blocks_per_shard;
+
+    /// The block with given index, read from disk if not cached. Only
+    /// the shard of that block is locked.
+    BlockPtr get_block(BlockIndex const& bi) const {
+      Shard & shard = m_cache->shards[(unsigned(bi.first)*31u + unsigned(bi.second)) % NUM_SHARDS];
+      vw::Mutex::Lock lock(shard.mutex);
+
+      typename std::map<BlockIndex, BlockIter>::iterator it = shard.index.find(bi);
+      if (it != shard.index.end()) {
+        // Move the block to the front of the list
+        shard.blocks.splice(shard.blocks.begin(), shard.blocks, it->second);
+        return shard.blocks.front().second;
+      }
+
+      // Read the block, evicting the least recently used one if needed.
+      // A thread still using an evicted block keeps it alive.
+      if (shard.blocks.size() >= m_max_blocks_per_shard) {
+        shard.index.erase(shard.blocks.back().first);
+        shard.blocks.pop_back();
+      }
+      vw::BBox2i box(bi.first*m_block_size, bi.second*m_block_size,
+                     m_block_size, m_block_size);
+      box.crop(vw::bounding_box(m_cache->dem));
+      BlockPtr block(new vw::ImageView<PixelT>(crop(m_cache->dem, box)));
+      shard.blocks.push_front(Block(bi, block));
+      shard.index[bi] = shard.blocks.begin();
+      return block;
+    }
+
+  public:
+    typedef vw::PixelMask<PixelT> pixel_type;
+    typedef pixel_type            result_type;
+    typedef vw::ProceduralPixelAccessor<CachedDemView> pixel_accessor;
+
+    /// Pixels equal to nodata, or NaN, are invalid. With the default
+    /// block size and count, at most 64 MB of float DEM data is kept
+    /// in memory.
+    CachedDemView(std::string const& dem_file, double nodata,
+                  int block_size = 256, int max_num_blocks = 256):
+      m_cache(new Cache(dem_file)), m_nodata(nodata),
+      m_block_size(block_size),
+      m_max_blocks_per_shard((max_num_blocks + NUM_SHARDS - 1)/NUM_SHARDS){
+      if (m_block_size <= 0 || max_num_blocks <= 0)
+        vw::vw_throw(vw::ArgumentErr() << "CachedDemView: Block size and count must be positive.\n");
+    }
+
+    inline vw::int32 cols  () const { return m_cache->dem.cols(); }
+    inline vw::int32 rows  () const { return m_cache->dem.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+    inline result_type operator()( vw::int32 col, vw::int32 row, vw::int32 p = 0 ) const {
+
+      BlockIndex bi(col / m_block_size, row / m_block_size);
+      PixelT val = (*get_block(bi))(col - bi.first *m_block_size,
+                                    row - bi.second*m_block_size);
+
+      pixel_type result(val);
+      if (val == m_nodata || boost::math::isnan(val))
+        result.invalidate();
+      return result;
+    }
+
+    typedef CachedDemView prerasterize_type;
+    inline prerasterize_type prerasterize( vw::BBox2i const& /*bbox*/ ) const { return *this; }
+    template <class DestT>
+    inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_DEM_SAMPLER_H__
@@ -29,15 +29,52 @@ namespace asp {
   int g_ip_num_errors = 0;
   Mutex g_ip_mutex;
 
+  // Cameras which are not thread-safe, such as ISIS, share global
+  // NAIF/SPICE state even across separate copies, so all projections
+  // through them must be serialized process-wide.
+  Mutex g_camera_mutex;
+
+
+//-------------------------------------------------------------------------------------------------
+// Class CameraPairPool
+
+  CameraPairPool::CamPair CameraPairPool::acquire() {
+    Mutex::Lock lock( m_mutex );
+    if (!m_free.empty()) {
+      CamPair cams = m_free.back();
+      m_free.pop_back();
+      return cams;
+    }
+    // Loading is done with the lock held, as the cameras that
+    // need a pool are not safe to load in parallel either.
+    CamPair cams;
+    load_cameras(cams.first, cams.second);
+    return cams;
+  }
+
+  void CameraPairPool::release(CamPair const& cams) {
+    Mutex::Lock lock( m_mutex );
+    m_free.push_back(cams);
+  }
+
+  camera::CameraModel* CameraPairPool::copy_of(camera::CameraModel const* cam,
+                                               CamPair const& cams) const {
+    if (cam == m_cam1)
+      return cams.first.get();
+    if (cam == m_cam2)
+      return cams.second.get();
+    vw_throw( LogicErr() << "CameraPairPool: Unknown camera.\n" );
+    return NULL;
+  }
 
 //-------------------------------------------------------------------------------------------------
 // Class EpipolarLinePointMatcher
 
-  EpipolarLinePointMatcher::EpipolarLinePointMatcher( bool single_threaded_camera,
+  EpipolarLinePointMatcher::EpipolarLinePointMatcher( CameraPairPool * camera_pool,
 						      double uniqueness_threshold,
                                                       double inlier_threshold,
 						      vw::cartography::Datum const& datum) :
-    m_single_threaded_camera(single_threaded_camera), m_uniqueness_threshold(uniqueness_threshold),
+    m_camera_pool(camera_pool), m_uniqueness_threshold(uniqueness_threshold),
     m_inlier_threshold(inlier_threshold), m_datum(datum) {}
 
   Vector3 EpipolarLinePointMatcher::epipolar_line( Vector2 const& feature,
@@ -106,7 +143,7 @@ namespace asp {
   // Local class definition -----
   class EpipolarLineMatchTask : public Task, private boost::noncopyable {
     typedef ip::InterestPointList::const_iterator IPListIter;
-    bool                            m_single_threaded_camera;
+    CameraPairPool                 *m_camera_pool;
     bool                            m_use_uchar_tree;
     math::FLANNTree<float        >& m_tree_float;
     math::FLANNTree<unsigned char>& m_tree_uchar;
@@ -115,10 +152,9 @@ namespace asp {
     camera::CameraModel            *m_cam1, *m_cam2;
     TransformRef                    m_tx1, m_tx2;
     EpipolarLinePointMatcher const& m_matcher;
-    Mutex&                          m_camera_mutex;
     std::vector<size_t>::iterator   m_output;
   public:
-    EpipolarLineMatchTask( bool single_threaded_camera,
+    EpipolarLineMatchTask( CameraPairPool * camera_pool,
 			   bool use_uchar_tree,
 			   math::FLANNTree<float        >& tree_float,
 			   math::FLANNTree<unsigned char>& tree_uchar,
@@ -130,16 +166,32 @@ namespace asp {
 			   TransformRef const& tx1,
 			   TransformRef const& tx2,
 			   EpipolarLinePointMatcher const& matcher,
-			   Mutex& camera_mutex,
 			   std::vector<size_t>::iterator output ) :
-      m_single_threaded_camera(single_threaded_camera),
+      m_camera_pool(camera_pool),
       m_use_uchar_tree(use_uchar_tree), m_tree_float(tree_float), m_tree_uchar(tree_uchar),
       m_start(start), m_end(end), m_ip_other(ip2),
       m_cam1(cam1), m_cam2(cam2), m_tx1(tx1), m_tx2(tx2),
-      m_matcher( matcher ), m_camera_mutex(camera_mutex), m_output(output) {}
+      m_matcher( matcher ), m_output(output) {}
 
     void operator()() {
 
+      // Use this thread's own copies of cameras which are not thread-safe
+      camera::CameraModel *cam1 = m_cam1, *cam2 = m_cam2;
+      CameraPairPool::CamPair cam_copies;
+      if (m_camera_pool) {
+        cam_copies = m_camera_pool->acquire();
+        cam1 = m_camera_pool->copy_of(m_cam1, cam_copies);
+        cam2 = m_camera_pool->copy_of(m_cam2, cam_copies);
+      }
+
+      match(cam1, cam2);
+
+      if (m_camera_pool)
+        m_camera_pool->release(cam_copies);
+    }
+
+    void match(camera::CameraModel* cam1, camera::CameraModel* cam2) {
+
       const size_t NUM_MATCHES_TO_FIND = 10;
       Vector<int   > indices  (NUM_MATCHES_TO_FIND);
       Vector<double> distances(NUM_MATCHES_TO_FIND);
@@ -150,12 +202,12 @@ namespace asp {
 
 	// Find the equation that describes the epipolar line
 	bool found_epipolar = false;
-	if (m_single_threaded_camera){
-	  // ISIS camera is single-threaded
-	  Mutex::Lock lock( m_camera_mutex );
-	  line_eq = m_matcher.epipolar_line( ip_org_coord, m_matcher.m_datum, m_cam1, m_cam2, found_epipolar);
+	if (m_camera_pool){
+	  // Only the FLANN search and line distances run in parallel
+	  Mutex::Lock lock( g_camera_mutex );
+	  line_eq = m_matcher.epipolar_line( ip_org_coord, m_matcher.m_datum, cam1, cam2, found_epipolar);
 	}else{
-	  line_eq = m_matcher.epipolar_line( ip_org_coord, m_matcher.m_datum, m_cam1, m_cam2, found_epipolar);
+	  line_eq = m_matcher.epipolar_line( ip_org_coord, m_matcher.m_datum, cam1, cam2, found_epipolar);
 	}
 
 	if (!found_epipolar) {
@@ -219,7 +271,7 @@ namespace asp {
 	  *m_output++ = (size_t)(-1); // Failed to find a match, return a flag!
 	}
       } // End loop through IP
-    } // End function operator()
+    } // End function match()
 
   }; // End class EpipolarLineMatchTask -------------------
 
@@ -265,7 +317,6 @@ namespace asp {
     vw_out(InfoMessage,"interest_point") << "FLANN-Tree created. Searching...\n";
 
     FifoWorkQueue matching_queue; // Create a thread pool object
-    Mutex camera_mutex;
 
     // Jobs set to 2x the number of cores. This is just incase all jobs are not equal.
     // The total number of interest points will be divided up among the jobs.
@@ -284,21 +335,21 @@ namespace asp {
       IPListIter end_it = start_it;
       std::advance( end_it, ip1_size / number_of_jobs );
       boost::shared_ptr<Task>
-	match_task( new EpipolarLineMatchTask( m_single_threaded_camera,
+	match_task( new EpipolarLineMatchTask( m_camera_pool,
 					       use_uchar_FLANN, kd_float, kd_uchar,
 					       start_it, end_it,
 					       ip2, cam1, cam2, tx1, tx2, *this,
-					       camera_mutex, output_it ) );
+					       output_it ) );
       matching_queue.add_task( match_task );
       start_it = end_it;
       std::advance( output_it, ip1_size / number_of_jobs );
     }
     boost::shared_ptr<Task>
-      match_task( new EpipolarLineMatchTask( m_single_threaded_camera,
+      match_task( new EpipolarLineMatchTask( m_camera_pool,
 					     use_uchar_FLANN, kd_float, kd_uchar,
 					     start_it, ip1.end(),
 					     ip2, cam1, cam2, tx1, tx2, *this,
-					     camera_mutex, output_it ) );
+					     output_it ) );
     matching_queue.add_task( match_task );
     matching_queue.join_all(); // Wait for all the jobs to finish.
   }
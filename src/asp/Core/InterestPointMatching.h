@@ -33,6 +33,7 @@
 
 #include <asp/Core/StereoSettings.h>
 #include <boost/foreach.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/math/special_functions/fpclassify.hpp>
 
 
@@ -143,19 +144,63 @@ namespace asp {
 			DETECT_IP_METHOD_SIFT     = 1,
 			DETECT_IP_METHOD_ORB      = 2};
 
+  /// Copies of a pair of cameras which are not thread-safe, so that
+  /// each thread doing IP matching works with its own copy. The
+  /// projections into them are still serialized by one process-wide
+  /// lock, as such cameras may share global state. A new copy is
+  /// loaded only when all existing ones are in use, so there are
+  /// never more copies than threads.
+  class CameraPairPool: private boost::noncopyable {
+  public:
+    typedef boost::shared_ptr<vw::camera::CameraModel> CamPtr;
+    typedef std::pair<CamPtr, CamPtr>                  CamPair;
+
+    /// The cameras being copied, used only to tell which of them a
+    /// caller refers to.
+    CameraPairPool(vw::camera::CameraModel const* cam1,
+                   vw::camera::CameraModel const* cam2):
+      m_cam1(cam1), m_cam2(cam2){}
+    virtual ~CameraPairPool(){}
+
+    /// Get a pair of copies not used by any other thread
+    CamPair acquire();
+
+    /// Make a pair of copies available again
+    void release(CamPair const& cams);
+
+    /// The copy in the given pair of one of the two original cameras
+    vw::camera::CameraModel* copy_of(vw::camera::CameraModel const* cam,
+                                     CamPair const& cams) const;
+
+  protected:
+    /// Load new instances of the two cameras. This is never called
+    /// by more than one thread at a time.
+    virtual void load_cameras(CamPtr & cam1, CamPtr & cam2) = 0;
+
+  private:
+    vw::camera::CameraModel const* m_cam1;
+    vw::camera::CameraModel const* m_cam2;
+    std::vector<CamPair> m_free;
+    vw::Mutex            m_mutex;
+  };
+
   /// Takes interest points and then finds the nearest 10 matches
   /// according to their IP descriptiors. It then
   /// filters them by whom are closest to the epipolar line via a
   /// threshold. The first 2 are then selected to be a match if
   /// their descriptor distance is sufficiently far apart.
+  ///
+  /// If the camera pool is not NULL, the cameras are not thread-safe.
+  /// Each thread then projects into its own copies of them, one thread
+  /// at a time, and only the descriptor matching runs in parallel.
   class EpipolarLinePointMatcher {
-    bool   m_single_threaded_camera;
+    CameraPairPool * m_camera_pool;
     double m_uniqueness_threshold, m_inlier_threshold;
     vw::cartography::Datum m_datum;
 
   public:
     /// Constructor.
-    EpipolarLinePointMatcher( bool single_threaded_camera,
+    EpipolarLinePointMatcher( CameraPairPool * camera_pool,
 			      double uniqueness_threshold, double inlier_threshold,
 			      vw::cartography::Datum const& datum);
 
@@ -278,7 +323,7 @@ namespace asp {
   /// Left and Right TX define transforms that have been performed on
   /// the images that that camera data doesn't know about. (ie scaling).
   template <class Image1T, class Image2T>
-  bool ip_matching( bool single_threaded_camera,
+  bool ip_matching( CameraPairPool * camera_pool,
 		    vw::camera::CameraModel* cam1,
 		    vw::camera::CameraModel* cam2,
 		    vw::ImageViewBase<Image1T> const& image1,
@@ -298,7 +343,7 @@ namespace asp {
   /// apply a homogrpahy to make right image like left image. This is
   /// useful so that both images have similar scale and similar affine qualities.
   template <class Image1T, class Image2T>
-  bool ip_matching_w_alignment( bool single_threaded_camera,
+  bool ip_matching_w_alignment( CameraPairPool * camera_pool,
 				vw::camera::CameraModel* cam1,
 				vw::camera::CameraModel* cam2,
 				vw::ImageViewBase<Image1T> const& image1,
@@ -609,7 +654,7 @@ namespace asp {
   // Left and Right TX define transforms that have been performed on
   // the images that that camera data doesn't know about. (ie scaling).
   template <class Image1T, class Image2T>
-  bool ip_matching( bool single_threaded_camera,
+  bool ip_matching( CameraPairPool * camera_pool,
 		    vw::camera::CameraModel* cam1,
 		    vw::camera::CameraModel* cam2,
 		    vw::ImageViewBase<Image1T> const& image1,
@@ -645,7 +690,7 @@ namespace asp {
     vw_out() << "Uniqueness threshold: " << uniqueness_threshold << "\n";
     vw_out() << "Inlier threshold:     " << inlier_threshold     << "\n";
     
-    EpipolarLinePointMatcher matcher(single_threaded_camera,
+    EpipolarLinePointMatcher matcher(camera_pool,
 				     uniqueness_threshold, inlier_threshold, datum );
     vw_out() << "\t    Matching Forward" << std::endl;
     matcher( ip1, ip2, detect_method, cam1, cam2, left_tx, right_tx, forward_match );
@@ -754,7 +799,7 @@ namespace asp {
   }
 
   template <class Image1T, class Image2T>
-  bool ip_matching_w_alignment( bool single_threaded_camera,
+  bool ip_matching_w_alignment( CameraPairPool * camera_pool,
 				vw::camera::CameraModel* cam1,
 				vw::camera::CameraModel* cam2,
 				vw::ImageViewBase<Image1T> const& image1,
@@ -809,7 +854,7 @@ namespace asp {
     //   next step. Using anything else will interpolate nodata values
     //   and stop them from being masked out.
     bool inlier =
-      ip_matching( single_threaded_camera,
+      ip_matching( camera_pool,
 		   cam1, cam2, image1.impl(),
 		   crop(transform(image2.impl(), compose(tx, inverse(right_tx)),
 				  ValueEdgeExtension<typename Image2T::pixel_type>(boost::math::isnan(nodata2) ? 0 : nodata2),
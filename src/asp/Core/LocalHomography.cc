@@ -19,10 +19,20 @@
 /// \file LocalHomography.cc
 ///
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
 #include <vw/Image/ImageView.h>
 #include <vw/Image/Transform.h>
+#include <vw/Core/Settings.h>
 #include <vw/Core/ThreadPool.h>
 #include <vw/FileIO/DiskImageView.h>
+#include <vw/Math/Geometry.h>
+#include <vw/Math/RANSAC.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <asp/Core/LocalHomography.h>
 #include <asp/Core/StereoSettings.h>
@@ -32,6 +42,12 @@ using namespace vw;
 
 namespace asp {
 
+  // The local homography file starts with this, followed by the
+  // version of the format, to tell it apart from other files and
+  // from files written by older versions.
+  const char  LOCAL_HOM_MAGIC[8]  = {'A', 'S', 'P', 'L', 'H', 'O', 'M', '\0'};
+  const int32 LOCAL_HOM_VERSION   = 1;
+
   void split_n_into_k(int n, int k, std::vector<int> & partition){
 
     VW_ASSERT(n >= k && k > 0,
@@ -54,11 +70,72 @@ namespace asp {
 
   }
 
+  /// Find with RANSAC the homography which takes the right points to
+  /// the left ones, as homography_rectification() does, but draw the
+  /// samples from the given generator rather than from rand(). Then
+  /// the result depends only on how the generator was seeded, and
+  /// several threads can do this at the same time.
+  Matrix<double> ransac_homography(std::vector<Vector3> const& right_points,
+                                   std::vector<Vector3> const& left_points,
+                                   double inlier_threshold,
+                                   boost::random::mt19937 & gen){
+
+    const int NUM_ITERATIONS = 100;
+    const size_t SAMPLE_SIZE = 4; // points needed to fit a homography
+    math::HomographyFittingFunctor fitting_func;
+    math::InterestPointErrorMetric error_func;
+
+    size_t num_points = right_points.size();
+    if (num_points < SAMPLE_SIZE)
+      vw_throw( math::RANSACErr() << "ransac_homography: Not enough points.\n" );
+    boost::random::uniform_int_distribution<size_t> dist(0, num_points - 1);
+
+    std::vector<size_t> best_inliers;
+    for (int iter = 0; iter < NUM_ITERATIONS; iter++){
+
+      // Fit to a sample of distinct points
+      std::vector<size_t> sample;
+      while (sample.size() < SAMPLE_SIZE){
+        size_t k = dist(gen);
+        if (std::find(sample.begin(), sample.end(), k) == sample.end())
+          sample.push_back(k);
+      }
+      std::vector<Vector3> right_sample, left_sample;
+      for (size_t s = 0; s < sample.size(); s++){
+        right_sample.push_back(right_points[sample[s]]);
+        left_sample.push_back (left_points [sample[s]]);
+      }
+      Matrix<double> H = fitting_func(right_sample, left_sample);
+
+      std::vector<size_t> inliers;
+      for (size_t k = 0; k < num_points; k++){
+        if (error_func(H, right_points[k], left_points[k]) < inlier_threshold)
+          inliers.push_back(k);
+      }
+      if (inliers.size() > best_inliers.size())
+        best_inliers = inliers;
+    }
+
+    if (best_inliers.size() < std::max(SAMPLE_SIZE, num_points*2/3))
+      vw_throw( math::RANSACErr() << "ransac_homography: Too few inliers.\n" );
+
+    // Fit to the inliers, then refine using all points, as in
+    // homography_rectification().
+    std::vector<Vector3> right_inliers, left_inliers;
+    for (size_t s = 0; s < best_inliers.size(); s++){
+      right_inliers.push_back(right_points[best_inliers[s]]);
+      left_inliers.push_back (left_points [best_inliers[s]]);
+    }
+    Matrix<double> H = fitting_func(right_inliers, left_inliers);
+    return fitting_func(right_points, left_points, H);
+  }
+
   /// Given a disparity map restricted to a subregion, find the homography
   /// transform which aligns best the two images based on this disparity.
   template<class SeedDispT>
   vw::math::Matrix<double> homography_for_disparity(vw::BBox2i subregion,
                                                     SeedDispT const& disparity,
+                                                    boost::random::mt19937 & gen,
                                                     bool & success){
     success = true;
 
@@ -75,7 +152,7 @@ namespace asp {
     split_n_into_k(disparity.cols(), std::min(disparity.cols(), N), partitionx);
     split_n_into_k(disparity.rows(), std::min(disparity.rows(), N), partitiony);
 
-    std::vector<vw::ip::InterestPoint> left_ip, right_ip;
+    std::vector<Vector3> left_points, right_points;
     for (int ix = 0; ix < (int)partitionx.size()-1; ix++){
       for (int iy = 0; iy < (int)partitiony.size()-1; iy++){
 
@@ -94,26 +171,19 @@ namespace asp {
         if (count == 0) continue; // no valid points
 
         // Do the averaging. We must add the box corner to the left and
-        // right interest points.
-        vw::ip::InterestPoint l, r;
-        l.x = subregion.min().x() + lx/count; r.x = subregion.min().x() + rx/count;
-        l.y = subregion.min().y() + ly/count; r.y = subregion.min().y() + ry/count;
-        left_ip.push_back(l);
-        right_ip.push_back(r);
+        // right points, which are in homogeneous coordinates.
+        left_points.push_back (Vector3(subregion.min().x() + lx/count,
+                                       subregion.min().y() + ly/count, 1));
+        right_points.push_back(Vector3(subregion.min().x() + rx/count,
+                                       subregion.min().y() + ry/count, 1));
       }
     }
 
     try {
-      Matrix<double> left_matrix, right_matrix;
-      BBox2i image_size = bounding_box(disparity);
-      bool adjust_left_image_size = true;
-      homography_rectification( adjust_left_image_size,
-                                image_size.size(), image_size.size(),
-                                left_ip, right_ip, left_matrix, right_matrix );
-      // Undoing the shift in origin.
-      right_matrix(0,2) -= left_matrix(0,2);
-      right_matrix(1,2) -= left_matrix(1,2);
-      return right_matrix;
+      // The same inlier threshold as in homography_rectification()
+      Vector2 size = bounding_box(disparity).size();
+      double inlier_threshold = norm_2(size) * 1.5 * stereo_settings().ip_inlier_thresh;
+      return ransac_homography(right_points, left_points, inlier_threshold, gen);
     }
     catch ( const vw::ArgumentErr& e ){}
     catch ( const vw::math::RANSACErr& e ){}
@@ -121,31 +191,39 @@ namespace asp {
     return vw::math::identity_matrix<3>();
   }
 
-  // Task that computes local homography in a given tile
+  // Task that computes the local homography of a correlation tile
   class LocalHomTask: public vw::Task, private boost::noncopyable {
 
     int m_col, m_row;
-    BBox2i m_sub_bbox;
-    // We on purpose store a local deep copy of sub_disparity_crop to
-    // avoid segfault.
-    ImageView < PixelMask<Vector2i> > m_sub_disparity_crop;
+    BBox2i m_bbox, m_sub_bbox;
+    ImageView< PixelMask<Vector2f> > const& m_sub_disparity; // in memory
     ImageView<Matrix3x3> & m_local_hom;
   public:
-    LocalHomTask(int col, int row,
-                 BBox2i sub_bbox,
-                 ImageViewRef < PixelMask<Vector2i> > const& sub_disparity_crop,
+    LocalHomTask(int col, int row, BBox2i bbox, BBox2i sub_bbox,
+                 ImageView< PixelMask<Vector2f> > const& sub_disparity,
                  ImageView<Matrix3x3> & local_hom):
-      m_col(col), m_row(row), m_sub_bbox(sub_bbox),
-      m_sub_disparity_crop(sub_disparity_crop),
-      m_local_hom(local_hom){}
+      m_col(col), m_row(row), m_bbox(bbox), m_sub_bbox(sub_bbox),
+      m_sub_disparity(sub_disparity), m_local_hom(local_hom){}
 
     void operator()() {
-      bool success;
-      // To do: If this function is ever used, the variable 'success'
-      // needs to be treated properly.
-      exit(1); // broken, for now
-      m_local_hom(m_col, m_row)
-        = homography_for_disparity(m_sub_bbox, m_sub_disparity_crop, success);
+
+      // Each task writes a different element of m_local_hom, so no
+      // locking is needed for that. Seeding by tile makes the result
+      // not depend on which thread runs the task, or when.
+      BBox2i sub_bbox = m_sub_bbox;
+      boost::random::mt19937 gen(m_row*m_local_hom.cols() + m_col + 1);
+      while(1){
+        bool success = false;
+        sub_bbox.crop( bounding_box(m_sub_disparity) );
+        m_local_hom(m_col, m_row)
+          = homography_for_disparity(sub_bbox, crop(m_sub_disparity, sub_bbox), gen, success);
+        if (success) break;
+        vw_out() << "\t--> Failed to find local disparity in box: " << m_bbox  << std::endl;
+        vw_out() << "\t--> Trying again by increasing the local region."  << std::endl;
+        if (sub_bbox == bounding_box(m_sub_disparity)) break; // can't expand more
+        int len = std::max(sub_bbox.width(), sub_bbox.height());
+        sub_bbox.expand(len);
+      }
     }
   };
 
@@ -154,8 +232,11 @@ namespace asp {
 
     DiskImageView< PixelGray<float> > left_sub (opt.out_prefix + "-L_sub.tif");
     DiskImageView< PixelGray<float> > left_img (opt.out_prefix + "-L.tif");
-    DiskImageView< PixelMask<Vector2f> >
-      sub_disparity(opt.out_prefix + "-D_sub.tif");
+
+    // D_sub is small, and the tasks below read overlapping and growing
+    // regions of it, so bring it in memory once.
+    ImageView< PixelMask<Vector2f> >
+      sub_disparity = DiskImageView< PixelMask<Vector2f> >(opt.out_prefix + "-D_sub.tif");
 
     Vector2 upscale_factor( double(left_img.cols()) / double(left_sub.cols()),
                             double(left_img.rows()) / double(left_sub.rows()) );
@@ -165,14 +246,10 @@ namespace asp {
     int rows = (int)ceil(left_img.rows()/double(ts));
     ImageView<Matrix3x3> local_hom(cols, rows);
 
-    // Calculate the local homographies using multiple threads.
-    // To do: Each thread calls RANSAC, which calls rand(), which
-    // is not thread safe. So for now use just one thread.
-
     Stopwatch sw;
     sw.start();
 
-    //FifoWorkQueue queue( vw_settings().default_num_threads() );
+    FifoWorkQueue queue( vw_settings().default_num_threads() );
     for (int col = 0; col < cols; col++){
       for (int row = 0; row < rows; row++){
 
@@ -185,64 +262,64 @@ namespace asp {
 
         // Expand the box until square to make sure the local
         // homography calculation does not fail. If that does not
-        // help, keep on expanding the box.
-        bool success = false;
+        // help, the task will keep on expanding the box.
         int len = std::max(sub_bbox.width(), sub_bbox.height());
         sub_bbox = BBox2i(sub_bbox.max() - Vector2(len, len), sub_bbox.max());
         sub_bbox.expand(1);
-        while(1){
-
-          // This code enables multi-threading. It gives different answers each time,
-          // as multiple threads pull random numbers from the same stream.
-          // This code must be kept disabled until Boost's random function is used
-          // with one random stream for each thread.
-          //boost::shared_ptr<LocalHomTask>
-          //task(new LocalHomTask(col, row, sub_bbox, crop(sub_disparity, sub_bbox),
-          //                        local_hom));
-          //queue.add_task(task);
-
-          sub_bbox.crop( bounding_box(sub_disparity) );
-          local_hom(col, row)
-            = homography_for_disparity(sub_bbox, crop(sub_disparity, sub_bbox), success);
-          if (success) break;
-          vw_out() << "\t--> Failed to find local disparity in box: " << bbox  << std::endl;
-          vw_out() << "\t--> Trying again by increasing the local region."  << std::endl;
-          if (sub_bbox == bounding_box(sub_disparity)) break; // can't expand more
-          len = std::max(sub_bbox.width(), sub_bbox.height());
-          sub_bbox.expand(len);
-        }
 
+        boost::shared_ptr<LocalHomTask>
+          task(new LocalHomTask(col, row, bbox, sub_bbox, sub_disparity, local_hom));
+        queue.add_task(task);
       }
     }
-    //queue.join_all();
+    queue.join_all();
 
     sw.stop();
     vw_out(DebugMessage,"asp") << "Local homographies elapsed time: "
                                << sw.elapsed_seconds() << " s." << std::endl;
 
-    std::string local_hom_file = opt.out_prefix + "-local_hom.txt";
+    std::string local_hom_file = opt.out_prefix + "-local_hom.bin";
     vw_out() << "Writing: " << local_hom_file << "\n";
     write_local_homographies(local_hom_file, local_hom);
 
     return;
   }
 
+  // The local homographies are stored in binary, as LOCAL_HOM_MAGIC,
+  // the format version, and the number of columns and rows of tiles,
+  // as int32 values, followed by the nine entries of each tile's
+  // matrix, as doubles, iterating over rows within columns. All are
+  // in the native byte order.
   void write_local_homographies(std::string const& local_hom_file,
                                 ImageView<Matrix3x3> const& local_hom){
 
-    std::ofstream fh(local_hom_file.c_str());
-    fh.precision(18);
-    fh << local_hom.cols() << " " << local_hom.rows() << std::endl;
+    std::ofstream fh(local_hom_file.c_str(), std::ios::binary);
+    if (!fh.good())
+      vw_throw( IOErr() << "write_local_homographies: Cannot write: "
+                        << local_hom_file << ".\n" );
 
+    int32 version = LOCAL_HOM_VERSION;
+    int32 size[2] = {local_hom.cols(), local_hom.rows()};
+    fh.write(LOCAL_HOM_MAGIC, sizeof(LOCAL_HOM_MAGIC));
+    fh.write((char*)&version, sizeof(version));
+    fh.write((char*)size, sizeof(size));
+
+    std::vector<double> vals(9*local_hom.cols()*local_hom.rows());
+    int count = 0;
     for (int col = 0; col < local_hom.cols(); col++){
       for (int row = 0; row < local_hom.rows(); row++){
-        Vector<double> V = matrix_to_vector(local_hom(col, row));
-        for (int t = 0; t < int(V.size())-1; t++) 
-          fh << V[t] << " ";
-        if (V.size() > 0) 
-          fh << V[V.size()-1] << std::endl;
+        Matrix3x3 H = local_hom(col, row);
+        for (int r = 0; r < 3; r++)
+          for (int c = 0; c < 3; c++)
+            vals[count++] = H(r, c);
       }
     }
+    if (!vals.empty())
+      fh.write((char*)&vals[0], vals.size()*sizeof(double));
+
+    if (!fh.good())
+      vw_throw( IOErr() << "write_local_homographies: Failed writing: "
+                        << local_hom_file << ".\n" );
     fh.close();
 
     return;
@@ -251,28 +328,41 @@ namespace asp {
   void read_local_homographies(std::string const& local_hom_file,
                                ImageView<Matrix3x3> & local_hom){
 
-    std::ifstream fh(local_hom_file.c_str());
+    std::ifstream fh(local_hom_file.c_str(), std::ios::binary);
     if (!fh.good())
       vw_throw( IOErr() << "read_local_homographies: File does not exist: "
                         << local_hom_file << ".\n" );
 
-    int cols, rows;
-    if ( !(fh >> cols >> rows) )
+    // Reject files written by other versions, or which are not local
+    // homographies at all.
+    char  magic[sizeof(LOCAL_HOM_MAGIC)];
+    int32 version = 0;
+    if ( !fh.read(magic, sizeof(magic)) ||
+         std::memcmp(magic, LOCAL_HOM_MAGIC, sizeof(magic)) != 0 ||
+         !fh.read((char*)&version, sizeof(version)) || version != LOCAL_HOM_VERSION )
+      vw_throw( IOErr() << "read_local_homographies: Not a local homography file "
+                        << "of version " << LOCAL_HOM_VERSION << ": "
+                        << local_hom_file << ".\n" );
+
+    int32 size[2];
+    if ( !fh.read((char*)size, sizeof(size)) || size[0] < 0 || size[1] < 0 )
+      vw_throw( IOErr() << "read_local_homographies: Invalid file: "
+                        << local_hom_file << ".\n" );
+
+    std::vector<double> vals(9*size[0]*size[1]);
+    if ( !vals.empty() && !fh.read((char*)&vals[0], vals.size()*sizeof(double)) )
       vw_throw( IOErr() << "read_local_homographies: Invalid file: "
                         << local_hom_file << ".\n" );
 
-    local_hom.set_size(cols, rows);
+    local_hom.set_size(size[0], size[1]);
+    int count = 0;
     for (int col = 0; col < local_hom.cols(); col++){
       for (int row = 0; row < local_hom.rows(); row++){
-
-        Vector<double, 9> V;
-        for (int t = 0; t < int(V.size()); t++){
-          if (! (fh >> V[t]) )
-            vw_throw( IOErr() << "read_local_homographies: Invalid file: "
-                              << local_hom_file << ".\n" );
-        }
-
-        local_hom(col, row) = vector_to_matrix(V);
+        Matrix3x3 H;
+        for (int r = 0; r < 3; r++)
+          for (int c = 0; c < 3; c++)
+            H(r, c) = vals[count++];
+        local_hom(col, row) = H;
       }
     }
     fh.close();
@@ -40,6 +40,7 @@ namespace asp {
   /// Create a local homography for each correlation tile
   void create_local_homographies(ASPGlobalOptions const& opt);
 
+  /// Save and load the local homographies, in a compact binary format
   void write_local_homographies(std::string const& local_hom_file,
                                 vw::ImageView<vw::Matrix3x3> const& local_hom);
   void read_local_homographies(std::string const& local_hom_file,
@@ -567,7 +567,44 @@ namespace asp{
   /// \cond INTERNAL
   OrthoRasterizerView::prerasterize_type OrthoRasterizerView::prerasterize( BBox2i const& bbox ) const {
 
-    BBox2i bbox_1 = bbox;
+    std::vector< ImageViewRef<float> > textures(1, m_texture);
+    std::vector< ImageView<float> > results;
+    BBox2i bbox_1;
+    rasterize_textures(bbox, textures, bbox_1, results);
+
+    ImageView< PixelGray<float> > result = results[0];
+    return prerasterize_type (result, BBox2i(-bbox_1.min().x(),
+					     -bbox_1.min().y(),
+					     cols(), rows()));
+  }
+
+  ImageView<float> OrthoRasterizerView::rasterize_textures
+  (BBox2i const& bbox, std::vector< ImageViewRef<float> > const& textures) const {
+
+    std::vector< ImageView<float> > results;
+    BBox2i bbox_1;
+    rasterize_textures(bbox, textures, bbox_1, results);
+
+    // Crop the expanded results to the given box, one plane per texture
+    int num_textures = textures.size();
+    Vector2i shift = bbox.min() - bbox_1.min();
+    ImageView<float> tile(bbox.width(), bbox.height(), num_textures);
+    for (int t = 0; t < num_textures; t++){
+      for (int col = 0; col < bbox.width(); col++){
+        for (int row = 0; row < bbox.height(); row++){
+          tile(col, row, t) = results[t](col + shift.x(), row + shift.y());
+        }
+      }
+    }
+    return tile;
+  }
+
+  void OrthoRasterizerView::rasterize_textures(BBox2i const& bbox,
+                                               std::vector< ImageViewRef<float> > const& textures,
+                                               BBox2i & bbox_1,
+                                               std::vector< ImageView<float> > & results) const {
+
+    bbox_1 = bbox;
 
     // bugfix, ensure we see enough beyond current tile
     bbox_1.expand((int)ceil(std::max(m_search_radius_factor, 5.0)));
@@ -575,19 +612,16 @@ namespace asp{
     // Used to find which polygons are actually in the draw space.
     BBox3 local_3d_bbox = pixel_to_point_bbox(bbox_1);
 
-    ImageView<float> render_buffer;
-    ImageView<double> d_buffer, weights;
+    // The geometry is shared by all textures. Each texture gets its
+    // own output buffer, and its own renderer or binning grid.
+    int num_textures = textures.size();
+    std::vector< ImageView<float> > render_buffers(num_textures);
+    std::vector< ImageView<double> > d_buffers(num_textures), weights(num_textures);
     if (m_use_surface_sampling){
-      render_buffer.set_size(bbox_1.width(), bbox_1.height());
+      for (int t = 0; t < num_textures; t++)
+        render_buffers[t].set_size(bbox_1.width(), bbox_1.height());
     }
 
-    // Setup a software renderer and the orthographic view matrix
-    vw::stereo::SoftwareRenderer renderer(bbox_1.width(),
-					  bbox_1.height(),
-					  &render_buffer(0,0) );
-    renderer.Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
-		     local_3d_bbox.min().y(), local_3d_bbox.max().y());
-
     // Given a DEM grid point, search for cloud points within the
     // circular region of radius equal to grid size. As such, a
     // given cloud point may contribute to multiple DEM points, but
@@ -599,13 +633,29 @@ namespace asp{
       search_radius = std::max(m_spacing, m_default_spacing);
     else
       search_radius = m_spacing*m_search_radius_factor;
-    vw::stereo::Point2Grid point2grid(bbox_1.width(),
-				      bbox_1.height(),
-				      d_buffer, weights,
-				      local_3d_bbox.min().x(),
-				      local_3d_bbox.min().y(),
-				      m_spacing, m_default_spacing,
-				      search_radius, m_sigma_factor);
+
+    // Setup a software renderer and the orthographic view matrix, or a
+    // binning grid, for each texture
+    std::vector< boost::shared_ptr<vw::stereo::SoftwareRenderer> > renderers(num_textures);
+    std::vector< boost::shared_ptr<vw::stereo::Point2Grid> >       point2grids(num_textures);
+    for (int t = 0; t < num_textures; t++){
+      if (m_use_surface_sampling){
+        renderers[t] = boost::shared_ptr<vw::stereo::SoftwareRenderer>
+          (new vw::stereo::SoftwareRenderer(bbox_1.width(), bbox_1.height(),
+                                            &render_buffers[t](0,0) ));
+        renderers[t]->Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
+                              local_3d_bbox.min().y(), local_3d_bbox.max().y());
+      }else{
+        point2grids[t] = boost::shared_ptr<vw::stereo::Point2Grid>
+          (new vw::stereo::Point2Grid(bbox_1.width(),
+                                      bbox_1.height(),
+                                      d_buffers[t], weights[t],
+                                      local_3d_bbox.min().x(),
+                                      local_3d_bbox.min().y(),
+                                      m_spacing, m_default_spacing,
+                                      search_radius, m_sigma_factor));
+      }
+    }
 
     // Set up the default color value
     double min_val = 0.0;
@@ -618,16 +668,19 @@ namespace asp{
       min_val = m_default_value;
     }
 
-    std::valarray<float> vertices(10), intensities(5);
+    std::valarray<float> vertices(10);
+    std::vector< std::valarray<float> > intensities(num_textures, std::valarray<float>(5));
 
-    if (m_use_surface_sampling){
-      static const int NUM_COLOR_COMPONENTS = 1;  // We only need gray scale
-      static const int NUM_VERTEX_COMPONENTS = 2; // DEMs are 2D
-      renderer.Clear(min_val);
-      renderer.SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
-      renderer.SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[0]);
-    }else{
-      point2grid.Clear(min_val);
+    for (int t = 0; t < num_textures; t++){
+      if (m_use_surface_sampling){
+        static const int NUM_COLOR_COMPONENTS = 1;  // We only need gray scale
+        static const int NUM_VERTEX_COMPONENTS = 2; // DEMs are 2D
+        renderers[t]->Clear(min_val);
+        renderers[t]->SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
+        renderers[t]->SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[t][0]);
+      }else{
+        point2grids[t]->Clear(min_val);
+      }
     }
 
     // For each block in the DEM space intersecting local_3d_bbox,
@@ -657,18 +710,15 @@ namespace asp{
 
     }
 
+    results.resize(num_textures);
     if ( blocks_map.empty() ){
-      if (m_use_surface_sampling){
-	return prerasterize_type( render_buffer,
-				  BBox2i(-bbox_1.min().x(),
-					 -bbox_1.min().y(),
-					 cols(), rows()) );
-      }else{
-	return prerasterize_type( d_buffer,
-				  BBox2i(-bbox_1.min().x(),
-					 -bbox_1.min().y(),
-					 cols(), rows()) );
+      for (int t = 0; t < num_textures; t++){
+        if (m_use_surface_sampling)
+          results[t] = render_buffers[t];
+        else
+          results[t] = d_buffers[t];
       }
+      return;
     }
 
     // This is very important. When doing surface sampling, for each
@@ -705,7 +755,9 @@ namespace asp{
       // Crop back to the area of interest
       point_copy = crop(point_copy, block - biased_block.min());
 
-      ImageView<float> texture_copy = crop(m_texture, block );
+      std::vector< ImageView<float> > texture_copies(num_textures);
+      for (int t = 0; t < num_textures; t++)
+        texture_copies[t] = crop(textures[t], block );
 
       typedef ImageView<Vector3>::pixel_accessor PointAcc;
       PointAcc row_acc = point_copy.origin();
@@ -735,28 +787,32 @@ namespace asp{
 	      vertices[8] = (*point_ul).x(); // UL
 	      vertices[9] = (*point_ul).y();
 
-	      intensities[0] = texture_copy(col,  row);
-	      intensities[1] = texture_copy(col,row+1);
-	      intensities[2] = texture_copy(col+1,  row+1);
-	      intensities[3] = texture_copy(col+1,row);
-	      intensities[4] = texture_copy(col,row);
-
-	      if ( !boost::math::isnan((*point_ll).z()) ) {
-		// triangle 1 is: UL LL LR
-		renderer.DrawPolygon(0, 3);
-	      }
-	      if ( !boost::math::isnan((*point_ur).z()) ) {
-		// triangle 2 is: LR, UR, UL
-		renderer.DrawPolygon(2, 3);
-	      }
+              for (int t = 0; t < num_textures; t++){
+                ImageView<float> const& texture_copy = texture_copies[t];
+                intensities[t][0] = texture_copy(col,  row);
+                intensities[t][1] = texture_copy(col,row+1);
+                intensities[t][2] = texture_copy(col+1,  row+1);
+                intensities[t][3] = texture_copy(col+1,row);
+                intensities[t][4] = texture_copy(col,row);
+
+                if ( !boost::math::isnan((*point_ll).z()) ) {
+                  // triangle 1 is: UL LL LR
+                  renderers[t]->DrawPolygon(0, 3);
+                }
+                if ( !boost::math::isnan((*point_ur).z()) ) {
+                  // triangle 2 is: LR, UR, UL
+                  renderers[t]->DrawPolygon(2, 3);
+                }
+              }
 	    }
 
 	  }else{
 	    // The new engine
 	    if ( !boost::math::isnan(point_copy(col, row).z()) ){
-	      point2grid.AddPoint(point_copy(col, row).x(),
-				  point_copy(col, row).y(),
-				  texture_copy(col,  row));
+              for (int t = 0; t < num_textures; t++)
+                point2grids[t]->AddPoint(point_copy(col, row).x(),
+                                         point_copy(col, row).y(),
+                                         texture_copies[t](col,  row));
 	    }
 	  }
 	  point_ul.next_col();
@@ -766,23 +822,19 @@ namespace asp{
 
     }
 
-    if (!m_use_surface_sampling)
-      point2grid.normalize();
-
     // The software renderer returns an image which will render
     // upside down in most image formats, so we correct that here.
     // We also introduce transparent pixels into the result where
     // necessary.
     // To do: Here can do flipping in place.
-    ImageView< PixelGray<float> > result;
-    if (m_use_surface_sampling)
-      result = flip_vertical(render_buffer);
-    else
-      result = flip_vertical(d_buffer);
-
-    return prerasterize_type (result, BBox2i(-bbox_1.min().x(),
-					     -bbox_1.min().y(),
-					     cols(), rows()));
+    for (int t = 0; t < num_textures; t++){
+      if (m_use_surface_sampling){
+        results[t] = flip_vertical(render_buffers[t]);
+      }else{
+        point2grids[t]->normalize();
+        results[t] = flip_vertical(d_buffers[t]);
+      }
+    }
   }
 
 
@@ -74,6 +74,12 @@ namespace asp{
     // Function to convert pixel coordinates to the point domain
     BBox3 pixel_to_point_bbox( BBox2 const& px ) const;
 
+    // Rasterize the textures over the box expanded to bbox_1, one result per texture
+    void rasterize_textures(BBox2i const& bbox,
+                            std::vector< ImageViewRef<float> > const& textures,
+                            BBox2i & bbox_1,
+                            std::vector< ImageView<float> > & results) const;
+
   public:
     typedef PixelGray<float> pixel_type;
     typedef const PixelGray<float> result_type;
@@ -135,6 +141,17 @@ namespace asp{
     }
     /// \endcond
 
+    /// Rasterize several textures over the same geometry in one pass,
+    /// so the points are read and filtered only once. Each texture is
+    /// still binned, or rendered, on its own grid. The textures must
+    /// have the dimensions of the point image. Returns one plane per
+    /// texture.
+    ImageView<float> rasterize_textures(BBox2i const& bbox,
+                                        std::vector< ImageViewRef<float> > const& textures) const;
+
+    /// The point image, whose third channel is the height
+    ImageViewRef<Vector3> const& point_image() const { return m_point_image; }
+
     void set_use_alpha          (bool   val) { m_use_alpha       = val; }
     void set_use_minz_as_default(bool   val) { m_minz_as_default = val; }
     void set_default_value      (double val) { m_default_value   = val; }
@@ -25,65 +25,190 @@
 #include <vw/Image/Filter.h>
 #include <vw/Image/Convolution.h>
 #include <vw/Image/EdgeExtension.h>
+#include <vw/Image/Interpolation.h>
 #include <vw/Image/Manipulation.h>
 #include <vw/Image/MaskViews.h>
-#include <vw/Image/Transform.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Math/Statistics.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
-#include <vw/Stereo/DisparityMap.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/PhotometricOutlier.h>
-namespace fs = boost::filesystem;
 
 using namespace vw;
 using namespace asp;
 
+namespace {
+
+  typedef PixelMask<PixelGray<float> > MaskedGray;
+
+  // The absolute difference of the left image and of the right image
+  // projected into the left image by the disparity, in the given box
+  // of the left image. The difference is invalid, with the value
+  // zero, where the projected right image is zero, so outside the
+  // right image or where the disparity is invalid.
+  ImageView<MaskedGray>
+  photometric_diff(ImageViewRef<PixelGray<float> > const& left_image,
+                   ImageViewRef<PixelGray<float> > const& right_image,
+                   ImageView<PixelMask<Vector2f> > const& disp, // cropped to box
+                   BBox2i const& box) {
+
+    // Read only the part of the right image which the disparity
+    // points to, plus a pixel for interpolation.
+    BBox2 right_box;
+    for (int col = 0; col < disp.cols(); col++){
+      for (int row = 0; row < disp.rows(); row++){
+        if (is_valid(disp(col, row)))
+          right_box.grow(Vector2(col + box.min().x(), row + box.min().y())
+                         + Vector2(disp(col, row).child()));
+      }
+    }
+    BBox2i right_ibox;
+    if (!right_box.empty()) {
+      right_ibox = BBox2i(Vector2i(floor(right_box.min())),
+                          Vector2i(ceil(right_box.max())) + Vector2i(1, 1));
+      right_ibox.crop(bounding_box(right_image));
+    }
+    ImageView<PixelGray<float> > right_tile;
+    if (!right_ibox.empty())
+      right_tile = crop(right_image, right_ibox);
+
+    // Bilinear interpolation with zero edge extension, as done by
+    // transform() with a stereo::DisparityTransform.
+    InterpolationView<EdgeExtensionView<ImageView<PixelGray<float> >, ZeroEdgeExtension>,
+                      BilinearInterpolation>
+      right_interp = interpolate(right_tile, BilinearInterpolation(), ZeroEdgeExtension());
+
+    ImageView<PixelGray<float> > left_tile = crop(left_image, box);
+    ImageView<MaskedGray> diff(disp.cols(), disp.rows());
+    for (int col = 0; col < disp.cols(); col++){
+      for (int row = 0; row < disp.rows(); row++){
+        PixelGray<float> right_val = 0;
+        if (is_valid(disp(col, row)) && !right_ibox.empty()) {
+          Vector2 p = Vector2(col + box.min().x() - right_ibox.min().x(),
+                              row + box.min().y() - right_ibox.min().y())
+            + Vector2(disp(col, row).child());
+          right_val = right_interp(p.x(), p.y());
+        }
+        if (right_val.v() == 0) {
+          diff(col, row) = MaskedGray(0);
+          diff(col, row).invalidate();
+        }else{
+          diff(col, row) = MaskedGray(fabs(left_tile(col, row).v() - right_val.v()));
+        }
+      }
+    }
+    return diff;
+  }
+
+  // Invalidate the disparity around pixels where the left image and
+  // the projected right image differ by more than the threshold. Each
+  // tile is computed with a halo which is large enough that the result
+  // is the same as when processing the whole image at once.
+  class PhotometricOutlierView: public ImageViewBase<PhotometricOutlierView> {
+    ImageViewRef<PixelGray<float> >   m_left_image, m_right_image;
+    ImageViewRef<PixelMask<Vector2f> > m_disparity;
+    float m_thresh;
+    int   m_kernel_size, m_halo;
+  public:
+    PhotometricOutlierView(ImageViewRef<PixelGray<float> > const& left_image,
+                           ImageViewRef<PixelGray<float> > const& right_image,
+                           ImageViewRef<PixelMask<Vector2f> > const& disparity,
+                           float thresh, int kernel_size):
+      m_left_image(left_image), m_right_image(right_image), m_disparity(disparity),
+      m_thresh(thresh), m_kernel_size(kernel_size) {
+
+      // The grassfire distances matter only up to the kernel size, and
+      // they are blurred with a kernel of about 3.5 sigma radius.
+      double sigma = kernel_size/3;
+      int blur_radius = int(ceil(4*sigma)) + 1;
+      m_halo = kernel_size + 3*blur_radius + 1;
+    }
+
+    // Image View interface
+    typedef PixelMask<Vector2f> pixel_type;
+    typedef pixel_type          result_type;
+    typedef ProceduralPixelAccessor<PhotometricOutlierView> pixel_accessor;
+
+    inline int32 cols  () const { return m_disparity.cols(); }
+    inline int32 rows  () const { return m_disparity.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+    inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+      vw_throw(NoImplErr() << "PhotometricOutlierView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+      BBox2i big_box = bbox;
+      big_box.expand(m_halo);
+      big_box.crop(bounding_box(m_disparity));
+
+      ImageView<PixelMask<Vector2f> > disp = crop(m_disparity, big_box);
+      ImageView<MaskedGray> diff = photometric_diff(m_left_image, m_right_image,
+                                                    disp, big_box);
+
+      // Thresholding image and dilating
+      ImageView<PixelGray<float> > dust = threshold(apply_mask(diff), m_thresh, 1.0, 0.0);
+      ImageView<PixelGray<float> > grass;
+      grassfire(dust, grass);
+      dust = gaussian_filter(grass, m_kernel_size/3);
+
+      ImageView<pixel_type> cleaned_disp =
+        intersect_mask(disp, intersect_mask(create_mask(threshold(dust, m_kernel_size, 0.0, 1.0)),
+                                            diff));
+
+      return prerasterize_type(cleaned_disp, -big_box.min().x(), -big_box.min().y(),
+                               cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+} // end unnamed namespace
+
 void asp::photometric_outlier_rejection( vw::cartography::GdalWriteOptions const& opt,
                                          std::string const& prefix,
                                          std::string const& input_disparity,
                                          std::string & output_disparity,
                                          int kernel_size ) {
-  // Projecting right into perspective of left
-  DiskImageView<PixelGray<float> > right_disk_image(prefix+"-R.tif");
-  DiskImageView<PixelMask<Vector2f> > disparity_disk_image( input_disparity );
-  stereo::DisparityTransform trans( disparity_disk_image );
-
-  std::string cache_dir = "/tmp"; // modify here to use a different cache dir if needed
-  if (!fs::is_directory(cache_dir)) {
-    vw_out() << "\nCreating cache directory: " << cache_dir << std::endl;
-    fs::create_directories(cache_dir);
-  }
 
-  DiskCacheImageView<PixelGray<float> >
-    right_proj( transform( right_disk_image, trans, ZeroEdgeExtension() ), "tif", TerminalProgressCallback("asp","Projecting R:"), cache_dir);
-
-  // Differencing Left and Projected Right
-  ImageViewRef<PixelMask<PixelGray<float32> > > right_mask =
-    create_mask(right_proj);
-  DiskImageView<PixelGray<float32> > left_image(prefix+"-L.tif");
-  DiskCacheImageView<PixelGray<float> >
-    diff( abs(apply_mask(copy_mask(left_image,right_mask))-right_proj),
-          "tif", TerminalProgressCallback("asp","\tDifference:"),
-          cache_dir);
+  // Both passes below work on one tile at a time, so no image is
+  // cached in memory or on disk.
+  DiskImageView<PixelGray<float> > left_image(prefix+"-L.tif");
+  DiskImageView<PixelGray<float> > right_image(prefix+"-R.tif");
+  DiskImageView<PixelMask<Vector2f> > disparity( input_disparity );
+
+  // First pass: Find the threshold from the distribution of the
+  // differences between the left image and the projected right image.
   ChannelAccumulator<math::CDFAccumulator<float32> > cdf;
   cdf.resize(8000,2001);
-  for_each_pixel(diff, cdf);
+  int tile_size = 1024;
+  std::vector<BBox2i> tiles = subdivide_bbox(disparity, tile_size, tile_size);
+  TerminalProgressCallback tpc("asp", "\tDifference:");
+  for (size_t i = 0; i < tiles.size(); i++) {
+    tpc.report_progress(double(i)/tiles.size());
+    ImageView<PixelMask<Vector2f> > disp = crop(disparity, tiles[i]);
+    ImageView<MaskedGray> diff = photometric_diff(left_image, right_image, disp, tiles[i]);
+    for_each_pixel(apply_mask(diff), cdf);
+  }
+  tpc.report_finished();
   float thresh = cdf.quantile(0.99985); // Pulling out last bin of CDF
   vw_out() << "\t  Using threshold: " << thresh << "\n";
 
-  // Thresholding image and dilating
-  ImageView<PixelGray<float> > dust =
-    threshold(apply_mask(copy_mask(diff,right_mask)),thresh,1.0,0.0);
-  ImageView<PixelGray<float> > grass;
-  grassfire(dust,grass);
-  dust = gaussian_filter(grass,kernel_size/3);
-
-  ImageViewRef<PixelMask<Vector2f > > cleaned_disparity =
-    intersect_mask(disparity_disk_image,
-                   intersect_mask(create_mask(threshold(dust,kernel_size,0.0,1.0)),right_mask));
-
-  vw::cartography::block_write_gdal_image( prefix+"-FDust.tif",
-                          cleaned_disparity, opt,
+  // Second pass: Mask the disparity near the outliers, per tile.
+  output_disparity = prefix+"-FDust.tif";
+  vw::cartography::block_write_gdal_image( output_disparity,
+                          PhotometricOutlierView(left_image, right_image, disparity,
+                                                 thresh, kernel_size),
+                          opt,
                           TerminalProgressCallback("asp","Dust Removal:") );
 }
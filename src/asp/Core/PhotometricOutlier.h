@@ -33,6 +33,11 @@ namespace vw{
 }
 
 namespace asp {
+  /// Invalidate the disparity where the left image and the right
+  /// image projected by the disparity differ the most, and in a
+  /// neighborhood of kernel_size around such places. This writes
+  /// prefix-FDust.tif, whose name is returned in output_disparity.
+  /// The images are processed in tiles, in bounded memory.
   void photometric_outlier_rejection( vw::cartography::GdalWriteOptions const& opt,
                                       std::string const& prefix,
                                       std::string const& input_disparity,
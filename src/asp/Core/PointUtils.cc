@@ -1049,22 +1049,13 @@ std::string asp::prefix_from_pointcloud_filename(std::string const& filename) {
 vw::BBox3 asp::pointcloud_bbox(vw::ImageViewRef<vw::Vector3> const& point_image,
                                bool is_geodetic) {
 
-  vw::BBox3 result;
   vw::vw_out() << "Computing the point cloud bounding box.\n";
   vw::TerminalProgressCallback progress_bar("asp", "\t--> ");
 
-  for (int row=0; row < point_image.rows(); ++row ) {
-    progress_bar.report_fractional_progress(row, point_image.rows());
-    for (int col=0; col < point_image.cols(); ++col ) {
-      vw::Vector3 pt = point_image(col, row);
-      if ( (!is_geodetic && pt != vw::Vector3()) ||
-           (is_geodetic  &&  !boost::math::isnan(pt.z())) )
-        result.grow(pt);
-    }
-  }
-  progress_bar.report_finished();
+  PointBBoxAccumulator accum(is_geodetic);
+  parallel_accumulate(point_image, accum, progress_bar);
 
-  return result;
+  return accum.bbox;
 }
 
 // Find the average longitude for a given point image with lon, lat, height values
@@ -1076,10 +1067,9 @@ double asp::find_avg_lon(ImageViewRef<Vector3> const& point_image){
                                              point_image.rows()))/32.0);
   if (subsample_amt < 1 )
     subsample_amt = 1;
-  PixelAccumulator<MeanAccumulator<Vector3> > mean_accum;
-  for_each_pixel( subsample(point_image, subsample_amt),
-                  mean_accum,
-                  TerminalProgressCallback("asp","Statistics: ") );
+  MeanVector3Accumulator mean_accum;
+  parallel_accumulate(subsample(point_image, subsample_amt), mean_accum,
+                      TerminalProgressCallback("asp","Statistics: ") );
   Vector3 avg_location = mean_accum.value();
   double avg_lon = avg_location.x() >= 0 ? 0 : 180;
   sw.stop();
@@ -24,7 +24,10 @@
 #define __ASP_CORE_POINT_UTILS_H__
 
 #include <string>
+#include <boost/math/special_functions/fpclassify.hpp>
 #include <vw/Core/Functors.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Settings.h>
 #include <vw/Image/PerPixelViews.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/Matrix.h>
@@ -331,6 +334,43 @@ namespace asp {
   vw::BBox3 pointcloud_bbox(vw::ImageViewRef<vw::Vector3> const& point_image,
                             bool is_geodetic);
 
+  /// Apply an accumulator to all pixels of an image. The image is
+  /// split into tiles which are processed in parallel, each with its
+  /// own copy of the accumulator, which is merged into the given one
+  /// at the end. The given accumulator must be empty on input, as each
+  /// tile starts from a copy of it. AccumT must take a pixel in
+  /// operator() and have a function merge(AccumT const&).
+  template <class ViewT, class AccumT>
+  void parallel_accumulate(vw::ImageViewBase<ViewT> const& image, AccumT & accum,
+                           vw::ProgressCallback const& progress
+                           = vw::ProgressCallback::dummy_instance());
+
+  /// Accumulator for the bounding box of the valid points of a
+  /// cloud. See pointcloud_bbox() for which points are valid.
+  struct PointBBoxAccumulator {
+    bool      is_geodetic;
+    vw::BBox3 bbox;
+    PointBBoxAccumulator(bool is_geodetic_in): is_geodetic(is_geodetic_in){}
+    void operator()(vw::Vector3 const& pt) {
+      if ( (!is_geodetic && pt != vw::Vector3()) ||
+           (is_geodetic  && !boost::math::isnan(pt.z())) )
+        bbox.grow(pt);
+    }
+    void merge(PointBBoxAccumulator const& other) {
+      if (!other.bbox.empty()) bbox.grow(other.bbox);
+    }
+  };
+
+  /// Accumulator for the mean of vectors
+  struct MeanVector3Accumulator {
+    vw::Vector3 sum;
+    double      count;
+    MeanVector3Accumulator(): count(0){}
+    void operator()(vw::Vector3 const& pt) { sum += pt; count++; }
+    void merge(MeanVector3Accumulator const& other) { sum += other.sum; count += other.count; }
+    vw::Vector3 value() const { return (count > 0) ? sum/count : vw::Vector3(); }
+  };
+
 //===================================================================================
 // Template function definitions
 
@@ -345,10 +385,21 @@ vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const
     shift = vw::str_to_vec<vw::Vector3>(shift_str);
   }
 
+  // A quantized cloud stores integer multiples of this scale
+  double scale = 0.0;
+  std::string scale_str;
+  if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_SCALE_TAG_STR, scale_str)){
+    scale = atof(scale_str.c_str());
+  }
+
   // Read the first m channels
   vw::ImageViewRef< vw::Vector<double, m> > out_image
     = vw::read_channels<m, double>(filename, 0);
 
+  // Undo the quantization. Zero pixels stay zero, hence invalid.
+  if (scale > 0.0)
+    out_image = scale*out_image;
+
   // Add the shift back to the first several channels.
   if (shift != vw::Vector3())
     out_image = subtract_shift(out_image, -shift);
@@ -357,6 +408,61 @@ vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const
 }
 
 
+namespace point_utils_private {
+
+  /// Accumulate the pixels of one tile into the accumulator for that tile
+  template <class ViewT, class AccumT>
+  class AccumulateTask : public vw::Task, private boost::noncopyable {
+    ViewT const&  m_image;
+    vw::BBox2i    m_bbox;
+    AccumT      & m_accum;
+    vw::Mutex   & m_mutex;
+    vw::ProgressCallback const& m_progress;
+    double        m_inc_amt;
+  public:
+    AccumulateTask(ViewT const& image, vw::BBox2i const& bbox, AccumT & accum,
+                   vw::Mutex & mutex, vw::ProgressCallback const& progress, double inc_amt):
+      m_image(image), m_bbox(bbox), m_accum(accum), m_mutex(mutex),
+      m_progress(progress), m_inc_amt(inc_amt){}
+
+    void operator()() {
+      vw::ImageView<typename ViewT::pixel_type> tile = crop(m_image, m_bbox);
+      for (int row = 0; row < tile.rows(); row++)
+        for (int col = 0; col < tile.cols(); col++)
+          m_accum(tile(col, row));
+
+      vw::Mutex::Lock lock(m_mutex);
+      m_progress.report_incremental_progress(m_inc_amt);
+    }
+  };
+
+} // end namespace point_utils_private
+
+template <class ViewT, class AccumT>
+void parallel_accumulate(vw::ImageViewBase<ViewT> const& image, AccumT & accum,
+                         vw::ProgressCallback const& progress){
+
+  int tile_size = vw::vw_settings().default_tile_size();
+  std::vector<vw::BBox2i> tiles = subdivide_bbox(image.impl(), tile_size, tile_size);
+
+  // Each tile starts from a copy of the (empty) input accumulator
+  std::vector<AccumT> results(tiles.size(), accum);
+  vw::Mutex mutex;
+  vw::FifoWorkQueue queue(vw::vw_settings().default_num_threads());
+  typedef point_utils_private::AccumulateTask<ViewT, AccumT> task_type;
+  for (size_t i = 0; i < tiles.size(); i++) {
+    boost::shared_ptr<task_type> task(new task_type(image.impl(), tiles[i], results[i],
+                                                    mutex, progress, 1.0/tiles.size()));
+    queue.add_task(task);
+  }
+  queue.join_all();
+  progress.report_finished();
+
+  // Merge in tile order, so the result does not depend on the number of threads
+  for (size_t i = 0; i < results.size(); i++)
+    accum.merge(results[i]);
+}
+
 /// Read given files and form an image composite.
 template<class PixelT>
 vw::ImageViewRef<PixelT> form_point_cloud_composite(std::vector<std::string> const & files,
@@ -186,7 +186,9 @@ namespace asp {
       ("corr-tile-size",         po::value(&global.corr_tile_size_ovr)->default_value(ASPGlobalOptions::corr_tile_size()),
                      "Override the default tile size used for processing.")
       ("sgm-collar-size",        po::value(&global.sgm_collar_size)->default_value(512),
-                     "Extend SGM calculation to this distance to increase accuracy at tile borders.");
+                     "Extend SGM calculation to this distance to increase accuracy at tile borders.")
+      ("blend-all-tiles",        po::bool_switch(&global.blend_all_tiles)->default_value(false)->implicit_value(true),
+                     "With parallel_stereo and SGM, blend all tiles in one pass, reading each tile only once.");
 
 
     po::options_description backwards_compat_options("Aliased backwards compatibility options");
@@ -300,6 +302,8 @@ namespace asp {
                                             "How much to round the output point cloud values, in meters (more rounding means less precision but potentially smaller size on disk). The inverse of a power of 2 is suggested. Default: 1/2^10 for Earth and proportionally less for smaller bodies.")
       ("save-double-precision-point-cloud", po::bool_switch(&global.save_double_precision_point_cloud)->default_value(false)->implicit_value(true),
                                             "Save the final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at twice the storage).")
+      ("save-quantized-point-cloud",        po::bool_switch(&global.save_quantized_point_cloud)->default_value(false)->implicit_value(true),
+                                            "Save the final point cloud as 32-bit integers, which are the offsets from the point cloud center in multiples of --point-cloud-rounding-error. More precise than float and compresses better.")
       ("compute-point-cloud-center-only",   po::bool_switch(&global.compute_point_cloud_center_only)->default_value(false)->implicit_value(true),
                                             "Only compute the center of triangulated point cloud and exit.")
       ("skip-point-cloud-center-comp", po::bool_switch(&global.skip_point_cloud_center_comp)->default_value(false)->implicit_value(true),
@@ -310,6 +314,8 @@ namespace asp {
        "Compute the piecewise adjustments as part of jitter correction, and then stop.")
       ("skip-computing-piecewise-adjustments", po::bool_switch(&global.skip_computing_piecewise_adjustments)->default_value(false)->implicit_value(true),
        "Skip computing the piecewise adjustments for jitter, they should have been done by now.")
+      ("fuse-stages",                       po::bool_switch(&global.fuse_stages)->default_value(false)->implicit_value(true),
+                                            "Do correlation, refinement, and filtering for each tile as part of triangulation, without writing D.tif, RD.tif, and F.tif. Only the low-resolution disparity must exist.")
       ;
   }
 
@@ -355,6 +361,8 @@ namespace asp {
     StereoSettings& global = stereo_settings();
     (*this).add_options()
       ("trans-crop-win", po::value(&global.trans_crop_win)->default_value(BBox2i(0, 0, 0, 0), "xoff yoff xsize ysize"), "Left image crop window in respect to L.tif. This is an internal option. [default: use the entire image].")
+      ("tile-worker", po::bool_switch(&global.tile_worker)->default_value(false)->implicit_value(true),
+       "Process a sequence of tiles read from standard input, one per line, as: <tile prefix> <xoff> <yoff> <xsize> <ysize>, keeping the stereo session loaded between tiles. This is an internal option used by parallel_stereo.")
       ("attach-georeference-to-lowres-disparity", po::bool_switch(&global.attach_georeference_to_lowres_disparity)->default_value(false)->implicit_value(true),
        "If input images are georeferenced, make D_sub and D_sub_spread georeferenced.");
   }
@@ -140,6 +140,7 @@ namespace asp {
     int    corr_blob_filter_area;     // Use blob filtering in pyramidal correlation
     int    corr_tile_size_ovr;        // Override the default tile size used for processing.
     int    sgm_collar_size;           // Extra tile padding used for SGM calculation.
+    bool   blend_all_tiles;           // Blend all tiles of a parallel_stereo run in one pass.
 
     // Subpixel Options
     vw::uint16 subpixel_mode;         // 0 = none
@@ -199,8 +200,10 @@ namespace asp {
     bool   use_least_squares;                 // Use a more rigorous triangulation
     bool   save_double_precision_point_cloud; // Save final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at 2x the storage).
     double point_cloud_rounding_error;        // How much to round the output point cloud values
+    bool   save_quantized_point_cloud;        // Save the point cloud as integer multiples of the rounding error
     bool   compute_point_cloud_center_only;   // Only compute the center of triangulated point cloud and exit.
     bool   skip_point_cloud_center_comp;
+    bool   fuse_stages;                       // Correlate, refine, and filter each tile during triangulation.
 
     // stereo_gui options
     int grid_cols;
@@ -219,6 +222,7 @@ namespace asp {
 
     // Undocumented options. We don't want these exposed to the user.
     vw::BBox2i trans_crop_win;        // Left image crop window in respect to L.tif.
+    bool tile_worker;                 // Process the tiles listed on standard input.
     bool attach_georeference_to_lowres_disparity;
 
     // Internal variable, to ensure we always initialize this class before using it
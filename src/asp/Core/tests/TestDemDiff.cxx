@@ -0,0 +1,130 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/DemDiff.h>
+
+using namespace vw;
+using namespace vw::cartography;
+
+// A UTM georeference with 30 meter pixels and the given upper-left corner
+GeoReference utm_georef(double x0, double y0) {
+  GeoReference georef;
+  georef.set_well_known_geogcs("WGS84");
+  georef.set_UTM(10);
+  Matrix3x3 t = math::identity_matrix<3>();
+  t(0,0) = 30;  t(0,2) = x0;
+  t(1,1) = -30; t(1,2) = y0;
+  georef.set_transform(t);
+  return georef;
+}
+
+// A DEM whose height is linear in the projected coordinates, so that
+// bilinear interpolation into it is exact.
+ImageView<double> linear_dem(GeoReference const& georef, int cols, int rows) {
+  ImageView<double> dem(cols, rows);
+  for (int col = 0; col < cols; col++) {
+    for (int row = 0; row < rows; row++) {
+      Vector2 p = georef.pixel_to_point(Vector2(col, row));
+      dem(col, row) = 0.5*(p[0] - 500000) + 0.25*(p[1] - 4100000);
+    }
+  }
+  return dem;
+}
+
+// Resample dem2 onto the grid of dem1 and compare with dem1 where valid
+int count_matches(GeoReference const& georef1, ImageView<double> const& dem1,
+                  GeoReference const& georef2, ImageView<double> const& dem2,
+                  bool is_shift, Vector2 const& shift, double tol) {
+  asp::DemOnDemGridView view(pixel_cast<PixelMask<double> >(dem2),
+                             dem1.cols(), dem1.rows(),
+                             GeoTransform(georef2, georef1), is_shift, shift);
+  ImageView<PixelMask<double> > resampled = view;
+  int count = 0;
+  for (int col = 0; col < dem1.cols(); col++) {
+    for (int row = 0; row < dem1.rows(); row++) {
+      if (!is_valid(resampled(col, row)))
+        continue;
+      EXPECT_NEAR(dem1(col, row), resampled(col, row).child(), tol);
+      count++;
+    }
+  }
+  return count;
+}
+
+TEST( DemDiff, ShiftedGrids ) {
+
+  // An integer shift of 3 columns and 2 rows
+  GeoReference georef1 = utm_georef(500000, 4100000);
+  GeoReference georef2 = utm_georef(500090, 4099940);
+  ImageView<double> dem1 = linear_dem(georef1, 50, 40);
+  ImageView<double> dem2 = linear_dem(georef2, 50, 40);
+
+  Vector2 shift;
+  ASSERT_TRUE(asp::dem_grid_shift(georef1, bounding_box(dem1), georef2, bounding_box(dem2),
+                                  shift));
+  EXPECT_VECTOR_NEAR(Vector2(-3, -2), shift, 1e-12);
+  EXPECT_EQ(47*38, count_matches(georef1, dem1, georef2, dem2, true, shift, 1e-6));
+
+  // A shift of half a pixel
+  georef2 = utm_georef(500015, 4100000);
+  dem2 = linear_dem(georef2, 50, 40);
+  ASSERT_TRUE(asp::dem_grid_shift(georef1, bounding_box(dem1), georef2, bounding_box(dem2),
+                                  shift));
+  EXPECT_VECTOR_NEAR(Vector2(-0.5, 0), shift, 1e-9);
+  EXPECT_GT(count_matches(georef1, dem1, georef2, dem2, true, shift, 1e-6), 0);
+
+  // No overlap
+  georef2 = utm_georef(600000, 4100000);
+  EXPECT_FALSE(asp::dem_grid_shift(georef1, bounding_box(dem1), georef2, bounding_box(dem2),
+                                   shift));
+}
+
+TEST( DemDiff, ReprojectedGrids ) {
+
+  // The second DEM is in UTM, and the first is a longitude-latitude
+  // grid inside of it.
+  GeoReference georef2 = utm_georef(500000, 4100000);
+  ImageView<double> dem2 = linear_dem(georef2, 200, 200);
+
+  GeoReference georef1;
+  georef1.set_well_known_geogcs("WGS84");
+  Vector2 corner = georef2.pixel_to_lonlat(Vector2(20, 20));
+  Matrix3x3 t = math::identity_matrix<3>();
+  t(0,0) = 0.0003;  t(0,2) = corner[0];
+  t(1,1) = -0.0003; t(1,2) = corner[1];
+  georef1.set_transform(t);
+
+  // The height of the first DEM at each pixel, found exactly
+  ImageView<double> dem1(70, 60);
+  GeoTransform gt(georef2, georef1);
+  for (int col = 0; col < dem1.cols(); col++) {
+    for (int row = 0; row < dem1.rows(); row++) {
+      Vector2 p = georef2.pixel_to_point(gt.reverse(Vector2(col, row)));
+      dem1(col, row) = 0.5*(p[0] - 500000) + 0.25*(p[1] - 4100000);
+    }
+  }
+
+  Vector2 shift;
+  EXPECT_FALSE(asp::dem_grid_shift(georef1, bounding_box(dem1), georef2, bounding_box(dem2),
+                                   shift));
+
+  // The heights change by about 17 m per pixel, and the interpolated
+  // locations are within 1e-3 pixels of the exact ones.
+  EXPECT_EQ(70*60, count_matches(georef1, dem1, georef2, dem2, false, Vector2(), 0.02));
+}
@@ -0,0 +1,65 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/LocalHomography.h>
+#include <fstream>
+
+using namespace vw;
+using namespace asp;
+
+TEST( LocalHomography, WriteRead ) {
+
+  ImageView<Matrix3x3> local_hom(3, 2);
+  for (int col = 0; col < local_hom.cols(); col++){
+    for (int row = 0; row < local_hom.rows(); row++){
+      Matrix3x3 H = math::identity_matrix<3>();
+      H(0, 2) = col;
+      H(1, 2) = row;
+      H(0, 1) = 0.5*col - row;
+      local_hom(col, row) = H;
+    }
+  }
+
+  UnlinkName file("local_hom.bin");
+  write_local_homographies(file, local_hom);
+
+  ImageView<Matrix3x3> local_hom2;
+  read_local_homographies(file, local_hom2);
+  ASSERT_EQ(local_hom.cols(), local_hom2.cols());
+  ASSERT_EQ(local_hom.rows(), local_hom2.rows());
+  for (int col = 0; col < local_hom.cols(); col++)
+    for (int row = 0; row < local_hom.rows(); row++)
+      EXPECT_MATRIX_EQ(local_hom(col, row), local_hom2(col, row));
+}
+
+TEST( LocalHomography, RejectForeign ) {
+
+  // A file in the old format, with just the size and the matrices
+  UnlinkName file("old_local_hom.bin");
+  {
+    std::ofstream fh(file.c_str(), std::ios::binary);
+    int32 size[2] = {1, 1};
+    double vals[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+    fh.write((char*)size, sizeof(size));
+    fh.write((char*)vals, sizeof(vals));
+  }
+
+  ImageView<Matrix3x3> local_hom;
+  EXPECT_THROW(read_local_homographies(file, local_hom), IOErr);
+}
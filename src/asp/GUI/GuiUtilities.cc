@@ -30,8 +30,8 @@
 #include <vw/Math/EulerAngles.h>
 #include <vw/Image/Algorithms.h>
 #include <vw/Cartography/GeoTransform.h>
-#include <vw/tools/hillshade.h>
 #include <vw/Core/RunOnce.h>
+#include <vw/Core/Settings.h>
 #include <asp/GUI/GuiUtilities.h>
 
 using namespace vw;
@@ -108,59 +108,6 @@ QRect bbox2qrect(BBox2 const& B){
                round(B.width()), round(B.height()));
 }
 
-bool write_hillshade(vw::cartography::GdalWriteOptions const& opt,
-                     double azimuth, double elevation,
-                     std::string const& input_file,
-                     std::string      & output_file) {
-
-  // Sanity check: Must have a georeference
-  cartography::GeoReference georef;
-  bool has_georef = vw::cartography::read_georeference(georef, input_file);
-  if (!has_georef) {
-    popUp("No georeference present in: " + input_file + ".");
-    return false;
-  }
-
-  double scale       = 0.0;
-  double blur_sigma  = std::numeric_limits<double>::quiet_NaN();
-  double nodata_val  = std::numeric_limits<double>::quiet_NaN();
-  vw::read_nodata_val(input_file, nodata_val);
-  std::ostringstream oss;
-  oss << "_hillshade_a" << azimuth << "_e" << elevation << ".tif"; 
-  std::string suffix = oss.str();
-
-  output_file = vw::mosaic::filename_from_suffix1(input_file, suffix);
-  try {
-    DiskImageView<float> input(input_file);
-    try{
-      bool will_write = vw::mosaic::overwrite_if_no_good(input_file, output_file,
-                                             input.cols(), input.rows());
-      if (will_write){
-        vw_out() << "Writing: " << output_file << std::endl;
-        vw::do_multitype_hillshade(input_file, output_file, azimuth, elevation, scale,
-                                   nodata_val, blur_sigma);
-      }
-    }catch(...){
-      // Failed to write, presumably because we have no write access.
-      // Write the file in the current dir.
-      vw_out() << "Failed to write: " << output_file << "\n";
-      output_file = vw::mosaic::filename_from_suffix2(input_file, suffix);
-      bool will_write = vw::mosaic::overwrite_if_no_good(input_file, output_file,
-                                             input.cols(), input.rows());
-      if (will_write){
-        vw_out() << "Writing: " << output_file << std::endl;
-        vw::do_multitype_hillshade(input_file,  output_file, azimuth, elevation, scale,
-                                   nodata_val, blur_sigma);
-      }
-    }
-  } catch (const Exception& e) {
-    popUp(e.what());
-    return false;
-  }
-
-  return true;
-}
-
 void imageData::read(std::string const& name_in, vw::cartography::GdalWriteOptions const& opt,
                      bool use_georef){
   m_opt = opt;
@@ -182,6 +129,18 @@ void imageData::read(std::string const& name_in, vw::cartography::GdalWriteOptio
     lonlat_bbox = georef.pixel_to_lonlat_bbox(image_bbox);
 }
 
+vw::Vector2 imageData::ground_pixel_size() const {
+  Matrix3x3 T = georef.transform();
+  Vector2 pixel_size(std::abs(T(0, 0)), std::abs(T(1, 1)));
+
+  // Same convention as the hillshade tool
+  if (!georef.is_projected()) {
+    double meters_per_degree = 2*M_PI*georef.datum().semi_major_axis()/360.0;
+    pixel_size *= meters_per_degree;
+  }
+  return pixel_size;
+}
+
 vw::Vector2 QPoint2Vec(QPoint const& qpt) {
   return vw::Vector2(qpt.x(), qpt.y());
 }
@@ -351,7 +310,8 @@ double DiskImagePyramidMultiChannel::get_nodata_val() const {
   
 void DiskImagePyramidMultiChannel::get_image_clip(double scale_in, vw::BBox2i region_in,
                   bool highlight_nodata,
-                  QImage & qimg, double & scale_out, vw::BBox2i & region_out) const{
+                  QImage & qimg, double & scale_out, vw::BBox2i & region_out,
+                  vw::Vector2 const& stretch_range) const{
 
   bool scale_pixels = (m_type == CH1_DOUBLE);
   
@@ -360,7 +320,8 @@ void DiskImagePyramidMultiChannel::get_image_clip(double scale_in, vw::BBox2i re
     ImageView<double> clip;
     m_img_ch1_double.get_image_clip(scale_in, region_in, clip,
                                   scale_out, region_out);
-    formQimage(highlight_nodata, scale_pixels, m_img_ch1_double.get_nodata_val(), clip, qimg);
+    formQimage(highlight_nodata, scale_pixels, m_img_ch1_double.get_nodata_val(), clip, qimg,
+               stretch_range);
   } else if (m_type == CH2_UINT8) {
     ImageView<Vector<vw::uint8, 2> > clip;
     m_img_ch2_uint8.get_image_clip(scale_in, region_in, clip,
@@ -381,6 +342,108 @@ void DiskImagePyramidMultiChannel::get_image_clip(double scale_in, vw::BBox2i re
   }
 }
 
+vw::Vector2 DiskImagePyramidMultiChannel::get_stretch_range() const {
+
+  if (m_type != CH1_DOUBLE)
+    return Vector2();
+
+  // A scale this large makes the pyramid return its coarsest level
+  ImageView<double> clip;
+  double scale_out;
+  BBox2i region_out;
+  m_img_ch1_double.get_image_clip(std::max(m_cols, m_rows), BBox2i(0, 0, m_cols, m_rows),
+                                  clip, scale_out, region_out);
+
+  double nodata_val = m_img_ch1_double.get_nodata_val();
+  double min_val = std::numeric_limits<double>::max();
+  double max_val = -std::numeric_limits<double>::max();
+  for (int col = 0; col < clip.cols(); col++){
+    for (int row = 0; row < clip.rows(); row++){
+      double v = clip(col, row);
+      if (v <= nodata_val || std::isnan(v)) continue;
+      if (v < min_val) min_val = v;
+      if (v > max_val) max_val = v;
+    }
+  }
+  if (min_val > max_val) // no valid pixels
+    return Vector2();
+  if (min_val >= max_val)
+    max_val = min_val + 1.0;
+
+  return Vector2(min_val, max_val);
+}
+
+namespace {
+  bool is_valid_dem_pixel(ImageView<double> const& dem, double nodata_val, int x, int y) {
+    if (x < 0 || y < 0 || x >= dem.cols() || y >= dem.rows())
+      return false;
+    double v = dem(x, y);
+    return !(v <= nodata_val) && !std::isnan(v);
+  }
+
+  // The change of the DEM per pixel at (x, y) along (dx, dy), using
+  // central differences if both neighbors are valid.
+  double dem_diff(ImageView<double> const& dem, double nodata_val,
+                  int x, int y, int dx, int dy) {
+    bool has_prev = is_valid_dem_pixel(dem, nodata_val, x - dx, y - dy);
+    bool has_next = is_valid_dem_pixel(dem, nodata_val, x + dx, y + dy);
+    if (has_prev && has_next)
+      return (dem(x + dx, y + dy) - dem(x - dx, y - dy))/2.0;
+    if (has_next)
+      return dem(x + dx, y + dy) - dem(x, y);
+    if (has_prev)
+      return dem(x, y) - dem(x - dx, y - dy);
+    return 0.0;
+  }
+}
+
+void DiskImagePyramidMultiChannel::get_hillshade_clip(double scale_in, vw::BBox2i region_in,
+                                                      HillshadeParams const& hillshade,
+                                                      QImage & qimg, double & scale_out,
+                                                      vw::BBox2i & region_out) const {
+  if (m_type != CH1_DOUBLE)
+    vw_throw(ArgumentErr() << "Hill-shading makes sense only for single-channel images.\n");
+
+  // Read a margin around the region, to find the slopes at its
+  // boundary. It is at least one pixel at the level being read.
+  BBox2i read_box = region_in;
+  read_box.expand(2*int(ceil(scale_in)));
+  read_box.crop(BBox2i(0, 0, m_cols, m_rows));
+  ImageView<double> dem;
+  BBox2i dem_box;
+  m_img_ch1_double.get_image_clip(scale_in, read_box, dem, scale_out, dem_box);
+
+  // The requested region at the level that was read
+  int scale = std::max(1, int(round(scale_out)));
+  region_out = BBox2i(Vector2i(region_in.min().x()/scale, region_in.min().y()/scale),
+                      Vector2i((region_in.max().x() + scale - 1)/scale,
+                               (region_in.max().y() + scale - 1)/scale));
+  region_out.crop(dem_box);
+
+  // Zero azimuth is towards the right of the image, and it grows
+  // counter-clockwise. The image y axis points down.
+  double az = hillshade.azimuth*M_PI/180.0, el = hillshade.elevation*M_PI/180.0;
+  Vector3 light(cos(el)*cos(az), -cos(el)*sin(az), sin(el));
+  double dx = hillshade.pixel_size[0]*scale_out, dy = hillshade.pixel_size[1]*scale_out;
+  double nodata_val = m_img_ch1_double.get_nodata_val();
+
+  qimg = QImage(region_out.width(), region_out.height(), QImage::Format_ARGB32_Premultiplied);
+  for (int col = 0; col < region_out.width(); col++){
+    for (int row = 0; row < region_out.height(); row++){
+      int x = col + region_out.min().x() - dem_box.min().x();
+      int y = row + region_out.min().y() - dem_box.min().y();
+      if (!is_valid_dem_pixel(dem, nodata_val, x, y)) {
+        qimg.setPixel(col, row, QColor(0, 0, 0, 0).rgba()); // transparent
+        continue;
+      }
+      Vector3 normal(-dem_diff(dem, nodata_val, x, y, 1, 0)/dx,
+                     -dem_diff(dem, nodata_val, x, y, 0, 1)/dy, 1.0);
+      double v = round(255*std::max(0.0, dot_prod(normal, light))/norm_2(normal));
+      qimg.setPixel(col, row, QColor(v, v, v, 255).rgba());
+    }
+  }
+}
+
 std::string DiskImagePyramidMultiChannel::get_value_as_str(int32 x, int32 y) const {
 
   // Below we cast from Vector<uint8> to Vector<double>, as the former
@@ -412,6 +475,277 @@ double DiskImagePyramidMultiChannel::get_value_as_double(int32 x, int32 y) const
   return 0;
 }
 
+const int TileRenderer::TILE_SIZE;
+const int TileRenderer::MAX_CACHED_TILES;
+const int TileRenderer::MAX_LEVEL;
+
+bool TileRenderer::TileKey::operator<(TileKey const& k) const {
+  if (img              != k.img             ) return img              < k.img;
+  if (highlight_nodata != k.highlight_nodata) return highlight_nodata < k.highlight_nodata;
+  if (hillshade.on     != k.hillshade.on    ) return hillshade.on     < k.hillshade.on;
+  if (hillshade.on) {
+    if (hillshade.azimuth   != k.hillshade.azimuth  ) return hillshade.azimuth   < k.hillshade.azimuth;
+    if (hillshade.elevation != k.hillshade.elevation) return hillshade.elevation < k.hillshade.elevation;
+  }
+  if (level            != k.level           ) return level            < k.level;
+  if (col              != k.col             ) return col              < k.col;
+  return row < k.row;
+}
+
+namespace {
+  // A rendered tile to be drawn, and the area of the clip it may cover
+  struct TilePiece {
+    QImage qimg;
+    QRectF dest, clip;
+  };
+}
+
+// Render the queued tiles until the renderer shuts down.
+class TileRenderer::Worker {
+  TileRenderer & m_renderer;
+public:
+  Worker(TileRenderer & renderer): m_renderer(renderer) {}
+
+  void operator()() {
+    TileKey key(NULL, false, HillshadeParams(), 0, 0, 0);
+    Vector2 stretch_range;
+    bool    have_stretch_range;
+    while (m_renderer.next_request(key, stretch_range, have_stretch_range)) {
+
+      Tile tile;
+      tile.scale = 1.0;
+      try {
+        if (key.hillshade.on) {
+          key.img->get_hillshade_clip(double(1 << key.level), tile_box(key), key.hillshade,
+                                      tile.qimg, tile.scale, tile.region);
+        }else{
+          // Single-channel images are scaled with the same range in all
+          // tiles, as otherwise the tile seams would show.
+          if (!have_stretch_range) {
+            stretch_range = key.img->get_stretch_range();
+            m_renderer.set_stretch_range(key.img, stretch_range);
+          }
+          key.img->get_image_clip(double(1 << key.level), tile_box(key),
+                                  key.highlight_nodata,
+                                  tile.qimg, tile.scale, tile.region, stretch_range);
+        }
+      }catch (const std::exception & e) {
+        // Cache an empty tile, so that we don't try again on every redraw
+        vw_out(WarningMessage) << "Failed to render a tile: " << e.what() << std::endl;
+        tile.qimg = QImage();
+      }
+
+      m_renderer.finish(key, tile);
+    }
+  }
+};
+
+TileRenderer::TileRenderer(): m_new_tiles(false), m_stop(false) {
+  // Reading tiles is mostly disk-bound, so a few threads are enough
+  int num_threads = std::max(1, std::min(4, int(vw_settings().default_num_threads())));
+  for (int i = 0; i < num_threads; i++) {
+    boost::shared_ptr<Worker> worker(new Worker(*this));
+    m_threads.push_back(boost::shared_ptr<Thread>(new Thread(worker)));
+  }
+}
+
+TileRenderer::~TileRenderer() {
+  {
+    Mutex::Lock lock(m_mutex);
+    m_stop = true;
+    m_pending.clear();
+    m_queued.clear();
+    m_work_cond.notify_all();
+  }
+  for (size_t i = 0; i < m_threads.size(); i++)
+    m_threads[i]->join();
+}
+
+vw::BBox2i TileRenderer::tile_box(TileKey const& key) {
+  int len = TILE_SIZE << key.level;
+  BBox2i box(key.col*len, key.row*len, len, len);
+  box.crop(BBox2i(0, 0, key.img->cols(), key.img->rows()));
+  return box;
+}
+
+bool TileRenderer::get_image_clip(DiskImagePyramidMultiChannel const& img,
+                                  double scale_in, vw::BBox2i region_in,
+                                  bool highlight_nodata, HillshadeParams const& hillshade,
+                                  QImage & qimg, double & scale_out,
+                                  vw::BBox2i & region_out) {
+
+  region_in.crop(BBox2i(0, 0, img.cols(), img.rows()));
+
+  // The coarsest level which still has at least as many pixels as
+  // the screen, just like the pyramid itself would pick.
+  int level = 0;
+  while (level < MAX_LEVEL && double(2 << level) <= scale_in)
+    level++;
+  int scale = 1 << level;
+  scale_out = scale;
+
+  // The region at this level, in which the tiles are assembled
+  region_out = BBox2i();
+  if (!region_in.empty()) {
+    region_out.min() = Vector2i(region_in.min().x()/scale, region_in.min().y()/scale);
+    region_out.max() = Vector2i((region_in.max().x() + scale - 1)/scale,
+                                (region_in.max().y() + scale - 1)/scale);
+  }
+
+  qimg = QImage(std::max(region_out.width(), 1), std::max(region_out.height(), 1),
+                QImage::Format_ARGB32_Premultiplied);
+  qimg.fill(Qt::transparent);
+  if (region_out.empty())
+    return true;
+
+  std::vector<TilePiece> pieces;
+
+  bool complete = true;
+  Vector2 center = (Vector2(region_out.min()) + Vector2(region_out.max()))/2.0;
+  double  diag   = std::max(1.0, norm_2(Vector2(region_out.size())));
+  int beg_col = region_out.min().x()/TILE_SIZE, end_col = (region_out.max().x() - 1)/TILE_SIZE;
+  int beg_row = region_out.min().y()/TILE_SIZE, end_row = (region_out.max().y() - 1)/TILE_SIZE;
+
+  {
+    Mutex::Lock lock(m_mutex);
+
+    for (int row = beg_row; row <= end_row; row++) {
+      for (int col = beg_col; col <= end_col; col++) {
+
+        TileKey key(&img, highlight_nodata, hillshade, level, col, row);
+        QRectF cell(col*TILE_SIZE - region_out.min().x(), row*TILE_SIZE - region_out.min().y(),
+                    TILE_SIZE, TILE_SIZE);
+
+        // Tiles closest to the center of the view are rendered first
+        Vector2 tile_center((col + 0.5)*TILE_SIZE, (row + 0.5)*TILE_SIZE);
+        double priority = norm_2(tile_center - center)/diag;
+
+        // Look for this tile, then for a coarser one covering it
+        TileMap::iterator it = m_tiles.find(key);
+        for (int k = 1; it == m_tiles.end() && level + k <= MAX_LEVEL; k++)
+          it = m_tiles.find(TileKey(&img, highlight_nodata, hillshade, level + k, col >> k, row >> k));
+        if (it == m_tiles.end() || it->first.level != level) {
+          complete = false;
+          request(key, priority);
+        }
+        if (it == m_tiles.end()) {
+          // Nothing to show meanwhile. A tile two levels up covers
+          // 16 of these and is rendered before all the finer ones.
+          if (level + 2 <= MAX_LEVEL)
+            request(TileKey(&img, highlight_nodata, hillshade, level + 2, col >> 2, row >> 2),
+                    priority - 1.0);
+          continue;
+        }
+
+        // Mark as most recently used
+        Tile const& tile = it->second;
+        m_lru.splice(m_lru.begin(), m_lru, tile.lru_pos);
+        if (tile.qimg.isNull())
+          continue;
+
+        double factor = tile.scale/scale;
+        TilePiece piece;
+        piece.qimg = tile.qimg;
+        piece.dest = QRectF(tile.region.min().x()*factor - region_out.min().x(),
+                            tile.region.min().y()*factor - region_out.min().y(),
+                            tile.region.width()*factor, tile.region.height()*factor);
+        piece.clip = cell;
+        pieces.push_back(piece);
+      }
+    }
+  } // End locked region
+
+  // Paint outside the lock, so the workers are not held up
+  QPainter paint(&qimg);
+  for (size_t i = 0; i < pieces.size(); i++) {
+    paint.setClipRect(pieces[i].clip);
+    paint.drawImage(pieces[i].dest, pieces[i].qimg);
+  }
+
+  return complete;
+}
+
+void TileRenderer::cancel_pending() {
+  Mutex::Lock lock(m_mutex);
+  m_pending.clear();
+  m_queued.clear();
+}
+
+void TileRenderer::clear() {
+  Mutex::Lock lock(m_mutex);
+  m_pending.clear();
+  m_queued.clear();
+  while (!m_in_flight.empty())
+    m_done_cond.wait(lock);
+  m_tiles.clear();
+  m_lru.clear();
+  m_stretch_ranges.clear();
+  m_new_tiles = false;
+}
+
+bool TileRenderer::has_new_tiles() {
+  Mutex::Lock lock(m_mutex);
+  bool ans = m_new_tiles;
+  m_new_tiles = false;
+  return ans;
+}
+
+// This is called with the mutex locked
+void TileRenderer::request(TileKey const& key, double priority) {
+  if (m_tiles.find(key)     != m_tiles.end()     ||
+      m_queued.find(key)    != m_queued.end()    ||
+      m_in_flight.find(key) != m_in_flight.end())
+    return;
+  m_pending.insert(std::make_pair(priority, key));
+  m_queued.insert(key);
+  m_work_cond.notify_one();
+}
+
+bool TileRenderer::next_request(TileKey & key, vw::Vector2 & stretch_range,
+                                bool & have_stretch_range) {
+  Mutex::Lock lock(m_mutex);
+  while (!m_stop && m_pending.empty())
+    m_work_cond.wait(lock);
+  if (m_stop)
+    return false;
+
+  key = m_pending.begin()->second;
+  m_pending.erase(m_pending.begin());
+  m_queued.erase(key);
+  m_in_flight.insert(key);
+
+  std::map<DiskImagePyramidMultiChannel const*, Vector2>::const_iterator it
+    = m_stretch_ranges.find(key.img);
+  have_stretch_range = (it != m_stretch_ranges.end());
+  if (have_stretch_range)
+    stretch_range = it->second;
+  return true;
+}
+
+void TileRenderer::set_stretch_range(DiskImagePyramidMultiChannel const* img,
+                                     vw::Vector2 const& stretch_range) {
+  Mutex::Lock lock(m_mutex);
+  m_stretch_ranges[img] = stretch_range;
+}
+
+void TileRenderer::finish(TileKey const& key, Tile const& tile) {
+  Mutex::Lock lock(m_mutex);
+  m_in_flight.erase(key);
+  m_done_cond.notify_all();
+
+  std::pair<TileMap::iterator, bool> res = m_tiles.insert(std::make_pair(key, tile));
+  if (!res.second)
+    return;
+  m_lru.push_front(key);
+  res.first->second.lru_pos = m_lru.begin();
+
+  while ((int)m_tiles.size() > MAX_CACHED_TILES) {
+    m_tiles.erase(m_lru.back());
+    m_lru.pop_back();
+  }
+  m_new_tiles = true;
+}
+
 void PointList::push_back(std::list<vw::Vector2> pts) {
   std::list<vw::Vector2>::iterator iter  = pts.begin();
   while (iter != pts.end()) {
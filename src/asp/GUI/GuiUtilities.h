@@ -27,14 +27,18 @@
 #include <vector>
 #include <list>
 #include <set>
+#include <map>
 
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/mpl/or.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 
 // Qt
 #include <QWidget>
 #include <QPoint>
+#include <QImage>
 
 // Vision Workbench
 #include <vw/Core/Thread.h>
@@ -120,7 +124,7 @@ namespace vw { namespace gui {
   typename boost::enable_if<boost::is_same<PixelT,double>, void>::type
   formQimage(bool highlight_nodata, bool scale_pixels, double nodata_val,
              ImageView<PixelT> const& clip,
-             QImage & qimg);
+             QImage & qimg, vw::Vector2 const& stretch_range = vw::Vector2());
 
   template<class PixelT>
   typename boost::enable_if<boost::is_same<PixelT, vw::Vector<vw::uint8, 2> >, void>::type
@@ -144,12 +148,6 @@ namespace vw { namespace gui {
   /// Convert a BBox2 object to a QRect object.
   QRect bbox2qrect(BBox2 const& B);
 
-  /// ?
-  bool write_hillshade(vw::cartography::GdalWriteOptions const& opt,
-                       double azimuth, double elevation,
-                       std::string const& input_file,
-                       std::string      & output_file);
-
   // Given an image, and an input file name, modify the filename using
   // a prefix. Write the image to that filename. If that fails, create
   // instead the filename in the current directory. Return the name
@@ -164,6 +162,15 @@ namespace vw { namespace gui {
                                         bool has_nodata,
                                         double nodata_val);
 
+  /// How to shade a DEM on the fly for display. The azimuth and
+  /// elevation have the same meaning as for the hillshade tool.
+  struct HillshadeParams {
+    bool        on;
+    double      azimuth, elevation; // in degrees
+    vw::Vector2 pixel_size;         // ground size of a full-resolution pixel, in meters
+    HillshadeParams(): on(false), azimuth(0), elevation(0) {}
+  };
+
   // An image class that supports 1 to 3 channels.  We use
   // DiskImagePyramid<double> to be able to use some of the
   // pre-defined member functions for an image class. This class
@@ -187,10 +194,23 @@ namespace vw { namespace gui {
 
     // This function will return a QImage to be shown on screen.
     // How we create it, depends on the type of image we want to display.
+    // Single-channel images are scaled to the range of values in the
+    // clip, unless stretch_range is non-empty.
     void get_image_clip(double scale_in, vw::BBox2i region_in,
                       bool highlight_nodata,
-                      QImage & qimg, double & scale_out, vw::BBox2i & region_out) const;
+                      QImage & qimg, double & scale_out, vw::BBox2i & region_out,
+                      vw::Vector2 const& stretch_range = vw::Vector2()) const;
     double get_nodata_val() const;
+
+    /// The range of valid values at the coarsest pyramid level, for
+    /// single-channel images. An empty range for other images.
+    vw::Vector2 get_stretch_range() const;
+
+    // Same as get_image_clip(), but shade the pyramid level being
+    // read as a DEM. Only for single-channel images.
+    void get_hillshade_clip(double scale_in, vw::BBox2i region_in,
+                            HillshadeParams const& hillshade,
+                            QImage & qimg, double & scale_out, vw::BBox2i & region_out) const;
     
     int32 cols  () const { return m_cols;  }
     int32 rows  () const { return m_rows;  }
@@ -205,6 +225,95 @@ namespace vw { namespace gui {
     std::string get_value_as_str( int32 x, int32 y) const;
   };
 
+  /// Render fixed-size tiles of DiskImagePyramidMultiChannel images
+  /// on background threads, and keep the most recently used ones in
+  /// memory, so that the GUI thread never waits for the disk. The
+  /// images passed in must stay alive until clear() is called.
+  class TileRenderer: private boost::noncopyable {
+  public:
+    TileRenderer();
+    ~TileRenderer();
+
+    /// Same as DiskImagePyramidMultiChannel::get_image_clip(), but
+    /// assembled only from tiles rendered so far. Missing tiles are
+    /// queued, those closest to the center of region_in first, and
+    /// their area is filled from coarser tiles if any are available.
+    /// Return true if all tiles were available at the desired level.
+    /// If hillshading, only the tiles being shown are shaded, and
+    /// those with other parameters eventually drop out of the cache.
+    bool get_image_clip(DiskImagePyramidMultiChannel const& img,
+                        double scale_in, vw::BBox2i region_in,
+                        bool highlight_nodata, HillshadeParams const& hillshade,
+                        QImage & qimg, double & scale_out, vw::BBox2i & region_out);
+
+    /// Drop all queued tiles, such as when the view changed.
+    void cancel_pending();
+
+    /// Forget all tiles, after waiting for the ones being rendered.
+    void clear();
+
+    /// Return true if tiles were rendered since the last call.
+    bool has_new_tiles();
+
+    static const int TILE_SIZE        = 256; // in pixels at a given level
+    static const int MAX_CACHED_TILES = 512; // 128 MB of ARGB32 tiles
+    static const int MAX_LEVEL        = 20;  // level L is subsampled by 2^L
+
+  private:
+
+    struct TileKey {
+      DiskImagePyramidMultiChannel const* img;
+      bool            highlight_nodata;
+      HillshadeParams hillshade;
+      int             level, col, row;
+      TileKey(DiskImagePyramidMultiChannel const* img_in, bool highlight_in,
+              HillshadeParams const& hillshade_in,
+              int level_in, int col_in, int row_in):
+        img(img_in), highlight_nodata(highlight_in), hillshade(hillshade_in),
+        level(level_in), col(col_in), row(row_in) {}
+      bool operator<(TileKey const& k) const;
+    };
+
+    struct Tile {
+      QImage      qimg;
+      double      scale;  // the scale and region as returned by the pyramid
+      vw::BBox2i  region;
+      std::list<TileKey>::iterator lru_pos;
+    };
+
+    typedef std::map<TileKey, Tile> TileMap;
+
+    class Worker;
+    friend class Worker;
+
+    /// The box, in full-resolution pixels, covered by a tile.
+    static vw::BBox2i tile_box(TileKey const& key);
+
+    /// Queue a tile unless it is cached, queued, or being rendered.
+    void request(TileKey const& key, double priority);
+
+    /// Block until there is a tile to render. Return false on shutdown.
+    bool next_request(TileKey & key, vw::Vector2 & stretch_range,
+                      bool & have_stretch_range);
+
+    /// Store a rendered tile, evicting the least recently used ones.
+    void finish(TileKey const& key, Tile const& tile);
+
+    /// Record the stretch range of an image, computed by a worker.
+    void set_stretch_range(DiskImagePyramidMultiChannel const* img,
+                           vw::Vector2 const& stretch_range);
+
+    TileMap                          m_tiles;
+    std::list<TileKey>               m_lru;      // most recently used first
+    std::multimap<double, TileKey>   m_pending;  // by priority, lowest first
+    std::set<TileKey>                m_queued, m_in_flight;
+    std::map<DiskImagePyramidMultiChannel const*, vw::Vector2> m_stretch_ranges;
+    std::vector<boost::shared_ptr<vw::Thread> > m_threads;
+    bool                             m_new_tiles, m_stop;
+    vw::Mutex                        m_mutex;
+    vw::Condition                    m_work_cond, m_done_cond;
+  };
+
   /// A class to keep all data associated with an image file
   struct imageData{
     std::string      name;
@@ -217,6 +326,9 @@ namespace vw { namespace gui {
 
     /// Load an image from disk into img and set the other variables.
     void read(std::string const& image, vw::cartography::GdalWriteOptions const& opt, bool use_georef);
+
+    /// The ground size of a pixel in meters, as used for hillshading.
+    vw::Vector2 ground_pixel_size() const;
   };
 
   // QT conversion functions
@@ -269,11 +381,14 @@ template<class PixelT>
 typename boost::enable_if<boost::is_same<PixelT,double>, void>::type
 formQimage(bool highlight_nodata, bool scale_pixels, double nodata_val,
            ImageView<PixelT> const& clip,
-           QImage & qimg){
+           QImage & qimg, vw::Vector2 const& stretch_range){
 
   double min_val = std::numeric_limits<double>::max();
   double max_val = -std::numeric_limits<double>::max();
-  if (scale_pixels) {
+  if (scale_pixels && stretch_range[0] < stretch_range[1]) {
+    min_val = stretch_range[0];
+    max_val = stretch_range[1];
+  }else if (scale_pixels) {
     for (int col = 0; col < clip.cols(); col++){
       for (int row = 0; row < clip.rows(); row++){
         if (clip(col, row) <= nodata_val) continue;
@@ -290,7 +405,7 @@ formQimage(bool highlight_nodata, bool scale_pixels, double nodata_val,
     for (int row = 0; row < clip.rows(); row++){
       double v = clip(col, row);
       if (scale_pixels)
-        v = round(255*(std::max(v, min_val) - min_val)/(max_val-min_val));
+        v = round(255*(std::min(std::max(v, min_val), max_val) - min_val)/(max_val-min_val));
 
       // The comparison below is false when nodata_val is NaN
       if (clip(col, row) <= nodata_val || std::isnan(clip(col, row)) ){
@@ -269,7 +269,12 @@ namespace vw { namespace gui {
             SLOT(allowMultipleSelections()));
     connect(m_deleteSelection,    SIGNAL(triggered()), this, SLOT(deleteSelection()));
 
-    MainWidget::maybeGenHillshade();
+    // Poll for tiles rendered in the background
+    m_tile_timer = new QTimer(this);
+    connect(m_tile_timer, SIGNAL(timeout()), this, SLOT(checkForNewTiles()));
+    m_tile_timer->start(50); // milliseconds
+
+    MainWidget::checkHillshadeMode();
 
   } // End constructor
 
@@ -277,6 +282,11 @@ namespace vw { namespace gui {
   MainWidget::~MainWidget() {
   }
 
+  void MainWidget::checkForNewTiles(){
+    if (m_tile_renderer.has_new_tiles())
+      refreshPixmap();
+  }
+
   bool MainWidget::eventFilter(QObject *obj, QEvent *E){
     return QWidget::eventFilter(obj, E);
   }
@@ -477,6 +487,7 @@ namespace vw { namespace gui {
     }
 
     int num_images = m_images.size();
+    m_tile_renderer.clear();
     m_shadow_thresh_images.clear(); // wipe the old copy
     m_shadow_thresh_images.resize(num_images);
 
@@ -518,14 +529,11 @@ namespace vw { namespace gui {
     refreshPixmap();
   }
 
-  void MainWidget::maybeGenHillshade(){
+  void MainWidget::checkHillshadeMode(){
 
+    // The hillshading itself is done on the fly when rendering the
+    // tiles being shown.
     int num_images = m_images.size();
-    m_hillshaded_images.clear(); // wipe the old copy
-    m_hillshaded_images.resize(num_images);
-
-    // Create the hillshaded images and save them to disk. We have to do
-    // it each time as perhaps the hillshade parameters changed.
     for (int image_iter = 0; image_iter < num_images; image_iter++) {
 
       if (!m_hillshade_mode[image_iter]) continue;
@@ -536,28 +544,12 @@ namespace vw { namespace gui {
         return;
       }
 
-      std::string input_file = m_image_files[image_iter];
       int num_channels = m_images[image_iter].img.planes();
       if (num_channels != 1) {
         popUp("Hill-shading makes sense only for single-channel images.");
         m_hillshade_mode[image_iter] = false;
         return;
       }
-
-      // Save the hillshaded images to disk
-      std::string hillshaded_file;
-      bool success = write_hillshade(m_opt,
-                                     m_hillshade_azimuth,
-                                     m_hillshade_elevation,
-                                     input_file, hillshaded_file);
-      if (!success) {
-        m_hillshade_mode[image_iter] = false;
-        return;
-      }
-
-      vw_out() << "Reading: " << hillshaded_file << std::endl;
-      m_hillshaded_images[image_iter].read(hillshaded_file, m_opt, m_use_georef);
-      temporary_files().files.insert(hillshaded_file);
     }
   }
 
@@ -589,7 +581,7 @@ namespace vw { namespace gui {
 
     m_shadow_thresh_calc_mode = false;
     m_shadow_thresh_view_mode = false;
-    MainWidget::maybeGenHillshade();
+    MainWidget::checkHillshadeMode();
 
     m_indicesWithAction.clear();
     refreshPixmap();
@@ -769,6 +761,9 @@ namespace vw { namespace gui {
     // determined. Then, there is nothing to do.
     if (m_current_view.empty()) return;
 
+    // Tiles queued for the previous view are no longer needed
+    m_tile_renderer.cancel_pending();
+
     std::list<BBox2i> screen_box_list; // List of regions the images are drawn in
     // Loop through input images
     // - These images get drawn in the same
@@ -817,21 +812,26 @@ namespace vw { namespace gui {
       // when multiplying large integers.
       double scale = sqrt((1.0*image_box.width()) * image_box.height())/
         std::max(1.0, sqrt((1.0*screen_box.width()) * screen_box.height()));
+      // The tiles not rendered yet are filled in from coarser ones,
+      // and we get called again once they arrive.
       double scale_out;
       BBox2i region_out;
       bool   highlight_nodata = m_shadow_thresh_view_mode;
+      HillshadeParams hillshade;
       if (m_shadow_thresh_view_mode){
-        m_shadow_thresh_images[i].img.get_image_clip(scale, image_box,
-                                                     highlight_nodata,
-                                                     qimg, scale_out, region_out);
-      }else if (m_hillshade_mode[i]){
-        m_hillshaded_images[i].img.get_image_clip(scale, image_box,
-                                                  highlight_nodata,
-                                                  qimg, scale_out, region_out);
+        m_tile_renderer.get_image_clip(m_shadow_thresh_images[i].img, scale, image_box,
+                                       highlight_nodata, hillshade,
+                                       qimg, scale_out, region_out);
       }else{
-        // Original images
-        m_images[i].img.get_image_clip(scale, image_box,
-                                       highlight_nodata,
+        // Original images, maybe hillshaded
+        if (m_hillshade_mode[i]){
+          hillshade.on         = true;
+          hillshade.azimuth    = m_hillshade_azimuth;
+          hillshade.elevation  = m_hillshade_elevation;
+          hillshade.pixel_size = m_images[i].ground_pixel_size();
+        }
+        m_tile_renderer.get_image_clip(m_images[i].img, scale, image_box,
+                                       highlight_nodata, hillshade,
                                        qimg, scale_out, region_out);
       }
 
@@ -1975,7 +1975,7 @@ namespace vw { namespace gui {
     m_hillshade_azimuth = a;
     m_hillshade_elevation = e;
 
-    MainWidget::maybeGenHillshade();
+    MainWidget::checkHillshadeMode();
     refreshPixmap();
 
     vw_out() << "Hillshade azimuth and elevation for " << m_image_files[0]
@@ -73,6 +73,7 @@ class QTableWidget;
 class QContextMenuEvent;
 class QMenu;
 class QStylePainter;
+class QTimer;
 
 namespace vw { namespace gui {
 
@@ -162,6 +163,7 @@ public slots:
     void deleteSelection();         ///< Delete an area selected with the mouse at the current point
     void toggleProfileMode(bool profile_mode); ///< Turn on and off the 1D profile tool
     void saveScreenshot();          ///< Save a screenshot of the current imagery
+    void checkForNewTiles();        ///< Redraw if tiles were rendered in the background
 
   protected:
 
@@ -308,8 +310,12 @@ public slots:
     bool   m_shadow_thresh_view_mode;
     std::vector<imageData> m_shadow_thresh_images;
 
-    std::vector<imageData> m_hillshaded_images;
     std::set<int> m_indicesWithAction;
+
+    // Renders the images above in the background. Must be cleared
+    // before any of them is replaced.
+    TileRenderer m_tile_renderer;
+    QTimer *     m_tile_timer;
     
     bool m_view_matches; ///< Control if IP's are drawn
 
@@ -335,7 +341,7 @@ public slots:
     void updateCurrentMousePosition();
     void updateRubberBand(QRect & R);
     void refreshPixmap();
-    void maybeGenHillshade();
+    void checkHillshadeMode(); ///< Turn off hillshading for images which are not DEMs
     void showImage(std::string const& image_name);
     void bringImageOnTop(int image_index);
     void pushImageToBottom(int image_index);
@@ -22,6 +22,7 @@
 // STL
 #include <fstream>
 #include <iostream>
+#include <vector>
 // VW
 #include <vw/Math/Vector.h>
 
@@ -56,6 +57,15 @@ namespace asp {
     }
     vw::Vector3 operator()( double const& t ) { return evaluate(t);}
 
+    // Evaluates the equation at each of the given times. Derived
+    // classes may do this faster than one time at a time.
+    virtual void evaluate( std::vector<double> const& times,
+                           std::vector<vw::Vector3> & output ) {
+      output.resize( times.size() );
+      for ( size_t i = 0; i < times.size(); i++ )
+        output[i] = evaluate( times[i] );
+    }
+
     // Tells the number of constants defining the equation
     // This is especially vague as it is meant for interaction with a
     // bundle adjuster. BA just wants to roll through the constants
@@ -21,12 +21,15 @@
 #include <asp/IsisIO/IsisInterfaceLineScan.h>
 
 #include <algorithm>
+#include <cmath>
+#include <limits>
 #include <vector>
 
 #include <Camera.h>
 #include <CameraDetectorMap.h>
 #include <CameraDistortionMap.h>
 #include <CameraFocalPlaneMap.h>
+#include <IException.h>
 #include <iTime.h>
 
 #include <boost/smart_ptr/scoped_ptr.hpp>
@@ -116,23 +119,59 @@ EphemerisLMA::operator()( EphemerisLMA::domain_type const& x ) const {
   return result;
 }
 
+// Solve for the ephemeris time at which the point is seen, starting
+// from the given time. A status which is not positive means failure.
+static Vector<double> solve_for_time( EphemerisLMA const& model,
+                                      double start_e, int & status ) {
+  Vector<double> objective(1), start(1);
+  start[0] = start_e;
+  status = -1;
+  try {
+    return math::levenberg_marquardt( model, start, objective, status );
+  } catch ( Isis::IException const& e ) {
+    // Such as for a time out of the range of the cached ephemeris
+    vw_out(DebugMessage, "asp") << "Ephemeris time solve failed: " << e.what() << "\n";
+    status = -1;
+  }
+  return start;
+}
+
+// Out of the given times, the one at which the point is closest to
+// being seen, to seed the solve for the time. This depends only on
+// the point, so the result of point_to_pixel() does not depend on
+// which points were projected before it.
+static double seed_time( EphemerisLMA const& model,
+                         std::vector<double> const& times ) {
+  double best_time = times[0], best_err = std::numeric_limits<double>::max();
+  Vector<double> x(1);
+  for ( size_t i = 0; i < times.size(); i++ ) {
+    x[0] = times[i];
+    double err = std::abs( model(x)[0] );
+    if ( err < best_err ) {
+      best_err  = err;
+      best_time = times[i];
+    }
+  }
+  return best_time;
+}
+
 Vector2
 IsisInterfaceLineScan::point_to_pixel( Vector3 const& point ) const {
 
-  // First seed LMA with an ephemeris time in the middle of the image
-  double middle = lines() / 2;
-  m_detectmap->SetParent( 1, m_alphacube.AlphaLine(middle) );
-  double start_e = m_camera->time().Et();
-
   // Build LMA
   EphemerisLMA model( point, m_camera.get(), m_distortmap, m_focalmap );
-  int status;
-  Vector<double> objective(1), start(1);
-  start[0] = start_e;
-  Vector<double> solution_e = math::levenberg_marquardt( model,
-                                                         start,
-                                                         objective,
-                                                         status );
+
+  // Seed LMA with the time of one of a few lines spread over the
+  // image, including the middle one
+  const int NUM_SEEDS = 5;
+  std::vector<double> times;
+  for ( int i = 0; i < NUM_SEEDS; i++ ) {
+    double line = double(lines()) * i / (NUM_SEEDS - 1);
+    m_detectmap->SetParent( 1, m_alphacube.AlphaLine(line) );
+    times.push_back( m_camera->time().Et() );
+  }
+  int status = -1;
+  Vector<double> solution_e = solve_for_time( model, seed_time( model, times ), status );
 
   // Make sure we found ideal time
   VW_ASSERT( status > 0, vw::camera::PointToPixelErr() << " Unable to project point into ISIS linescan camera " );
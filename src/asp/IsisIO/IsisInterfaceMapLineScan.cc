@@ -24,6 +24,7 @@
 #include <asp/IsisIO/IsisInterfaceMapLineScan.h>
 
 #include <algorithm>
+#include <cmath>
 #include <limits>
 #include <string>
 #include <vector>
@@ -32,6 +33,7 @@
 #include <CameraDistortionMap.h>
 #include <CameraFocalPlaneMap.h>
 #include <CameraGroundMap.h>
+#include <IException.h>
 #include <Latitude.h>
 #include <Longitude.h>
 #include <Projection.h>
@@ -111,22 +113,58 @@ EphemerisLMA::operator()( EphemerisLMA::domain_type const& x ) const {
   return result;
 }
 
+// Solve for the ephemeris time at which the point is seen, starting
+// from the given time. A status which is not positive means failure.
+static Vector<double> solve_for_time( EphemerisLMA const& model,
+                                      double start_e, int & status ) {
+  Vector<double> objective(1), start(1);
+  start[0] = start_e;
+  status = -1;
+  try {
+    return math::levenberg_marquardt( model, start, objective, status );
+  } catch ( Isis::IException const& e ) {
+    // Such as for a time out of the range of the cached ephemeris
+    vw_out(DebugMessage, "asp") << "Ephemeris time solve failed: " << e.what() << "\n";
+    status = -1;
+  }
+  return start;
+}
+
+// Out of the given times, the one at which the point is closest to
+// being seen, to seed the solve for the time. This depends only on
+// the point, so the result of point_to_pixel() does not depend on
+// which points were projected before it.
+static double seed_time( EphemerisLMA const& model,
+                         std::vector<double> const& times ) {
+  double best_time = times[0], best_err = std::numeric_limits<double>::max();
+  Vector<double> x(1);
+  for ( size_t i = 0; i < times.size(); i++ ) {
+    x[0] = times[i];
+    double err = std::abs( model(x)[0] );
+    if ( err < best_err ) {
+      best_err  = err;
+      best_time = times[i];
+    }
+  }
+  return best_time;
+}
+
 Vector2
 IsisInterfaceMapLineScan::point_to_pixel( Vector3 const& point ) const {
 
-  // First seed LMA with an ephemeris time in the middle of the image
-  double middle_et =
-    m_camera->cacheStartTime().Et() + (m_camera->cacheEndTime().Et()-m_camera->cacheStartTime().Et())/2.0;
-
   // Build LMA
   EphemerisLMA model( point, m_camera.get(), m_distortmap, m_focalmap );
-  int status;
-  Vector<double> objective(1), start(1);
-  start[0] = middle_et;
-  Vector<double> solution_e = math::levenberg_marquardt( model,
-                                                         start,
-                                                         objective,
-                                                         status );
+
+  // Seed LMA with one of a few ephemeris times spread over the cached
+  // range, including the middle one
+  const int NUM_SEEDS = 5;
+  double start_et = m_camera->cacheStartTime().Et();
+  double end_et   = m_camera->cacheEndTime().Et();
+  std::vector<double> times;
+  for ( int i = 0; i < NUM_SEEDS; i++ )
+    times.push_back( start_et + (end_et - start_et) * i / (NUM_SEEDS - 1) );
+  int status = -1;
+  Vector<double> solution_e = solve_for_time( model, seed_time( model, times ), status );
 
   // Make sure we found ideal time
   VW_ASSERT( status > 0,
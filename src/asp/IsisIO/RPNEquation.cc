@@ -19,8 +19,9 @@
 #include <vw/Math/Vector.h>
 #include <asp/IsisIO/RPNEquation.h>
 
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
-#include <stack>
 #include <vector>
 
 #include <boost/algorithm/string/classification.hpp>
@@ -29,6 +30,8 @@
 using namespace vw;
 using namespace asp;
 
+const int RPNEquation::MAX_STACK_DEPTH;
+
 // Constructors
 //-----------------------------------------------------
 RPNEquation::RPNEquation() {
@@ -38,6 +41,10 @@ RPNEquation::RPNEquation() {
   m_y_consts.clear();
   m_z_eq.clear();
   m_z_consts.clear();
+  compile( m_x_eq, m_x_prog );
+  compile( m_y_eq, m_y_prog );
+  compile( m_z_eq, m_z_prog );
+  m_coeffs_dirty = true;
   m_cached_time = -1;
   m_time_offset = 0;
 }
@@ -47,6 +54,10 @@ RPNEquation::RPNEquation( std::string x_eq,
   string_to_eqn( x_eq, m_x_eq, m_x_consts );
   string_to_eqn( y_eq, m_y_eq, m_y_consts );
   string_to_eqn( z_eq, m_z_eq, m_z_consts );
+  compile( m_x_eq, m_x_prog );
+  compile( m_y_eq, m_y_prog );
+  compile( m_z_eq, m_z_prog );
+  m_coeffs_dirty = true;
   m_cached_time = -1;
   m_time_offset = 0;
 }
@@ -54,17 +65,23 @@ RPNEquation::RPNEquation( std::string x_eq,
 // Update
 //-----------------------------------------------------
 void RPNEquation::update( double const& t ) {
+  prepare();
   m_cached_time = t;
   double delta_t = t - m_time_offset;
-  m_cached_output[0] = evaluate( m_x_eq,
-                                 m_x_consts,
-                                 delta_t );
-  m_cached_output[1] = evaluate( m_y_eq,
-                                 m_y_consts,
-                                 delta_t );
-  m_cached_output[2] = evaluate( m_z_eq,
-                                 m_z_consts,
-                                 delta_t );
+  m_cached_output[0] = run( m_x_prog, m_x_consts, delta_t );
+  m_cached_output[1] = run( m_y_prog, m_y_consts, delta_t );
+  m_cached_output[2] = run( m_z_prog, m_z_consts, delta_t );
+}
+void RPNEquation::evaluate( std::vector<double> const& times,
+                            std::vector<Vector3> & output ) {
+  prepare();
+  output.resize( times.size() );
+  for ( size_t i = 0; i < times.size(); i++ ) {
+    double delta_t = times[i] - m_time_offset;
+    output[i][0] = run( m_x_prog, m_x_consts, delta_t );
+    output[i][1] = run( m_y_prog, m_y_consts, delta_t );
+    output[i][2] = run( m_z_prog, m_z_consts, delta_t );
+  }
 }
 void RPNEquation::string_to_eqn( std::string& str,
                                  std::vector<std::string>& commands,
@@ -92,83 +109,205 @@ void RPNEquation::string_to_eqn( std::string& str,
     }
   }
 }
-double RPNEquation::evaluate( std::vector<std::string>& commands,
-                              std::vector<double>& consts,
-                              double const& t ) {
-  // Evaluates an equation in the internal format
-  if ( commands.empty() )
-    return 0;
-  int consts_index = 0;
-  std::stack<double> rpn_stack;
-  double buffer;
-  for ( std::vector<std::string>::iterator iter = commands.begin();
+void RPNEquation::compile( std::vector<std::string> const& commands,
+                           Program & prog ) {
+  // Turns the tokens into opcodes, checking along the way that
+  // the stack never underflows nor gets too deep.
+  prog.ops.clear();
+  prog.is_poly = false;
+  prog.poly_coeffs.clear();
+  int consts_index = 0, depth = 0;
+  for ( std::vector<std::string>::const_iterator iter = commands.begin();
         iter != commands.end(); ++iter ) {
+    Op op;
+    op.const_index = -1;
+    int num_args = 2;
     if ( *iter == "c" ) {
-      rpn_stack.push( consts[consts_index] );
+      op.code = OP_CONST;
+      op.const_index = consts_index;
       consts_index++;
+      num_args = 0;
     } else if ( *iter == "t" ) {
-      rpn_stack.push( t );
-    } else if ( rpn_stack.size() < 1 ) {
-      vw_throw( IOErr() << "Insufficient arguments for RPN command: "
-                << *iter << "\n" );
+      op.code = OP_T;
+      num_args = 0;
     } else if ( *iter == "sin" ) {
-      buffer = sin( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
+      op.code = OP_SIN;  num_args = 1;
     } else if ( *iter == "cos" ) {
-      buffer = cos( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
+      op.code = OP_COS;  num_args = 1;
     } else if ( *iter == "tan" ) {
-      buffer = tan( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
+      op.code = OP_TAN;  num_args = 1;
     } else if ( *iter == "abs" ) {
-      buffer = fabs( rpn_stack.top() );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
-    } else if ( rpn_stack.size() < 2 ) {
-      vw_throw( IOErr() << "Insufficient arguments for command: "
-                << *iter << "\n" );
+      op.code = OP_ABS;  num_args = 1;
     } else if ( *iter == "*" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer *= rpn_stack.top();
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
+      op.code = OP_MUL;
     } else if ( *iter == "/" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer = rpn_stack.top() / buffer;
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
+      op.code = OP_DIV;
     } else if ( *iter == "-" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer = rpn_stack.top() - buffer;
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
+      op.code = OP_SUB;
     } else if ( *iter == "+" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer += rpn_stack.top();
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
+      op.code = OP_ADD;
     } else if ( *iter == "^" ) {
-      buffer = rpn_stack.top();
-      rpn_stack.pop();
-      buffer = pow( rpn_stack.top(), buffer );
-      rpn_stack.pop();
-      rpn_stack.push( buffer );
+      op.code = OP_POW;
     } else {
       vw_throw( IOErr() << "Unknown RPN operator: " << *iter << "\n" );
     }
-  } // End of calculator
 
-  if ( rpn_stack.size() != 1 )
+    if ( depth < num_args )
+      vw_throw( IOErr() << "Insufficient arguments for RPN command: "
+                << *iter << "\n" );
+    depth += (num_args == 0) ? 1 : 1 - num_args;
+    if ( depth > MAX_STACK_DEPTH )
+      vw_throw( IOErr() << "RPN equation is too deeply nested. The stack "
+                << "can hold at most " << MAX_STACK_DEPTH << " values.\n" );
+    prog.ops.push_back( op );
+  }
+
+  if ( !prog.ops.empty() && depth != 1 )
     vw_throw( IOErr() << "Unbalanced RPN equation! More constants than need by operators.\n" );
+}
+void RPNEquation::lower_to_poly( std::vector<double> const& consts,
+                                 Program & prog ) {
+  // Run the program on polynomials in t rather than on numbers. If
+  // it only adds, subtracts, and multiplies polynomials, divides
+  // them by constants, and raises them to small whole powers, the
+  // result is a polynomial. Other operations are fine only on
+  // constants. The coefficients depend on the constants, so this
+  // must be redone when those change.
+  const int MAX_POWER = 16;
+  typedef std::vector<double> Poly;
+  prog.is_poly = false;
+  prog.poly_coeffs.clear();
+  std::vector<Poly> stack;
+  stack.reserve( MAX_STACK_DEPTH );
+  for ( size_t i = 0; i < prog.ops.size(); i++ ) {
+    Op const& op = prog.ops[i];
+    if ( op.code == OP_CONST ) {
+      stack.push_back( Poly( 1, consts[op.const_index] ) );
+      continue;
+    }
+    if ( op.code == OP_T ) {
+      Poly p( 2, 0.0 );
+      p[1] = 1.0;
+      stack.push_back( p );
+      continue;
+    }
 
-  return rpn_stack.top();
+    Poly b = stack.back();
+    stack.pop_back();
+    if ( op.code == OP_SIN || op.code == OP_COS ||
+         op.code == OP_TAN || op.code == OP_ABS ) {
+      if ( b.size() != 1 )
+        return; // Not a polynomial
+      switch ( op.code ) {
+      case OP_SIN: b[0] = sin( b[0] ); break;
+      case OP_COS: b[0] = cos( b[0] ); break;
+      case OP_TAN: b[0] = tan( b[0] ); break;
+      default:     b[0] = fabs( b[0] ); break;
+      }
+      stack.push_back( b );
+      continue;
+    }
+
+    Poly a = stack.back();
+    stack.pop_back();
+    Poly c;
+    switch ( op.code ) {
+    case OP_ADD:
+    case OP_SUB:
+      c.resize( std::max( a.size(), b.size() ), 0.0 );
+      for ( size_t k = 0; k < a.size(); k++ )
+        c[k] += a[k];
+      for ( size_t k = 0; k < b.size(); k++ )
+        c[k] += (op.code == OP_ADD) ? b[k] : -b[k];
+      break;
+    case OP_MUL:
+      c.resize( a.size() + b.size() - 1, 0.0 );
+      for ( size_t k = 0; k < a.size(); k++ )
+        for ( size_t l = 0; l < b.size(); l++ )
+          c[k+l] += a[k]*b[l];
+      break;
+    case OP_DIV:
+      if ( b.size() != 1 )
+        return; // Not a polynomial
+      c = a;
+      for ( size_t k = 0; k < c.size(); k++ )
+        c[k] /= b[0];
+      break;
+    case OP_POW:
+      if ( b.size() != 1 )
+        return; // Not a polynomial
+      if ( a.size() == 1 ) {
+        c = Poly( 1, pow( a[0], b[0] ) );
+      } else {
+        if ( b[0] != floor( b[0] ) || b[0] < 0 || b[0] > MAX_POWER )
+          return; // Not a polynomial
+        c = Poly( 1, 1.0 );
+        for ( int k = 0; k < int(b[0]); k++ ) {
+          Poly d( c.size() + a.size() - 1, 0.0 );
+          for ( size_t l = 0; l < c.size(); l++ )
+            for ( size_t m = 0; m < a.size(); m++ )
+              d[l+m] += c[l]*a[m];
+          c = d;
+        }
+      }
+      break;
+    default:
+      vw_throw( LogicErr() << "RPNEquation: Unexpected opcode.\n" );
+    }
+    stack.push_back( c );
+  }
+
+  prog.is_poly = true;
+  if ( !stack.empty() )
+    prog.poly_coeffs = stack.back();
+}
+void RPNEquation::prepare() {
+  // Redo the polynomial lowering if the constants may have changed
+  if ( !m_coeffs_dirty )
+    return;
+  lower_to_poly( m_x_consts, m_x_prog );
+  lower_to_poly( m_y_consts, m_y_prog );
+  lower_to_poly( m_z_consts, m_z_prog );
+  m_coeffs_dirty = false;
+}
+double RPNEquation::run( Program const& prog,
+                         std::vector<double> const& consts,
+                         double t ) const {
+  // Evaluates a compiled equation
+  if ( prog.is_poly ) {
+    // Horner's rule
+    std::vector<double> const& coeffs = prog.poly_coeffs;
+    if ( coeffs.empty() )
+      return 0;
+    double result = coeffs.back();
+    for ( int k = int(coeffs.size()) - 2; k >= 0; k-- )
+      result = result*t + coeffs[k];
+    return result;
+  }
+
+  // The depth was checked when compiling
+  double stack[MAX_STACK_DEPTH];
+  int top = -1;
+  std::vector<Op>::const_iterator end = prog.ops.end();
+  for ( std::vector<Op>::const_iterator op = prog.ops.begin(); op != end; ++op ) {
+    switch ( op->code ) {
+    case OP_CONST: stack[++top] = consts[op->const_index]; break;
+    case OP_T:     stack[++top] = t; break;
+    case OP_SIN:   stack[top] = sin( stack[top] ); break;
+    case OP_COS:   stack[top] = cos( stack[top] ); break;
+    case OP_TAN:   stack[top] = tan( stack[top] ); break;
+    case OP_ABS:   stack[top] = fabs( stack[top] ); break;
+    case OP_MUL:   stack[top-1] *= stack[top]; top--; break;
+    case OP_DIV:   stack[top-1] /= stack[top]; top--; break;
+    case OP_SUB:   stack[top-1] -= stack[top]; top--; break;
+    case OP_ADD:   stack[top-1] += stack[top]; top--; break;
+    case OP_POW:   stack[top-1] = pow( stack[top-1], stack[top] ); top--; break;
+    }
+  }
+
+  if ( top < 0 )
+    return 0;
+  return stack[top];
 }
 
 // FileIO
@@ -218,12 +357,18 @@ void RPNEquation::read( std::ifstream &f ) {
   buffer = "";
   std::getline( f, buffer );
   string_to_eqn( buffer, m_z_eq, m_z_consts );
+
+  compile( m_x_eq, m_x_prog );
+  compile( m_y_eq, m_y_prog );
+  compile( m_z_eq, m_z_prog );
+  m_coeffs_dirty = true;
 }
 
 // Constant Access
 //-----------------------------------------------------
 double& RPNEquation::operator[]( size_t const& n ) {
   m_cached_time = -1;
+  m_coeffs_dirty = true;
   if ( n >= m_x_consts.size() + m_y_consts.size()
        + m_z_consts.size() )
     vw_throw( ArgumentErr() << "RPNEquation: invalid index." );
@@ -38,6 +38,10 @@ namespace asp {
   //
   // Remember: Have your equation space delimited
   // Also: 'c' is an internal place holder for RPNEquation
+  //
+  // The tokens are compiled to a list of opcodes which is run on a
+  // fixed-size stack. If with the current constants an equation is a
+  // polynomial in t, it is evaluated with Horner's rule instead.
   class RPNEquation : public BaseEquation {
     std::vector<std::string> m_x_eq;
     std::vector<double> m_x_consts;
@@ -46,13 +50,36 @@ namespace asp {
     std::vector<std::string> m_z_eq;
     std::vector<double> m_z_consts;
 
+    // Compiled form of one equation
+    enum OpCode { OP_CONST, OP_T, OP_SIN, OP_COS, OP_TAN, OP_ABS,
+                  OP_MUL, OP_DIV, OP_SUB, OP_ADD, OP_POW };
+    struct Op {
+      OpCode code;
+      int    const_index; // For OP_CONST
+    };
+    struct Program {
+      std::vector<Op>     ops;
+      bool                is_poly;
+      std::vector<double> poly_coeffs; // Lowest order first
+    };
+    Program m_x_prog, m_y_prog, m_z_prog;
+    bool    m_coeffs_dirty; // The constants changed since the last lowering
+
+    // The most values an equation can keep on the stack
+    static const int MAX_STACK_DEPTH = 64;
+
     void update( double const& t );
     void string_to_eqn( std::string& str,
                         std::vector<std::string>& commands,
                         std::vector<double>& consts );
-    double evaluate( std::vector<std::string>& commands,
-                     std::vector<double>& consts,
-                     double const& t );
+    void compile( std::vector<std::string> const& commands,
+                  Program & prog );
+    void lower_to_poly( std::vector<double> const& consts,
+                        Program & prog );
+    void prepare();
+    double run( Program const& prog,
+                std::vector<double> const& consts,
+                double t ) const;
   public:
     RPNEquation();
     RPNEquation( std::string x_eq,
@@ -64,6 +91,10 @@ namespace asp {
         m_y_consts.size() + m_z_consts.size(); }
     double& operator[]( size_t const& n );
 
+    using BaseEquation::evaluate;
+    void evaluate( std::vector<double> const& times,
+                   std::vector<vw::Vector3> & output );
+
     void write( std::ofstream &f );
     void read( std::ifstream &f );
   };
@@ -126,3 +126,32 @@ TEST(EphemerisEquations, reversepolish) {
   EXPECT_NEAR( 15.4176744337735, test[1], DELTA );
   EXPECT_NEAR( 2737.72972972973, test[2], DELTA );
 }
+
+TEST(EphemerisEquations, reversepolish_compiled) {
+  // x and y are polynomials, z is not
+  RPNEquation rpn( "t 2 ^ 3 * t 2 / +", "2 t - 3 ^", "4 cos t *" );
+  EXPECT_EQ( 6u, rpn.size() );
+
+  std::vector<double> times;
+  times.push_back( 0.5 );
+  times.push_back( 2 );
+  std::vector<Vector3> output;
+  rpn.evaluate( times, output );
+  ASSERT_EQ( 2u, output.size() );
+  for ( size_t i = 0; i < times.size(); i++ ) {
+    Vector3 test = rpn(times[i]);
+    EXPECT_NEAR( test[0], output[i][0], DELTA );
+    EXPECT_NEAR( test[1], output[i][1], DELTA );
+    EXPECT_NEAR( test[2], output[i][2], DELTA );
+  }
+  EXPECT_NEAR( 1,     output[0][0], DELTA );
+  EXPECT_NEAR( 3.375, output[0][1], DELTA );
+  EXPECT_NEAR( cos(4.0)*0.5, output[0][2], DELTA );
+
+  // Changing a constant must redo the polynomial
+  rpn[0] = 4; // 3*t^4 + t/2
+  Vector3 test = rpn(2);
+  EXPECT_NEAR( 49, test[0], DELTA );
+
+  EXPECT_THROW( RPNEquation( "t +", "t", "t" ), IOErr );
+}
@@ -53,6 +53,61 @@ namespace vw {
 
 namespace asp {
 
+  /// Give a camera loaded from the same files as 'cam' the same
+  /// AdjustedCameraModel adjustments as 'cam'. The adjustments the
+  /// session applied when loading are dropped, as 'cam' may have been
+  /// adjusted further since, such as in bundle_adjust.
+  static boost::shared_ptr<camera::CameraModel>
+  copy_adjustments(camera::CameraModel const* cam,
+                   boost::shared_ptr<camera::CameraModel> loaded) {
+
+    // Strip the adjustments of the loaded camera
+    camera::AdjustedCameraModel * adj_loaded;
+    while ((adj_loaded = dynamic_cast<camera::AdjustedCameraModel*>(loaded.get())) != NULL)
+      loaded = adj_loaded->unadjusted_model();
+
+    // Re-apply those of the given camera, from the innermost out
+    std::vector<camera::AdjustedCameraModel> adjustments;
+    camera::AdjustedCameraModel const* adj_cam;
+    while ((adj_cam = dynamic_cast<camera::AdjustedCameraModel const*>(cam)) != NULL) {
+      adjustments.push_back(*adj_cam);
+      cam = adjustments.back().unadjusted_model().get();
+    }
+    for (int i = int(adjustments.size()) - 1; i >= 0; i--) {
+      camera::AdjustedCameraModel & adj = adjustments[i];
+      loaded.reset(new camera::AdjustedCameraModel(loaded, adj.translation(), adj.rotation(),
+                                                   adj.pixel_offset(), adj.scale()));
+    }
+    return loaded;
+  }
+
+  /// Loads copies of the left and right cameras of a session, for
+  /// IP matching with cameras which are not thread-safe. This does
+  /// not go through camera_models(), which may return cached cameras.
+  /// The copies get the adjustments of the given cameras.
+  class SessionCameraPool: public CameraPairPool {
+    StereoSession * m_session;
+    std::string     m_left_image_file,  m_left_camera_file;
+    std::string     m_right_image_file, m_right_camera_file;
+    vw::camera::CameraModel const* m_cam1;
+    vw::camera::CameraModel const* m_cam2;
+  public:
+    SessionCameraPool(StereoSession * session,
+                      std::string const& left_image_file,  std::string const& left_camera_file,
+                      std::string const& right_image_file, std::string const& right_camera_file,
+                      vw::camera::CameraModel const* cam1,
+                      vw::camera::CameraModel const* cam2):
+      CameraPairPool(cam1, cam2), m_session(session),
+      m_left_image_file (left_image_file),  m_left_camera_file (left_camera_file),
+      m_right_image_file(right_image_file), m_right_camera_file(right_camera_file),
+      m_cam1(cam1), m_cam2(cam2){}
+  protected:
+    virtual void load_cameras(CamPtr & cam1, CamPtr & cam2) {
+      cam1 = copy_adjustments(m_cam1, m_session->camera_model(m_left_image_file,  m_left_camera_file));
+      cam2 = copy_adjustments(m_cam2, m_session->camera_model(m_right_image_file, m_right_camera_file));
+    }
+  };
+
   // Pass over all the string variables we use
   void StereoSession::initialize( vw::cartography::GdalWriteOptions const& options,
 				  std::string const& left_image_file,
@@ -123,7 +178,17 @@ namespace asp {
     bool inlier = false;
     if (nadir_facing) {
       // Run an IP matching function that takes the camera and datum info into account
-      bool single_threaded_camera = true; // TODO: This is probably needed only for ISIS.
+
+      // If the cameras are not thread-safe, each thread does the
+      // matching with its own copies of them. Those are loaded from
+      // this session's files, which the given cameras must also be
+      // from, and get the same adjustments as the given cameras.
+      boost::shared_ptr<CameraPairPool> camera_pool;
+      if (!this->supports_multi_threading())
+        camera_pool.reset(new SessionCameraPool(this,
+                                                m_left_image_file,  m_left_camera_file,
+                                                m_right_image_file, m_right_camera_file,
+                                                cam1, cam2));
 
       bool use_sphere_for_isis = false; // Assume Mars is not a sphere
       cartography::Datum datum = this->get_datum(cam1, use_sphere_for_isis);
@@ -141,7 +206,7 @@ namespace asp {
       vw_out() << "IP inlier threshold         = " << inlier_thresh << std::endl;
       vw_out() << "IP uniqueness threshold     = " << ip_uniqueness_thresh  << std::endl;
 
-      inlier = ip_matching_w_alignment(single_threaded_camera, cam1, cam2,
+      inlier = ip_matching_w_alignment(camera_pool.get(), cam1, cam2,
                                        image1_norm, image2_norm,
                                        ip_per_tile,
                                        datum, match_filename,
@@ -204,8 +269,23 @@ namespace asp {
   // Default implementation of this function.  Derived classes will probably override this.
   void StereoSession::camera_models(boost::shared_ptr<vw::camera::CameraModel> &cam1,
                                     boost::shared_ptr<vw::camera::CameraModel> &cam2) {
+
+    bool tile_worker = stereo_settings().tile_worker;
+    if (tile_worker && m_cached_left_camera.get() != NULL &&
+        m_cached_camera_adjust_prefix == stereo_settings().bundle_adjust_prefix) {
+      cam1 = m_cached_left_camera;
+      cam2 = m_cached_right_camera;
+      return;
+    }
+
     cam1 = camera_model(m_left_image_file,  m_left_camera_file);
     cam2 = camera_model(m_right_image_file, m_right_camera_file);
+
+    if (tile_worker) {
+      m_cached_left_camera          = cam1;
+      m_cached_right_camera         = cam2;
+      m_cached_camera_adjust_prefix = stereo_settings().bundle_adjust_prefix;
+    }
   }
 
   // This function will be over-written for ASTER
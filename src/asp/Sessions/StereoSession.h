@@ -148,6 +148,11 @@ namespace asp {
     std::string m_left_camera_file, m_right_camera_file;
     std::string m_out_prefix, m_input_dem;
 
+    // With --tile-worker, the cameras are loaded once and reused for all
+    // tiles, as long as the bundle adjust prefix they were loaded with stays.
+    boost::shared_ptr<vw::camera::CameraModel> m_cached_left_camera, m_cached_right_camera;
+    std::string m_cached_camera_adjust_prefix;
+
     virtual void initialize (vw::cartography::GdalWriteOptions const& options,
 			     std::string const& left_image_file,
 			     std::string const& right_image_file,
@@ -168,6 +173,9 @@ namespace asp {
     virtual bool requires_input_dem       () const {return false;}
     virtual bool supports_image_alignment () const {return true; }
     virtual bool is_nadir_facing          () const {return true; }
+    /// Whether the camera models of this session can be used by several
+    /// threads at the same time. If not, each thread loads its own copy.
+    virtual bool supports_multi_threading () const {return true; }
 
 
 
@@ -74,6 +74,7 @@ namespace asp {
 
     virtual std::string name() const { return "isismapisis"; }
     virtual bool        uses_map_projected_inputs() const {return true;}
+    virtual bool        supports_multi_threading () const {return false;}
 
     static StereoSession* construct() { return new StereoSessionIsisMapIsis; }
   };
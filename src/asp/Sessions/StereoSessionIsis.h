@@ -151,6 +151,9 @@ namespace asp {
 
     virtual std::string name() const { return "isis"; }
 
+    /// ISIS cameras are not thread-safe
+    virtual bool supports_multi_threading() const { return false; }
+
     /// Returns the target datum to use for a given camera model
     virtual vw::cartography::Datum get_datum(const vw::camera::CameraModel* cam,
                                              bool use_sphere_for_isis) const;
@@ -25,6 +25,7 @@
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/DemSampler.h>
 #include <asp/Tools/bundle_adjust.h>
 #include <asp/Core/InterestPointMatching.h>
 #include <xercesc/util/PlatformUtils.hpp>
@@ -1347,9 +1348,10 @@ void create_matches_from_mapprojected_images(Options const& opt){
     vw_out() << "Found DEM nodata value: " << nodata_val << std::endl;
   }
   
-  ImageView< PixelMask<double> > dem = create_mask(DiskImageView<double>(dem_file), nodata_val);
-  InterpolationView<EdgeExtensionView< ImageView< PixelMask<double> >, ConstantEdgeExtension >, BilinearInterpolation> interp_dem = interpolate(dem, BilinearInterpolation(),
-																		ConstantEdgeExtension());
+  // Only a few points are sampled, so read the DEM on demand
+  asp::CachedDemView<double> dem(dem_file, nodata_val);
+  InterpolationView<EdgeExtensionView< asp::CachedDemView<double>, ConstantEdgeExtension >, BilinearInterpolation>
+    interp_dem = interpolate(dem, BilinearInterpolation(), ConstantEdgeExtension());
   vw::cartography::GeoReference dem_georef;
   bool is_good = vw::cartography::read_georeference(dem_georef, dem_file);
   if (!is_good) {
@@ -1450,8 +1452,9 @@ void create_gcp_from_mapprojected_images(Options const& opt){
     vw_out() << "Found DEM nodata value: " << nodata_val << std::endl;
   }
   
-  ImageView< PixelMask<double> > dem = create_mask(DiskImageView<double>(dem_file), nodata_val);
-  InterpolationView<EdgeExtensionView< ImageView< PixelMask<double> >, ConstantEdgeExtension >, BilinearInterpolation>
+  // Only a few points are sampled, so read the DEM on demand
+  asp::CachedDemView<double> dem(dem_file, nodata_val);
+  InterpolationView<EdgeExtensionView< asp::CachedDemView<double>, ConstantEdgeExtension >, BilinearInterpolation>
     interp_dem = interpolate(dem, BilinearInterpolation(), ConstantEdgeExtension());
   vw::cartography::GeoReference georef_dem;
   bool is_good = vw::cartography::read_georeference(georef_dem, dem_file);
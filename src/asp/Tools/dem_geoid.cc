@@ -28,6 +28,7 @@ extern "C" {
                             double* flon, double* flat, double* val);
 }
 
+#include <vw/Core/Thread.h>
 #include <vw/FileIO.h>
 #include <vw/Image.h>
 #include <vw/Cartography.h>
@@ -43,6 +44,14 @@ using namespace vw;
 using namespace vw::cartography;
 using namespace std;
 
+/// The largest difference between the interpolated and exact geoid
+/// heights found so far, shared by all tiles.
+struct GeoidInterpStats {
+  vw::Mutex mutex;
+  double    max_deviation;
+  GeoidInterpStats(): max_deviation(0.0) {}
+};
+
 template <class ImageT>
 class DemGeoidView : public ImageViewBase<DemGeoidView<ImageT> >
 {
@@ -55,6 +64,8 @@ class DemGeoidView : public ImageViewBase<DemGeoidView<ImageT> >
   bool     m_reverse_adjustment; ///< If true, convert from orthometric height to geoid height
   double   m_correction;
   double   m_nodata_val;
+  int      m_interp_spacing; ///< If positive, compute the geoid exactly only this often
+  GeoidInterpStats * m_stats;
 
 public:
 
@@ -68,13 +79,15 @@ public:
                bool is_egm2008, vector<double> const& egm2008_grid,
                ImageViewRef<PixelMask<double> > const& geoid,
                GeoReference const& geoid_georef, bool reverse_adjustment,
-               double correction, double nodata_val):
+               double correction, double nodata_val,
+               int interp_spacing, GeoidInterpStats * stats):
     m_img(img), m_georef(georef),
     m_is_egm2008(is_egm2008), m_egm2008_grid(egm2008_grid),
     m_geoid(geoid), m_geoid_georef(geoid_georef),
     m_reverse_adjustment(reverse_adjustment),
     m_correction(correction),
-    m_nodata_val(nodata_val){}
+    m_nodata_val(nodata_val),
+    m_interp_spacing(interp_spacing), m_stats(stats){}
 
   inline int32 cols  () const { return m_img.cols(); }
   inline int32 rows  () const { return m_img.rows(); }
@@ -82,12 +95,11 @@ public:
 
   inline pixel_accessor origin() const { return pixel_accessor(*this); }
 
-  inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
-
-    if ( m_img(col, row, p) == m_nodata_val )
-      return m_nodata_val; // Skip invalid pixels
+  /// The geoid height, including the datum correction, at a DEM
+  /// pixel. Return false if the geoid is not defined there.
+  bool geoid_height(Vector2 const& pix, double & height) const {
 
-    Vector2 lonlat = m_georef.pixel_to_lonlat(Vector2(col, row));
+    Vector2 lonlat = m_georef.pixel_to_lonlat(pix);
 
     // For testing (see the link to the reference web form belows).
     //lonlat[0] = -121;   lonlat[1] = 37;   // mainland US
@@ -112,28 +124,28 @@ public:
     while( lonlat[0] <   0.0  ) lonlat[0] += 360.0;
     while( lonlat[0] >= 360.0 ) lonlat[0] -= 360.0;
 
-
-
-    result_type geoid_height = 0.0;
+    height = 0.0;
     if (m_is_egm2008){
       int nr = m_geoid.rows(), 
           nc = m_geoid.cols();
       // Call fortran function from "geoid" mini external library
       egm2008_call_interp_(&nr, &nc, (double*)&m_egm2008_grid[0],
-                           &lonlat[0], &lonlat[1], &geoid_height);
+                           &lonlat[0], &lonlat[1], &height);
     }else{
       // Use our own interpolation into the geoid image
-      Vector2  pix = m_geoid_georef.lonlat_to_pixel(lonlat);
-      PixelMask<double> interp_val = m_geoid(pix[0], pix[1]);
+      Vector2  geoid_pix = m_geoid_georef.lonlat_to_pixel(lonlat);
+      PixelMask<double> interp_val = m_geoid(geoid_pix[0], geoid_pix[1]);
       if (!is_valid(interp_val))
-        return m_nodata_val;
-      geoid_height = interp_val.child();
+        return false;
+      height = interp_val.child();
     }
 
-    geoid_height += m_correction;
+    height += m_correction;
+    return true;
+  }
 
-    result_type height_above_ellipsoid = m_img(col, row, p);
-    
+  /// Apply the geoid height to a DEM height
+  inline double adjust(double height_above_ellipsoid, double geoid_height) const {
     // Compute height above the geoid
     // - See the note in the main program about the formula below
     if (m_reverse_adjustment)
@@ -142,18 +154,121 @@ public:
       return height_above_ellipsoid - geoid_height;
   }
 
+  inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
+
+    if ( m_img(col, row, p) == m_nodata_val )
+      return m_nodata_val; // Skip invalid pixels
+
+    double height;
+    if (!geoid_height(Vector2(col, row), height))
+      return m_nodata_val;
+
+    return adjust(m_img(col, row, p), height);
+  }
+
   /// \cond INTERNAL
-  typedef DemGeoidView<typename ImageT::prerasterize_type> prerasterize_type;
+  typedef CropView<ImageView<result_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return prerasterize_type( m_img.prerasterize(bbox), m_georef,
-                              m_is_egm2008, m_egm2008_grid,
-                              m_geoid, m_geoid_georef, m_reverse_adjustment,
-                              m_correction, m_nodata_val );
+
+    ImageView<double> dem = crop(m_img, bbox);
+    ImageView<double> geoid(bbox.width(), bbox.height());
+    if (m_interp_spacing <= 0 || !interp_geoid(bbox, geoid)) {
+      // The exact geoid height at each valid pixel
+      for (int col = 0; col < bbox.width(); col++){
+        for (int row = 0; row < bbox.height(); row++){
+          if (dem(col, row) == m_nodata_val ||
+              !geoid_height(Vector2(col + bbox.min().x(), row + bbox.min().y()), geoid(col, row)))
+            dem(col, row) = m_nodata_val;
+        }
+      }
+    }
+
+    // Apply the adjustment to the whole tile at once
+    double sign = m_reverse_adjustment ? 1.0 : -1.0;
+    double * dem_ptr = &dem(0, 0);
+    double const* geoid_ptr = &geoid(0, 0);
+    int num_pixels = bbox.width()*bbox.height();
+    for (int i = 0; i < num_pixels; i++) {
+      if (dem_ptr[i] != m_nodata_val)
+        dem_ptr[i] += sign*geoid_ptr[i];
+    }
+
+    return prerasterize_type( dem, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
   }
   template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
     vw::rasterize( prerasterize(bbox), dest, bbox );
   }
   /// \endcond
+
+private:
+
+  /// Find the geoid height in the tile by computing it exactly on a
+  /// grid of spacing m_interp_spacing, including the tile boundary,
+  /// and interpolating bilinearly in between, first along rows, then
+  /// along columns. Projecting a DEM pixel to lon-lat and looking up
+  /// the geoid is done only at the grid nodes. Return false if the
+  /// geoid is not defined at some node.
+  bool interp_geoid(BBox2i const& bbox, ImageView<double> & geoid) const {
+
+    // The grid nodes, relative to the tile corner
+    std::vector<int> xs, ys;
+    for (int x = 0; x < bbox.width()  - 1; x += m_interp_spacing) xs.push_back(x);
+    for (int y = 0; y < bbox.height() - 1; y += m_interp_spacing) ys.push_back(y);
+    xs.push_back(bbox.width()  - 1);
+    ys.push_back(bbox.height() - 1);
+    int nx = xs.size(), ny = ys.size();
+
+    ImageView<double> nodes(nx, ny);
+    for (int ix = 0; ix < nx; ix++) {
+      for (int iy = 0; iy < ny; iy++) {
+        if (!geoid_height(Vector2(xs[ix] + bbox.min().x(), ys[iy] + bbox.min().y()),
+                          nodes(ix, iy)))
+          return false;
+      }
+    }
+
+    // Interpolate along the node rows
+    for (int iy = 0; iy < ny; iy++) {
+      for (int ix = 0; ix + 1 < nx; ix++) {
+        int x0 = xs[ix], x1 = xs[ix+1];
+        for (int x = x0; x <= x1; x++) {
+          double t = (x1 > x0) ? double(x - x0)/(x1 - x0) : 0.0;
+          geoid(x, ys[iy]) = (1.0 - t)*nodes(ix, iy) + t*nodes(ix+1, iy);
+        }
+      }
+      if (nx == 1)
+        geoid(0, ys[iy]) = nodes(0, iy);
+    }
+
+    // Then along the columns
+    for (int x = 0; x < bbox.width(); x++) {
+      for (int iy = 0; iy + 1 < ny; iy++) {
+        int y0 = ys[iy], y1 = ys[iy+1];
+        for (int y = y0 + 1; y < y1; y++) {
+          double t = double(y - y0)/(y1 - y0);
+          geoid(x, y) = (1.0 - t)*geoid(x, y0) + t*geoid(x, y1);
+        }
+      }
+    }
+
+    // Compare with the exact geoid height at the cell centers, where
+    // the interpolation error is largest.
+    double max_deviation = 0.0;
+    for (int ix = 0; ix + 1 < nx; ix++) {
+      for (int iy = 0; iy + 1 < ny; iy++) {
+        int x = (xs[ix] + xs[ix+1])/2, y = (ys[iy] + ys[iy+1])/2;
+        double exact;
+        if (geoid_height(Vector2(x + bbox.min().x(), y + bbox.min().y()), exact))
+          max_deviation = std::max(max_deviation, fabs(exact - geoid(x, y)));
+      }
+    }
+    if (m_stats != NULL) {
+      vw::Mutex::Lock lock(m_stats->mutex);
+      m_stats->max_deviation = std::max(m_stats->max_deviation, max_deviation);
+    }
+
+    return true;
+  }
 };
 
 // Helper function which uses the class above.
@@ -163,11 +278,13 @@ dem_geoid( ImageViewBase<ImageT> const& img, GeoReference const& georef,
            bool is_egm2008, vector<double> & egm2008_grid,
            ImageViewRef<PixelMask<double> > const& geoid,
            GeoReference const& geoid_georef, bool reverse_adjustment,
-           double correction, double nodata_val) {
+           double correction, double nodata_val,
+           int interp_spacing, GeoidInterpStats * stats) {
   return DemGeoidView<ImageT>( img.impl(), georef,
                                is_egm2008, egm2008_grid,
                                geoid, geoid_georef,
-                               reverse_adjustment, correction, nodata_val );
+                               reverse_adjustment, correction, nodata_val,
+                               interp_spacing, stats );
 }
 
 struct Options : vw::cartography::GdalWriteOptions {
@@ -175,6 +292,7 @@ struct Options : vw::cartography::GdalWriteOptions {
   double nodata_value;
   bool   use_double;
   bool   reverse_adjustment;
+  int    interp_spacing;
 };
 
 string get_geoid_full_path(string geoid_file){
@@ -216,7 +334,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
          "Output using double precision (64 bit) instead of float (32 bit).")
     ("reverse-adjustment",
                         po::bool_switch(&opt.reverse_adjustment)->default_value(false)->implicit_value(true),
-        "Go from DEM relative to the geoid to DEM relative to the ellipsoid.");
+        "Go from DEM relative to the geoid to DEM relative to the ellipsoid.")
+    ("interp-spacing",  po::value(&opt.interp_spacing)->default_value(0),
+        "Compute the geoid correction exactly only on a grid with this spacing, in pixels, in each tile, and interpolate bilinearly in between. This is much faster for large DEMs. The largest deviation from the exact correction, as sampled at the grid cell centers, is printed at the end. If 0, compute it at each pixel.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -239,6 +359,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
     vw_throw( ArgumentErr() << "Requires <dem> in order to proceed.\n\n"
               << usage << general_options );
 
+  if ( opt.interp_spacing < 0 )
+    vw_throw( ArgumentErr() << "The value of --interp-spacing must be non-negative.\n" );
+
   boost::to_lower(opt.geoid);
 
   if ( opt.out_prefix.empty() )
@@ -447,24 +570,30 @@ int main( int argc, char *argv[] ) {
     //vw_out() << "Geoid georef: " << geoid_georef << std::endl;
 
     // Set up conversion image view
-    ImageViewRef<double> adj_dem = dem_geoid(dem_img, dem_georef,
-                                             is_egm2008, egm2008_grid,
-                                             geoid, geoid_georef,
-                                             reverse_adjustment, major_correction, dem_nodata_val);
+    GeoidInterpStats interp_stats;
+    DemGeoidView<DiskImageView<double> > adj_dem
+      = dem_geoid(dem_img, dem_georef,
+                  is_egm2008, egm2008_grid,
+                  geoid, geoid_georef,
+                  reverse_adjustment, major_correction, dem_nodata_val,
+                  opt.interp_spacing, &interp_stats);
 
     string adj_dem_file = opt.out_prefix + "-adj.tif";
     vw_out() << "Writing adjusted DEM: " << adj_dem_file << endl;
 
     if ( opt.use_double ) {
       // Output as double
+      ImageViewRef<double> adj_dem_double = adj_dem;
       boost::scoped_ptr<DiskImageResourceGDAL> rsrc( vw::cartography::build_gdal_rsrc(adj_dem_file,
-                                                                          adj_dem, opt ) );
+                                                                          adj_dem_double, opt ) );
       rsrc->set_nodata_write( dem_nodata_val );
       write_georeference( *rsrc, dem_georef );
-      block_write_image( *rsrc, adj_dem,
+      block_write_image( *rsrc, adj_dem_double,
                          TerminalProgressCallback("asp", "\t--> Applying DEM adjustment: ") );
     }else{
-      // Output as float
+      // Output as float. Cast the concrete view, not an ImageViewRef
+      // of it, so that its prerasterize, which does the interpolation,
+      // is still called.
       ImageViewRef<float> adj_dem_float = channel_cast<float>( adj_dem );
       boost::scoped_ptr<DiskImageResourceGDAL> rsrc( vw::cartography::build_gdal_rsrc(adj_dem_file,
                                                                           adj_dem_float, opt ) );
@@ -474,6 +603,9 @@ int main( int argc, char *argv[] ) {
                          TerminalProgressCallback("asp", "\t--> Applying DEM adjustment: ") );
     }
 
+    if (opt.interp_spacing > 0)
+      vw_out() << "Maximum deviation of the interpolated geoid correction "
+               << "from the exact one: " << interp_stats.max_deviation << " m." << endl;
 
   } ASP_STANDARD_CATCHES;
 
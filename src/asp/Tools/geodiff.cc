@@ -17,6 +17,7 @@
 
 
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/DemDiff.h>
 #include <vw/FileIO.h>
 #include <vw/Image.h>
 #include <vw/Cartography.h>
@@ -33,17 +34,6 @@ using namespace vw::cartography;
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
-// Function to convert a masked geodetic vector to a masked altitude vector
-class MGeodeticToMAltitude : public ReturnFixedType<PixelMask<double> > {
-public:
-  PixelMask<double> operator()(PixelMask<Vector3> const& v) const {
-    if (!is_valid(v)) {
-      return PixelMask<double>();
-    }
-    return PixelMask<double>(v.child()[2]);
-  }
-};
-
 struct Options : vw::cartography::GdalWriteOptions {
   string dem1_file, dem2_file, output_prefix, csv_format_str, csv_proj4_str;
   double nodata_value;
@@ -116,6 +106,37 @@ void georef_sanity_checks(GeoReference const& georef1, GeoReference const& geore
   
 }
 
+/// Write the difference of two DEMs, as float or double. The cast to
+/// float is applied before the view is wrapped in an ImageViewRef, so
+/// that it is rasterized in tiles rather than pixel by pixel.
+template <class ImageT>
+void write_difference(Options const& opt, ImageViewBase<ImageT> const& diff,
+                      GeoReference const& georef) {
+
+  std::string output_file = opt.output_prefix + "-diff.tif";
+  vw_out() << "Writing difference file: " << output_file << "\n";
+    
+  if (opt.use_float) {
+    ImageViewRef<float> difference_float = channel_cast<float>(diff.impl());
+    boost::scoped_ptr<DiskImageResourceGDAL>
+      rsrc(vw::cartography::build_gdal_rsrc(output_file,
+                                            difference_float, opt));
+    rsrc->set_nodata_write(opt.nodata_value);
+    write_georeference(*rsrc, georef);
+    block_write_image(*rsrc, difference_float,
+                      TerminalProgressCallback("asp", "\t--> Differencing: "));
+  } else {
+    ImageViewRef<double> difference = diff.impl();
+    boost::scoped_ptr<DiskImageResourceGDAL>
+      rsrc(vw::cartography::build_gdal_rsrc(output_file,
+                                            difference, opt));
+    rsrc->set_nodata_write(opt.nodata_value);
+    write_georeference(*rsrc, georef);
+    block_write_image(*rsrc, difference,
+                      TerminalProgressCallback("asp", "\t--> Differencing: "));
+  }
+}
+
 void dem2dem_diff(Options& opt){
   
   DiskImageResourceGDAL dem1_rsrc(opt.dem1_file), dem2_rsrc(opt.dem2_file);
@@ -141,61 +162,56 @@ void dem2dem_diff(Options& opt){
   
   georef_sanity_checks(dem1_georef, dem2_georef);
 
+  // If the two DEMs have the same projection and pixel size, a pixel
+  // in the first DEM is at a fixed shift from the corresponding pixel
+  // in the second DEM.
+  Vector2 shift;
+  bool is_shift = asp::dem_grid_shift(dem1_georef, bounding_box(dem1_disk_image_view),
+                                      dem2_georef, bounding_box(dem2_disk_image_view),
+                                      shift);
+
   // Generate a bounding box that is the minimum of the two BBox areas
   BBox2 crop_box = bounding_box(dem1_disk_image_view);
 
   // Transform the second DEM's bounding box to first DEM's pixels
-  GeoTransform gt(dem2_georef, dem1_georef);
-  BBox2 box21 = gt.forward_bbox(bounding_box(dem2_disk_image_view));
+  BBox2 box21;
+  if (is_shift) {
+    box21 = BBox2(-shift, Vector2(dem2_disk_image_view.cols(),
+                                  dem2_disk_image_view.rows()) - shift);
+  } else {
+    GeoTransform gt(dem2_georef, dem1_georef);
+    box21 = gt.forward_bbox(bounding_box(dem2_disk_image_view));
+  }
   crop_box.crop(box21);
 
   if (crop_box.empty()) 
     vw_throw(ArgumentErr() << "The two DEMs do not have a common area.\n");
-    
-  ImageViewRef<PixelMask<double> > dem2_trans =
-    crop(geo_transform
-	 (per_pixel_filter(dem_to_geodetic
-			   (create_mask(dem2_disk_image_view, dem2_nodata),
-			    dem2_georef),
-			   MGeodeticToMAltitude()),
-	  dem2_georef, dem1_georef,
-      ValueEdgeExtension<PixelMask<double> >(PixelMask<double>())),
-     crop_box);
-    
-  ImageViewRef<double> difference;
-  if (opt.use_absolute) {
-    difference =
-      apply_mask(abs(crop(create_mask(dem1_disk_image_view, dem1_nodata), crop_box) - dem2_trans),
-                 opt.nodata_value);
-  } else {
-    difference =
-      apply_mask(crop(create_mask(dem1_disk_image_view, dem1_nodata), crop_box) - dem2_trans,
-                 opt.nodata_value);
-  }
-    
+
+  if (is_shift)
+    vw_out() << "The DEM grids differ by a shift of " << shift << " pixels.\n";
+  else
+    vw_out() << "The DEMs have different grids, transforming the second DEM.\n";
+
+  // The resampled second DEM can only be rasterized in tiles, so it
+  // is kept as a concrete view, not in an ImageViewRef, until the
+  // difference is written.
+  asp::DemOnDemGridView dem2_trans(create_mask(dem2_disk_image_view, dem2_nodata),
+                                   dem1_disk_image_view.cols(), dem1_disk_image_view.rows(),
+                                   GeoTransform(dem2_georef, dem1_georef), is_shift, shift);
+
   GeoReference crop_georef = crop(dem1_georef, crop_box);
-    
-  std::string output_file = opt.output_prefix + "-diff.tif";
-  vw_out() << "Writing difference file: " << output_file << "\n";
-    
-  if (opt.use_float) {
-    ImageViewRef<float> difference_float = channel_cast<float>(difference);
-    boost::scoped_ptr<DiskImageResourceGDAL>
-      rsrc(vw::cartography::build_gdal_rsrc(output_file,
-                                            difference_float, opt));
-    rsrc->set_nodata_write(opt.nodata_value);
-    write_georeference(*rsrc, crop_georef);
-    block_write_image(*rsrc, difference_float,
-                      TerminalProgressCallback("asp", "\t--> Differencing: "));
-  } else {
-    boost::scoped_ptr<DiskImageResourceGDAL>
-      rsrc(vw::cartography::build_gdal_rsrc(output_file,
-                                            difference, opt));
-    rsrc->set_nodata_write(opt.nodata_value);
-    write_georeference(*rsrc, crop_georef);
-    block_write_image(*rsrc, difference,
-                      TerminalProgressCallback("asp", "\t--> Differencing: "));
-  }
+  if (opt.use_absolute)
+    write_difference(opt,
+                     apply_mask(abs(crop(create_mask(dem1_disk_image_view, dem1_nodata), crop_box) -
+                                    crop(dem2_trans, crop_box)),
+                                opt.nodata_value),
+                     crop_georef);
+  else
+    write_difference(opt,
+                     apply_mask(crop(create_mask(dem1_disk_image_view, dem1_nodata), crop_box) -
+                                crop(dem2_trans, crop_box),
+                                opt.nodata_value),
+                     crop_georef);
 }
 
 // From a DEM, subtract a csv file. Reverse the sign is 'reverse' is true.
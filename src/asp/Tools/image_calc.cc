@@ -331,6 +331,146 @@ struct calc_grammar : b_s::qi::grammar<ITER, calc_operation(), b_s::ascii::space
 }; // End struct calc_grammer
 
 
+//================================================================================
+// - Compiled evaluation of the operations tree
+
+/// The operations tree compiled to a program for a stack machine whose
+/// entries are whole rows of values. Each operation is then applied in
+/// a tight loop over a row, instead of walking the tree at each pixel.
+/// Subtrees which do not depend on the inputs are folded into constants.
+class CalcProgram {
+
+  // An instruction either pushes a number or an input variable on the
+  // stack, or applies a unary or binary operation to the top of the stack.
+  struct Instruction {
+    OperationType opType;
+    double        value;
+    int           varName;
+    Instruction(OperationType o, double v = 0, int var = 0):
+      opType(o), value(v), varName(var){}
+  };
+
+  std::vector<Instruction> m_program;
+  int m_stack_size;
+
+  /// True if the operation does not depend on the input variables
+  static bool is_constant(calc_operation const& op) {
+    if (op.opType == OP_variable)
+      return false;
+    for (size_t i = 0; i < op.inputs.size(); i++)
+      if (!is_constant(op.inputs[i]))
+        return false;
+    return true;
+  }
+
+  void push(Instruction const& instr, int & depth) {
+    m_program.push_back(instr);
+    if (instr.opType == OP_number || instr.opType == OP_variable)
+      depth++;
+    else if (instr.opType != OP_negate && instr.opType != OP_abs)
+      depth--; // binary operation
+    m_stack_size = std::max(m_stack_size, depth);
+  }
+
+  void compile(calc_operation const& op, int num_vars, int & depth) {
+
+    size_t min_inputs = 0;
+    switch(op.opType) {
+    case OP_number: case OP_variable:            min_inputs = 0; break;
+    case OP_negate: case OP_abs:
+    case OP_min:    case OP_max:                 min_inputs = 1; break;
+    case OP_add:    case OP_subtract: case OP_divide:
+    case OP_multiply: case OP_power:             min_inputs = 2; break;
+    default:
+      vw_throw(LogicErr() << "Unexpected operation type!\n");
+    }
+    if (op.inputs.size() < min_inputs)
+      vw_throw(LogicErr() << "Insufficient inputs for this operation!\n");
+
+    if (is_constant(op)) {
+      push(Instruction(OP_number, op.applyOperation<double>(std::vector<double>())), depth);
+      return;
+    }
+
+    if (op.opType == OP_variable) {
+      if (op.varName < 0 || op.varName >= num_vars)
+        vw_throw(ArgumentErr() << "Unrecognized variable input!\n");
+      push(Instruction(OP_variable, 0, op.varName), depth);
+      return;
+    }
+
+    // The min and max of several inputs are found two at a time
+    compile(op.inputs[0], num_vars, depth);
+    if (op.opType == OP_negate || op.opType == OP_abs) {
+      push(Instruction(op.opType), depth);
+      return;
+    }
+    size_t num_inputs = (op.opType == OP_min || op.opType == OP_max) ? op.inputs.size() : 2;
+    for (size_t i = 1; i < num_inputs; i++) {
+      compile(op.inputs[i], num_vars, depth);
+      push(Instruction(op.opType), depth);
+    }
+  }
+
+public:
+
+  CalcProgram(calc_operation const& operation_tree, int num_vars): m_stack_size(0) {
+    int depth = 0;
+    compile(operation_tree, num_vars, depth);
+  }
+
+  /// Evaluate the program on rows of the input variables, each of the
+  /// given length. The stack is scratch space, so that this object can
+  /// be shared among threads. Returns a pointer to the results.
+  double const* evaluate(std::vector<double const*> const& inputs, int len,
+                         std::vector< std::vector<double> > & stack) const {
+
+    stack.resize(m_stack_size);
+    for (size_t i = 0; i < stack.size(); i++)
+      stack[i].resize(len);
+
+    int depth = 0;
+    for (size_t k = 0; k < m_program.size(); k++) {
+      Instruction const& instr = m_program[k];
+      if (instr.opType == OP_number) {
+        std::fill(stack[depth].begin(), stack[depth].end(), instr.value);
+        depth++;
+        continue;
+      }
+      if (instr.opType == OP_variable) {
+        std::copy(inputs[instr.varName], inputs[instr.varName] + len, stack[depth].begin());
+        depth++;
+        continue;
+      }
+
+      double * a = &stack[depth-1][0];
+      switch(instr.opType) {
+      case OP_negate: for (int i = 0; i < len; i++) a[i] = -a[i];         continue;
+      case OP_abs:    for (int i = 0; i < len; i++) a[i] = std::abs(a[i]); continue;
+      default: break;
+      }
+
+      // Binary operations store the result in the next to top entry
+      a = &stack[depth-2][0];
+      double const* b = &stack[depth-1][0];
+      switch(instr.opType) {
+      case OP_add:      for (int i = 0; i < len; i++) a[i] += b[i];          break;
+      case OP_subtract: for (int i = 0; i < len; i++) a[i] -= b[i];          break;
+      case OP_divide:   for (int i = 0; i < len; i++) a[i] /= b[i];          break;
+      case OP_multiply: for (int i = 0; i < len; i++) a[i] *= b[i];          break;
+      case OP_power:    for (int i = 0; i < len; i++) a[i] = pow(a[i], b[i]); break;
+      case OP_min:      for (int i = 0; i < len; i++) if (b[i] < a[i]) a[i] = b[i]; break;
+      case OP_max:      for (int i = 0; i < len; i++) if (b[i] > a[i]) a[i] = b[i]; break;
+      default:
+        vw_throw(LogicErr() << "Unexpected operation type!\n");
+      }
+      depth--;
+    }
+
+    return &stack[0][0];
+  }
+};
+
 //=================================================================================
 
 /// List of possible output data types
@@ -390,6 +530,7 @@ vw::float64 clamp_and_cast<vw::float64>(const double val) {
 }
 
 /// Image view class which applies the calc_operation tree to each pixel location.
+/// The tree is compiled once, and then evaluated a row at a time.
 template <class ImageT, typename OutputPixelT>
 class ImageCalcView : public ImageViewBase<ImageCalcView<ImageT, OutputPixelT> > {
 
@@ -403,7 +544,7 @@ private: // Variables
   std::vector<bool      > m_has_nodata_vec;
   std::vector<input_pixel_type> m_nodata_vec;
   result_type    m_output_nodata;
-  calc_operation m_operation_tree;
+  CalcProgram    m_program;
   int m_num_rows;
   int m_num_cols;
   int m_num_channels;
@@ -418,7 +559,7 @@ public: // Functions
                  calc_operation const& operation_tree)
                   : m_image_vec(imageVec),   m_has_nodata_vec(has_nodata_vec),
                     m_nodata_vec(nodata_vec), m_output_nodata(outputNodata),
-                    m_operation_tree(operation_tree) {
+                    m_program(operation_tree, imageVec.size()) {
     const size_t numImages = imageVec.size();
     VW_ASSERT( (numImages > 0), ArgumentErr() << "ImageCalcView: One or more images required!." );
     VW_ASSERT( (has_nodata_vec.size() == numImages), LogicErr() << "ImageCalcView: Incorrect hasNodata count passed in!." );
@@ -456,54 +597,50 @@ public: // Functions
     // Set up the output image tile
     ImageView<result_type> tile(bbox.width(), bbox.height());
 
-    // TODO: Left to right processing!
-
-    // Set up for pixel calculations
-    const size_t num_images = m_image_vec.size();
-    std::vector<input_pixel_type> input_pixels(num_images);
-    std::vector<double>           input_doubles(num_images);
-
     // Rasterize all the input images at this particular tile
+    const size_t num_images = m_image_vec.size();
     std::vector<ImageView<input_pixel_type> > input_tiles(num_images);
     for (size_t i=0; i<num_images; ++i)
       input_tiles[i] = crop(m_image_vec[i], bbox);
 
-    // Loop through each output pixel and compute each output value
-    for (int c = 0; c < bbox.width(); c++) {
-      for (int r = 0; r < bbox.height(); r++) {
-        // Fetch all the input pixels for this location
-        bool isNodata = false;
-        for (size_t i=0; i<num_images; ++i) {
-          input_pixels[i] = (input_tiles[i])(c,r);
-
-          // If any of the input pixels are nodata, the output is nodata.
-          if (m_has_nodata_vec[i] && (m_nodata_vec[i] == input_pixels[i])) {
-            isNodata = true;
-            break;
-          }
-        } // End image loop
-
-        if (isNodata) { // Output is nodata, move on to the next pixel
-          tile(c, r) = m_output_nodata;
-          continue;
-        }
-
+    // The values of the inputs in a row, the nodata mask of the row, and
+    // the scratch space for evaluation
+    const int width = bbox.width();
+    std::vector< std::vector<double> > input_rows(num_images, std::vector<double>(width));
+    std::vector<double const*> input_ptrs(num_images);
+    for (size_t i=0; i<num_images; ++i)
+      input_ptrs[i] = &input_rows[i][0];
+    std::vector<vw::uint8> is_nodata(width);
+    std::vector< std::vector<double> > stack;
 
-        for (int chan=0; chan<m_num_channels; ++chan) {
-          for (size_t i=0; i<num_images; ++i) {
-            input_doubles[i] = input_pixels[i][chan];
-          } // End image loop
+    for (int r = 0; r < bbox.height(); r++) {
 
-          // Apply the operation tree to this pixel and store in the output pixel
-          double newVal = m_operation_tree.applyOperation<double>(input_doubles);
-          //if (newVal > 255)
-          //  std::cout << "Value: " << newVal << " --> " << static_cast<double>(clamp_and_cast<output_channel_type>(newVal)) << "\n";
-          tile(c, r, chan) = clamp_and_cast<output_channel_type>(newVal);
+      // If any of the input pixels are nodata, the output is nodata.
+      std::fill(is_nodata.begin(), is_nodata.end(), 0);
+      for (size_t i=0; i<num_images; ++i) {
+        if (!m_has_nodata_vec[i])
+          continue;
+        for (int c = 0; c < width; c++)
+          if (m_nodata_vec[i] == input_tiles[i](c,r))
+            is_nodata[c] = 1;
+      }
 
-        } // End channel loop
+      for (int chan=0; chan<m_num_channels; ++chan) {
+        for (size_t i=0; i<num_images; ++i)
+          for (int c = 0; c < width; c++)
+            input_rows[i][c] = input_tiles[i](c,r)[chan];
+
+        // Apply the operation tree to this row and store it in the output
+        double const* result = m_program.evaluate(input_ptrs, width, stack);
+        for (int c = 0; c < width; c++) {
+          if (is_nodata[c])
+            tile(c, r) = m_output_nodata;
+          else
+            tile(c, r, chan) = clamp_and_cast<output_channel_type>(result[c]);
+        }
 
-      } // End row loop
-    } // End column loop
+      } // End channel loop
+    } // End row loop
 
   // Return the tile we created with fake borders to make it look the size of the entire output image
   return prerasterize_type(tile,
@@ -31,6 +31,8 @@
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Core/StereoSettings.h>
 
+#include <boost/thread/tss.hpp>
+
 using namespace vw;
 using namespace vw::cartography;
 namespace po = boost::program_options;
@@ -107,8 +109,239 @@ public:
 
     return out_box;
   }
+
+  /// Same interface as Map2CamTrans. There is no DEM to cache.
+  void cache_dem(vw::BBox2i const& bbox) const {}
 }; // End class Datum2CamTrans
 
+/// Wrapper around a transform from output (map-projected) pixels to
+/// camera pixels. If given a positive tolerance, in each tile the
+/// exact transform is evaluated only on an adaptive grid, and the
+/// results are interpolated bilinearly in between. A grid cell is
+/// subdivided while the interpolated value at its center or at one
+/// of its edge midpoints differs from the exact one by more than the
+/// tolerance, or while any of its samples fails to project. With a
+/// non-positive tolerance all calls go to the exact transform.
+template <class TransT>
+class AdaptiveGridTrans : public vw::TransformBase< AdaptiveGridTrans<TransT> > {
+
+  // The camera pixels for the most recent tile seen by a thread.
+  // Transforms are applied by tiles, with reverse_bbox() called on a
+  // tile before reverse() is invoked on its pixels in the same thread.
+  struct TileCache {
+    BBox2i             box;
+    ImageView<Vector2> pix;
+    ImageView<uint8>   is_exact;
+  };
+  
+  TransT       m_trans;
+  double       m_tol;
+  vw::Vector2i m_image_size;
+  Vector2      m_invalid_pix;
+  boost::shared_ptr< boost::thread_specific_ptr<TileCache> > m_cache;
+
+  // Evaluate the exact transform at a tile pixel, unless already done
+  Vector2 exact(TileCache & tc, int col, int row) const {
+    if (!tc.is_exact(col, row)) {
+      tc.pix(col, row) = m_trans.reverse(tc.box.min() + Vector2(col, row));
+      tc.is_exact(col, row) = 1;
+    }
+    return tc.pix(col, row);
+  }
+
+  // See Datum2CamTrans::reverse()
+  bool is_in_image(Vector2 const& pt) const {
+    int b = BicubicInterpolation::pixel_buffer;  
+    return (pt[0] >= b - 1 && pt[0] < m_image_size[0] - b &&
+            pt[1] >= b - 1 && pt[1] < m_image_size[1] - b);
+  }
+  
+  // Fill in the cell with corners (c0, r0) and (c1, r1), inclusive,
+  // by interpolation, subdividing it as needed.
+  void refine(TileCache & tc, int c0, int r0, int c1, int r1) const {
+    
+    Vector2 p00 = exact(tc, c0, r0), p10 = exact(tc, c1, r0);
+    Vector2 p01 = exact(tc, c0, r1), p11 = exact(tc, c1, r1);
+    if (c1 - c0 <= 1 && r1 - r0 <= 1) 
+      return; // all pixels are corners, so they are exact
+
+    int cm = (c0 + c1)/2, rm = (r0 + r1)/2;
+    bool split = (p00 == m_invalid_pix || p10 == m_invalid_pix ||
+                  p01 == m_invalid_pix || p11 == m_invalid_pix);
+    
+    Vector2i samples[5] = {Vector2i(cm, rm), Vector2i(cm, r0), Vector2i(cm, r1),
+                           Vector2i(c0, rm), Vector2i(c1, rm)};
+    for (int s = 0; s < 5 && !split; s++) {
+      Vector2 val = exact(tc, samples[s].x(), samples[s].y());
+      if (val == m_invalid_pix ||
+          norm_2(val - interp(p00, p10, p01, p11, c0, r0, c1, r1,
+                              samples[s].x(), samples[s].y())) > m_tol)
+        split = true;
+    }
+
+    if (!split) {
+      for (int col = c0; col <= c1; col++) {
+        for (int row = r0; row <= r1; row++) {
+          if (tc.is_exact(col, row)) continue;
+          tc.pix(col, row) = interp(p00, p10, p01, p11, c0, r0, c1, r1, col, row);
+          // Near the image boundary the exact transform decides
+          if (!is_in_image(tc.pix(col, row)))
+            exact(tc, col, row);
+        }
+      }
+      return;
+    }
+
+    // Split along each direction which still has interior pixels
+    std::vector<Vector2i> cols, rows;
+    if (c1 - c0 > 1) { cols.push_back(Vector2i(c0, cm)); cols.push_back(Vector2i(cm, c1)); }
+    else             { cols.push_back(Vector2i(c0, c1)); }
+    if (r1 - r0 > 1) { rows.push_back(Vector2i(r0, rm)); rows.push_back(Vector2i(rm, r1)); }
+    else             { rows.push_back(Vector2i(r0, r1)); }
+    for (size_t i = 0; i < cols.size(); i++) 
+      for (size_t j = 0; j < rows.size(); j++) 
+        refine(tc, cols[i][0], rows[j][0], cols[i][1], rows[j][1]);
+  }
+
+  static Vector2 interp(Vector2 const& p00, Vector2 const& p10,
+                        Vector2 const& p01, Vector2 const& p11,
+                        int c0, int r0, int c1, int r1, int col, int row) {
+    double s = (c1 > c0) ? double(col - c0)/double(c1 - c0) : 0.0;
+    double t = (r1 > r0) ? double(row - r0)/double(r1 - r0) : 0.0;
+    return (1-s)*(1-t)*p00 + s*(1-t)*p10 + (1-s)*t*p01 + s*t*p11;
+  }
+  
+public:
+  AdaptiveGridTrans(TransT const& trans, double tol, vw::Vector2i const& image_size):
+    m_trans(trans), m_tol(tol), m_image_size(image_size),
+    m_cache(new boost::thread_specific_ptr<TileCache>()){
+    m_invalid_pix = vw::camera::CameraModel::invalid_pixel();
+  }
+
+  /// Convert Map Projected pixel to camera pixel
+  vw::Vector2 reverse(const vw::Vector2 &p) const{
+    if (m_tol > 0) {
+      TileCache const* tc = m_cache->get();
+      if (tc != NULL && p.x() == floor(p.x()) && p.y() == floor(p.y()) &&
+          tc->box.contains(p)) 
+        return tc->pix(int(p.x()) - tc->box.min().x(), int(p.y()) - tc->box.min().y());
+    }
+    return m_trans.reverse(p);
+  }
+
+  vw::BBox2i reverse_bbox( vw::BBox2i const& bbox ) const {
+    if (m_tol <= 0) 
+      return m_trans.reverse_bbox(bbox);
+
+    TileCache * tc = m_cache->get();
+    if (tc == NULL) {
+      tc = new TileCache;
+      m_cache->reset(tc);
+    }
+    tc->box = bbox;
+    tc->pix.set_size(bbox.width(), bbox.height());
+    tc->is_exact.set_size(bbox.width(), bbox.height());
+    fill(tc->is_exact, 0);
+
+    vw::BBox2 out_box;
+    if (!bbox.empty()) {
+      m_trans.cache_dem(bbox); // speeds up the exact transform within this tile
+      refine(*tc, 0, 0, bbox.width() - 1, bbox.height() - 1);
+      for (int col = 0; col < bbox.width(); col++) {
+        for (int row = 0; row < bbox.height(); row++) {
+          if (tc->pix(col, row) != m_invalid_pix) 
+            out_box.grow(tc->pix(col, row));
+        }
+      }
+    }
+    out_box = grow_bbox_to_int( out_box );
+
+    // Need the check below as to not try to create images with negative dimensions.
+    if (out_box.empty())
+      return vw::BBox2i(0, 0, 0, 0);
+
+    // Account for the interpolation error
+    out_box.expand(int(ceil(m_tol)));
+    return out_box;
+  }
+}; // End class AdaptiveGridTrans
+
+/// ISIS is not thread-safe. When projecting ISIS images with multiple
+/// threads in one process, all calls into ISIS go through this mutex.
+vw::Mutex g_isis_mutex;
+
+/// Wrapper which serializes the calls to a camera model which is not
+/// thread-safe, so that one instance can be shared by all threads.
+class SerializedCameraModel : public vw::camera::CameraModel {
+  boost::shared_ptr<camera::CameraModel> m_cam;
+public:
+  SerializedCameraModel(boost::shared_ptr<camera::CameraModel> cam): m_cam(cam){}
+
+  virtual std::string type() const { return m_cam->type(); }
+
+  virtual Vector2 point_to_pixel(Vector3 const& point) const {
+    Mutex::Lock lock(g_isis_mutex);
+    return m_cam->point_to_pixel(point);
+  }
+  virtual Vector3 pixel_to_vector(Vector2 const& pix) const {
+    Mutex::Lock lock(g_isis_mutex);
+    return m_cam->pixel_to_vector(pix);
+  }
+  virtual Vector3 camera_center(Vector2 const& pix) const {
+    Mutex::Lock lock(g_isis_mutex);
+    return m_cam->camera_center(pix);
+  }
+  virtual Quat camera_pose(Vector2 const& pix) const {
+    Mutex::Lock lock(g_isis_mutex);
+    return m_cam->camera_pose(pix);
+  }
+};
+
+/// Reads the tiles of an image, holding the ISIS mutex while doing so
+/// if the image is an ISIS cube which is read by multiple threads.
+template <class ImageT>
+class SerializedReadView : public ImageViewBase< SerializedReadView<ImageT> > {
+  ImageT m_img;
+  bool   m_serialize;
+public:
+  SerializedReadView(ImageT const& img, bool serialize):
+    m_img(img), m_serialize(serialize){}
+
+  typedef typename ImageT::pixel_type pixel_type;
+  typedef pixel_type result_type;
+  typedef ProceduralPixelAccessor<SerializedReadView> pixel_accessor;
+
+  inline int32 cols  () const { return m_img.cols(); }
+  inline int32 rows  () const { return m_img.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double/*i*/, double/*j*/, int32/*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "SerializedReadView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+    ImageView<pixel_type> tile;
+    if (m_serialize) {
+      Mutex::Lock lock(g_isis_mutex);
+      tile = crop(m_img, bbox);
+    } else {
+      tile = crop(m_img, bbox);
+    }
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
+                             cols(), rows() );
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+
 
 
 
@@ -120,11 +353,11 @@ struct Options : vw::cartography::GdalWriteOptions {
   // Input
   std::string dem_file, image_file, camera_file, output_file, stereo_session,
     bundle_adjust_prefix;
-  bool isQuery;
+  bool isQuery, in_process_tiling, serialize_isis;
 
   // Settings
   std::string target_srs_string;
-  double nodata_value, tr, mpp, ppd, datum_offset;
+  double nodata_value, tr, mpp, ppd, datum_offset, adaptive_grid_tolerance;
   BBox2 target_projwin, target_pixelwin;
 };
 
@@ -153,7 +386,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("t_pixelwin",       po::value(&opt.target_pixelwin),
      "Limit the map-projected image to this region, with the corners given in pixels (xmin ymin xmax ymax). Max is exclusive.")
     ("bundle-adjust-prefix", po::value(&opt.bundle_adjust_prefix),
-     "Use the camera adjustment obtained by previously running bundle_adjust with this output prefix.");
+     "Use the camera adjustment obtained by previously running bundle_adjust with this output prefix.")
+    ("adaptive-grid-tolerance", po::value(&opt.adaptive_grid_tolerance)->default_value(0),
+     "If positive, project into the camera only an adaptive grid of output pixels in each tile, and interpolate in between, refining the grid where the interpolation error exceeds this many camera pixels (for example, 0.01). Much faster for linescan cameras. DEM holes smaller than a grid cell may be missed.")
+    ("in-process-tiling", po::bool_switch(&opt.in_process_tiling)->default_value(false),
+     "Project ISIS images with multiple threads in this process, writing the tiled output blocks directly, with the camera model and the DEM shared among the threads. The calls into ISIS are serialized, so this is best used together with --adaptive-grid-tolerance. Other images are always projected this way.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -193,6 +430,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     opt.stereo_session = "rpc";
   }
 
+  if (opt.adaptive_grid_tolerance < 0)
+    vw_throw( ArgumentErr() << "The adaptive grid tolerance must be non-negative.\n" );
+
   // Need this to be able to load adjusted camera models. That will happen
   // in the stereo session.
   asp::stereo_settings().bundle_adjust_prefix = opt.bundle_adjust_prefix;
@@ -229,9 +469,10 @@ void write_parallel_cond( std::string              const& filename,
 
   bool has_georef = true;
 
-  // ISIS is not thread safe so we must switch out base on what the session is.
+  // ISIS is not thread safe so we must switch out base on what the session is,
+  // unless all ISIS calls were serialized.
   vw_out() << "Writing: " << filename << "\n";
-  if ( session_type == "isis" ) {
+  if ( session_type == "isis" && !opt.serialize_isis ) {
     vw::cartography::write_gdal_image(filename, image.impl(), has_georef, georef,
                           has_nodata, nodata_val, opt, tpc, keywords);
   } else {
@@ -458,7 +699,9 @@ void project_image_nodata(Options & opt,
             apply_mask
             ( // Handle nodata
              transform_nodata( // Apply the output from Map2CamTrans
-                              create_mask(DiskImageView<ImagePixelT>(img_rsrc),
+                              create_mask(SerializedReadView< DiskImageView<ImagePixelT> >
+                                          (DiskImageView<ImagePixelT>(img_rsrc),
+                                           opt.serialize_isis),
                                           opt.nodata_value), // Handle nodata
                               transform,
                               virtual_image_size[0],
@@ -498,7 +741,8 @@ void project_image_alpha(Options & opt,
        crop( // Apply crop (only happens if --t_pixelwin was specified)
              // Transparent pixels are inserted for nodata
              transform_nodata( // Apply the output from Map2CamTrans
-                              DiskImageView<ImagePixelT>(img_rsrc),
+                              SerializedReadView< DiskImageView<ImagePixelT> >
+                              (DiskImageView<ImagePixelT>(img_rsrc), opt.serialize_isis),
                               transform,
                               virtual_image_size[0],
                               virtual_image_size[1],
@@ -531,23 +775,27 @@ void project_image_nodata_pick_transform(Options & opt,
     // A DEM file was provided
     return project_image_nodata<ImagePixelT>(opt, croppedGeoRef,
                                              virtual_image_size, croppedImageBB, camera_model, 
-                                             Map2CamTrans( // Converts coordinates in DEM
-                                                           // georeference to camera pixels
-                                                          camera_model.get(), target_georef,
-                                                          dem_georef, opt.dem_file, image_size,
-                                                          call_from_mapproject
-                                                          )
+                                             AdaptiveGridTrans<Map2CamTrans>
+                                             (Map2CamTrans( // Converts coordinates in DEM
+                                                            // georeference to camera pixels
+                                                           camera_model.get(), target_georef,
+                                                           dem_georef, opt.dem_file, image_size,
+                                                           call_from_mapproject
+                                                           ),
+                                              opt.adaptive_grid_tolerance, image_size)
                                             );
   } else {
     // A constant datum elevation was provided
     return project_image_nodata<ImagePixelT>(opt, croppedGeoRef,
                                              virtual_image_size, croppedImageBB, camera_model, 
-                                             Datum2CamTrans( // Converts coordinates in DEM
-                                                             // georeference to camera pixels
-                                                            camera_model.get(), target_georef,
-                                                            dem_georef, opt.datum_offset, image_size,
-                                                            call_from_mapproject
-                                                            )
+                                             AdaptiveGridTrans<Datum2CamTrans>
+                                             (Datum2CamTrans( // Converts coordinates in DEM
+                                                              // georeference to camera pixels
+                                                             camera_model.get(), target_georef,
+                                                             dem_georef, opt.datum_offset, image_size,
+                                                             call_from_mapproject
+                                                             ),
+                                              opt.adaptive_grid_tolerance, image_size)
                                             );
   }
 }
@@ -566,23 +814,27 @@ void project_image_alpha_pick_transform(Options & opt,
     // A DEM file was provided
     return project_image_alpha<ImagePixelT>(opt, croppedGeoRef,
                                             virtual_image_size, croppedImageBB, camera_model, 
-                                            Map2CamTrans( // Converts coordinates in DEM
-                                                          // georeference to camera pixels
-                                                         camera_model.get(), target_georef,
-                                                         dem_georef, opt.dem_file, image_size,
-                                                         call_from_mapproject
-                                                         )
+                                            AdaptiveGridTrans<Map2CamTrans>
+                                            (Map2CamTrans( // Converts coordinates in DEM
+                                                           // georeference to camera pixels
+                                                          camera_model.get(), target_georef,
+                                                          dem_georef, opt.dem_file, image_size,
+                                                          call_from_mapproject
+                                                          ),
+                                             opt.adaptive_grid_tolerance, image_size)
                                            );
   } else {
     // A constant datum elevation was provided
     return project_image_alpha<ImagePixelT>(opt, croppedGeoRef,
                                             virtual_image_size, croppedImageBB, camera_model, 
-                                            Datum2CamTrans( // Converts coordinates in DEM
-                                                            // georeference to camera pixels
-                                                           camera_model.get(), target_georef,
-                                                           dem_georef, opt.datum_offset, image_size,
-                                                           call_from_mapproject
-                                                           )
+                                            AdaptiveGridTrans<Datum2CamTrans>
+                                            (Datum2CamTrans( // Converts coordinates in DEM
+                                                             // georeference to camera pixels
+                                                            camera_model.get(), target_georef,
+                                                            dem_georef, opt.datum_offset, image_size,
+                                                            call_from_mapproject
+                                                            ),
+                                             opt.adaptive_grid_tolerance, image_size)
                                            );
   }
 }
@@ -627,6 +879,12 @@ int main( int argc, char* argv[] ) {
     boost::shared_ptr<camera::CameraModel> camera_model =
       session->camera_model(opt.image_file, opt.camera_file);
 
+    // Share one ISIS camera among all threads, with its calls serialized
+    opt.serialize_isis = (opt.in_process_tiling &&
+                          (session->name() == "isis" || session->name() == "isismapisis"));
+    if (opt.serialize_isis)
+      camera_model.reset(new SerializedCameraModel(camera_model));
+
     {
       // Safety check that the users are not trying to map project map
       // projected images. This should not be an error as sometimes
@@ -59,6 +59,7 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/DemSampler.h>
 #include <liblas/liblas.hpp>
 
 #include <limits>
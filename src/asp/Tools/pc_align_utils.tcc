@@ -1225,8 +1225,7 @@ InterpolationReadyDem load_interpolation_ready_dem(std::string
   if (!has_georef)
     vw::vw_throw(vw::ArgumentErr() << "DEM: " << dem_path << " does not have a georeference.\n");
 
-  // Set up file handle to the DEM and read the nodata value
-  vw::DiskImageView<float> dem(dem_path);
+  // Read the nodata value
   double nodata = std::numeric_limits<double>::quiet_NaN();
   {
     boost::shared_ptr<vw::DiskImageResource> dem_rsrc( new vw::DiskImageResourceGDAL(dem_path) );
@@ -1234,8 +1233,9 @@ InterpolationReadyDem load_interpolation_ready_dem(std::string
       nodata = dem_rsrc->nodata_read();
   }
   
-  // Set up interpolation + mask view of the DEM
-  vw::ImageViewRef< vw::PixelMask<float> > masked_dem = create_mask(dem, nodata);
+  // Set up interpolation + mask view of the DEM. The DEM is sampled only
+  // where there are points, so it is read in blocks on demand.
+  vw::ImageViewRef< vw::PixelMask<float> > masked_dem = asp::CachedDemView<float>(dem_path, nodata);
   return InterpolationReadyDem(interpolate(masked_dem));
 }
 
@@ -95,7 +95,7 @@ struct Options : vw::cartography::GdalWriteOptions {
   std::string csv_format_str, csv_proj4_str;
   double      search_radius_factor, sigma_factor;
   bool        use_surface_sampling;
-  bool        has_las_or_csv;
+  bool        has_las_or_csv, dem_pyramid;
 
   // Output
   std::string out_prefix, output_file_type;
@@ -106,7 +106,7 @@ struct Options : vw::cartography::GdalWriteOptions {
 	      dem_hole_fill_len(0), ortho_hole_fill_len(0),
 	      remove_outliers_with_pct(true), max_valid_triangulation_error(0),
 	      erode_len(0), search_radius_factor(0), sigma_factor(0), use_surface_sampling(false),
-	      has_las_or_csv(false){}
+	      has_las_or_csv(false), dem_pyramid(false){}
 };
 
 void parse_input_clouds_textures(std::vector<std::string> const& files,
@@ -351,6 +351,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("dem-spacing,s", po::value(&dem_spacing1)->default_value(""),
 	     "Set output DEM resolution (in target georeferenced units per pixel). If not specified, it will be computed automatically (except for LAS and CSV files). Multiple spacings can be set (in quotes) to generate multiple output files. This is the same as the --tr option.")
     ("tr",            po::value(&dem_spacing2)->default_value(""), "This is identical to the --dem-spacing option.")
+    ("dem-pyramid",   po::bool_switch(&opt.dem_pyramid)->default_value(false),
+     "When multiple DEM spacings are set, rasterize the point cloud only at the finest one, and create the products at the coarser spacings by averaging the valid pixels of the finest ones. Each coarser spacing must be an integer multiple of the finest. Much faster than rasterizing the cloud at each spacing.")
     ("datum",                    po::value(&opt.datum),
      "Set the datum. This will override the datum from the input images and also --t_srs, --semi-major-axis, and --semi-minor-axis. Options: WGS_1984, D_MOON (1,737,400 meters), D_MARS (3,396,190 meters), MOLA (3,396,000 meters), NAD83, WGS72, and NAD27. Also accepted: Earth (=WGS_1984), Mars (=D_MARS), Moon (=D_MOON).")
     ("reference-spheroid,r", po::value(&opt.reference_spheroid),
@@ -478,6 +480,22 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
       spacing_provided = true;
   }
 
+  // With a single spacing there is nothing to average, so
+  // --dem-pyramid does nothing.
+  if (opt.dem_pyramid && opt.dem_spacing.size() > 1){
+    double min_spacing = *std::min_element(opt.dem_spacing.begin(), opt.dem_spacing.end());
+    if (min_spacing <= 0)
+      vw_throw( ArgumentErr() << "All DEM spacings must be set when using --dem-pyramid.\n"
+			      << usage << general_options );
+    for (size_t i=0; i<opt.dem_spacing.size(); ++i) {
+      double factor = opt.dem_spacing[i]/min_spacing;
+      if (std::abs(factor - round(factor)) > 1e-6*factor)
+	vw_throw( ArgumentErr() << "When using --dem-pyramid, each DEM spacing must be "
+				<< "an integer multiple of the finest one.\n"
+				<< usage << general_options );
+    }
+  }
+
   if (opt.has_las_or_csv && !spacing_provided){
     vw_throw( ArgumentErr() << "When inputs are LAS or CSV files, the "
 			    << "output DEM resolution must be set.\n" );
@@ -740,6 +758,116 @@ namespace asp{
     return CombinedView<ImageT>(nodata_value, image1.impl(), image2.impl(), image3.impl());
   }
 
+  // Rasterizes several textures over the same geometry in one pass
+  // through the point cloud, with one output plane per texture.
+  class MultiTextureView : public ImageViewBase<MultiTextureView>
+  {
+    OrthoRasterizerView const& m_rasterizer;
+    std::vector< ImageViewRef<float> > m_textures;
+
+  public:
+
+    typedef float pixel_type;
+    typedef float result_type;
+    typedef ProceduralPixelAccessor<MultiTextureView> pixel_accessor;
+
+    MultiTextureView(OrthoRasterizerView const& rasterizer,
+		     std::vector< ImageViewRef<float> > const& textures):
+      m_rasterizer(rasterizer), m_textures(textures){}
+
+    inline int32 cols  () const { return m_rasterizer.cols(); }
+    inline int32 rows  () const { return m_rasterizer.rows(); }
+    inline int32 planes() const { return m_textures.size(); }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
+      vw_throw(NoImplErr() << "MultiTextureView::operator()(...) is not implemented");
+      return result_type();
+    }
+
+    /// \cond INTERNAL
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+      return prerasterize_type(m_rasterizer.rasterize_textures(bbox, m_textures),
+			       -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+    /// \endcond
+  };
+
+  // Average the valid pixels in each factor x factor block of the
+  // image. Used to create coarser DEMs from a finer one. Pixels which
+  // equal the nodata value or are NaN are not valid.
+  template <class ImageT>
+  class BlockAverageView : public ImageViewBase<BlockAverageView<ImageT> >
+  {
+    ImageT m_image;
+    int    m_factor;
+    double m_nodata_value;
+
+  public:
+
+    typedef float pixel_type;
+    typedef float result_type;
+    typedef ProceduralPixelAccessor<BlockAverageView> pixel_accessor;
+
+    BlockAverageView(ImageT const& image, int factor, double nodata_value):
+      m_image(image), m_factor(factor), m_nodata_value(nodata_value){}
+
+    inline int32 cols  () const { return (m_image.cols() + m_factor - 1)/m_factor; }
+    inline int32 rows  () const { return (m_image.rows() + m_factor - 1)/m_factor; }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
+      vw_throw(NoImplErr() << "BlockAverageView::operator()(...) is not implemented");
+      return result_type();
+    }
+
+    /// \cond INTERNAL
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+
+      BBox2i in_box(bbox.min()*m_factor, bbox.max()*m_factor);
+      in_box.crop(bounding_box(m_image));
+      ImageView<float> in_tile = crop(m_image, in_box);
+
+      ImageView<float> tile(bbox.width(), bbox.height());
+      for (int col = 0; col < bbox.width(); col++){
+	for (int row = 0; row < bbox.height(); row++){
+	  double sum = 0;
+	  int count = 0;
+	  int beg_col = (bbox.min().x() + col)*m_factor - in_box.min().x();
+	  int beg_row = (bbox.min().y() + row)*m_factor - in_box.min().y();
+	  for (int c = beg_col; c < std::min(beg_col + m_factor, in_tile.cols()); c++){
+	    for (int r = beg_row; r < std::min(beg_row + m_factor, in_tile.rows()); r++){
+	      if (in_tile(c, r) == m_nodata_value || boost::math::isnan(in_tile(c, r)))
+		continue;
+	      sum += in_tile(c, r);
+	      count++;
+	    }
+	  }
+	  tile(col, row) = (count > 0) ? sum/count : m_nodata_value;
+	}
+      }
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+    /// \endcond
+  };
+  template <class ImageT>
+  BlockAverageView<ImageT> block_average(ImageViewBase<ImageT> const& image,
+					 int factor, double nodata_value){
+    return BlockAverageView<ImageT>(image.impl(), factor, nodata_value);
+  }
+
   // Round pixels in given image to multiple of given scale.
   // Don't round nodata values.
   template <class PixelT>
@@ -800,6 +928,10 @@ namespace asp{
 	m_vals.push_back(value);
     }
 
+    void merge(ErrorRangeEstimAccum const& other) {
+      m_vals.insert(m_vals.end(), other.m_vals.begin(), other.m_vals.end());
+    }
+
     int size(){
       return m_vals.size();
     }
@@ -875,6 +1007,26 @@ namespace asp{
 
 
 
+/// Removes a temporary file when going out of scope, including when
+/// an exception is thrown
+class TempFileRemover {
+  std::string m_file;
+public:
+  TempFileRemover(): m_file("") {}
+  void set(std::string const& file) { m_file = file; }
+  ~TempFileRemover() {
+    if (m_file == "")
+      return;
+    boost::system::error_code ec; // don't throw from the destructor
+    fs::remove(m_file, ec);
+  }
+};
+
+/// Fetch one plane of the file with the textures rasterized in one pass
+ImageViewRef< PixelGray<float> > rasterized_plane(std::string const& file, int plane){
+  return pixel_cast< PixelGray<float> >(select_plane(DiskImageView<float>(file), plane));
+}
+
 /// Do more work!
 void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
 				Options& opt,
@@ -929,7 +1081,65 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
   // rather than filling holes in the cloud first. This is faster.
   rasterizer.set_hole_fill_len(0);
 
-  ImageViewRef< PixelGray<float> > rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+  // Each pass through the rasterizer reads and filters the point
+  // cloud. Hence, all products which share the DEM geometry are
+  // rasterized together in one pass, saved to a temporary multi-band
+  // file, and written from there. Each product is still binned
+  // separately. That is the DEM, the intersection
+  // error, and the DRG, unless the cloud must be hole-filled for it.
+  std::vector< ImageViewRef<float> > textures;
+  int dem_plane = -1, err_plane = -1, drg_plane = -1;
+  int num_channels = 0;
+  if ( !opt.no_dem ){
+    dem_plane = textures.size();
+    textures.push_back(channel_cast<float>(select_channel(rasterizer.point_image(), 2)));
+  }
+  if ( opt.do_error ) {
+    num_channels = asp::num_channels(opt.pointcloud_files);
+    if (num_channels == 4){
+      ImageViewRef<Vector4> point_disk_image = asp::form_point_cloud_composite<Vector4>(opt.pointcloud_files,
+							    asp::OrthoRasterizerView::max_subblock_size());
+      err_plane = textures.size();
+      textures.push_back(channel_cast<float>(select_channel(point_disk_image, 3)));
+    }else if (num_channels == 6){
+      ImageViewRef<Vector6> point_disk_image = asp::form_point_cloud_composite<Vector6>(opt.pointcloud_files,
+							    asp::OrthoRasterizerView::max_subblock_size());
+      ImageViewRef<Vector3> ned_err = asp::error_to_NED(point_disk_image, georef);
+      err_plane = textures.size();
+      for (int ch_index = 0; ch_index < 3; ch_index++)
+	textures.push_back(channel_cast<float>(select_channel(ned_err, ch_index)));
+    }
+  }
+  if ( opt.do_ortho && opt.ortho_hole_fill_len == 0 ){
+    ImageViewRef< PixelGray<float> > texture = asp::form_point_cloud_composite< PixelGray<float> >(opt.texture_files,
+							  asp::OrthoRasterizerView::max_subblock_size());
+    drg_plane = textures.size();
+    textures.push_back(select_channel(texture, 0));
+  }
+
+  std::string fused_file;
+  TempFileRemover fused_file_remover;
+  if (textures.size() >= 2){
+    Stopwatch sw;
+    sw.start();
+    fused_file = opt.out_prefix + "-rasterized-tmp.tif";
+    fused_file_remover.set(fused_file);
+    vw_out() << "Writing: " << fused_file << "\n";
+    bool has_georef = false, has_nodata = true;
+    block_write_gdal_image(fused_file, asp::MultiTextureView(rasterizer, textures),
+			   has_georef, georef, has_nodata, opt.nodata_value, opt,
+			   TerminalProgressCallback("asp", "Rasterizing: "));
+    sw.stop();
+    vw_out(DebugMessage,"asp") << "Rasterization time: " << sw.elapsed_seconds() << std::endl;
+  }else{
+    dem_plane = err_plane = drg_plane = -1; // one product, rasterize it directly
+  }
+
+  ImageViewRef< PixelGray<float> > rasterizer_fsaa;
+  if (dem_plane >= 0)
+    rasterizer_fsaa = generate_fsaa_raster( rasterized_plane(fused_file, dem_plane), opt );
+  else
+    rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
 
   // Write out the DEM. We've set the texture to be the height.
   Vector2 tile_size(vw_settings().default_tile_size(),
@@ -963,17 +1173,20 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
 
   // Write triangulation error image if requested
   if ( opt.do_error ) {
-    int num_channels = asp::num_channels(opt.pointcloud_files);
 
     int hole_fill_len = 0;
     if (num_channels == 4){
       // The error is a scalar.
-      ImageViewRef<Vector4> point_disk_image = asp::form_point_cloud_composite<Vector4>(opt.pointcloud_files,
-							    asp::OrthoRasterizerView::max_subblock_size());
-      ImageViewRef<double> error_channel = select_channel(point_disk_image,3);
-      rasterizer.set_texture( error_channel );
-      rasterizer.set_hole_fill_len(hole_fill_len);
-      rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+      if (err_plane >= 0){
+	rasterizer_fsaa = generate_fsaa_raster( rasterized_plane(fused_file, err_plane), opt );
+      }else{
+	ImageViewRef<Vector4> point_disk_image = asp::form_point_cloud_composite<Vector4>(opt.pointcloud_files,
+							      asp::OrthoRasterizerView::max_subblock_size());
+	ImageViewRef<double> error_channel = select_channel(point_disk_image,3);
+	rasterizer.set_texture( error_channel );
+	rasterizer.set_hole_fill_len(hole_fill_len);
+	rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+      }
       save_image(opt,
 		 asp::round_image_pixels_skip_nodata(rasterizer_fsaa,
 						     opt.rounding_error,
@@ -981,17 +1194,22 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
 		 georef, hole_fill_len, "IntersectionErr");
     }else if (num_channels == 6){
       // The error is a 3D vector. Convert it to NED coordinate system, and rasterize it.
-      ImageViewRef<Vector6> point_disk_image = asp::form_point_cloud_composite<Vector6>(opt.pointcloud_files,
-							    asp::OrthoRasterizerView::max_subblock_size());
-      ImageViewRef<Vector3> ned_err = asp::error_to_NED(point_disk_image, georef);
       std::vector< ImageViewRef< PixelGray<float> > >  rasterized(3);
-      for (int ch_index = 0; ch_index < 3; ch_index++){
-	ImageViewRef<double> ch = select_channel(ned_err, ch_index);
-	rasterizer.set_texture(ch);
-	rasterizer.set_hole_fill_len(hole_fill_len);
-	rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
-	rasterized[ch_index] =
-	  block_cache(rasterizer_fsaa, tile_size, opt.num_threads);
+      if (err_plane >= 0){
+	for (int ch_index = 0; ch_index < 3; ch_index++)
+	  rasterized[ch_index] = generate_fsaa_raster( rasterized_plane(fused_file, err_plane + ch_index), opt );
+      }else{
+	ImageViewRef<Vector6> point_disk_image = asp::form_point_cloud_composite<Vector6>(opt.pointcloud_files,
+							      asp::OrthoRasterizerView::max_subblock_size());
+	ImageViewRef<Vector3> ned_err = asp::error_to_NED(point_disk_image, georef);
+	for (int ch_index = 0; ch_index < 3; ch_index++){
+	  ImageViewRef<double> ch = select_channel(ned_err, ch_index);
+	  rasterizer.set_texture(ch);
+	  rasterizer.set_hole_fill_len(hole_fill_len);
+	  rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+	  rasterized[ch_index] =
+	    block_cache(rasterizer_fsaa, tile_size, opt.num_threads);
+	}
       }
       save_image(opt,
 		 asp::round_image_pixels_skip_nodata
@@ -1013,11 +1231,15 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
     int hole_fill_len = opt.ortho_hole_fill_len;
     Stopwatch sw3;
     sw3.start();
-    ImageViewRef< PixelGray<float> > texture = asp::form_point_cloud_composite< PixelGray<float> >(opt.texture_files,
-							  asp::OrthoRasterizerView::max_subblock_size());
-    rasterizer.set_texture(texture);
-    rasterizer.set_hole_fill_len(hole_fill_len);
-    rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+    if (drg_plane >= 0){
+      rasterizer_fsaa = generate_fsaa_raster( rasterized_plane(fused_file, drg_plane), opt );
+    }else{
+      ImageViewRef< PixelGray<float> > texture = asp::form_point_cloud_composite< PixelGray<float> >(opt.texture_files,
+							    asp::OrthoRasterizerView::max_subblock_size());
+      rasterizer.set_texture(texture);
+      rasterizer.set_hole_fill_len(hole_fill_len);
+      rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
+    }
     asp::save_image(opt, rasterizer_fsaa, georef, hole_fill_len, "DRG");
     sw3.stop();
     vw_out(DebugMessage,"asp") << "DRG render time: " << sw3.elapsed_seconds() << std::endl;
@@ -1040,6 +1262,80 @@ void do_software_rasterization( asp::OrthoRasterizerView& rasterizer,
 } // End do_software_rasterization
 
 
+/// The georeference of a DEM whose pixels are the averages of
+/// factor x factor blocks of pixels of the DEM with the given georeference.
+cartography::GeoReference coarser_georef(cartography::GeoReference const& georef, int factor){
+
+  cartography::GeoReference out_georef = georef;
+  Matrix3x3 transform = georef.transform();
+  transform(0,0) *= factor;
+  transform(1,1) *= factor;
+  out_georef.set_transform(transform);
+
+  // The center of the first coarse pixel is at the center of the
+  // first block of fine pixels.
+  double c = (factor - 1.0)/2.0;
+  Vector2 shift = georef.pixel_to_point(Vector2(c, c)) - out_georef.pixel_to_point(Vector2(0, 0));
+  transform(0,2) += shift[0];
+  transform(1,2) += shift[1];
+  out_georef.set_transform(transform);
+  return out_georef;
+}
+
+/// Create the DEM, intersection error, and DRG at a coarser spacing by
+/// averaging the products written at the finest spacing.
+void write_coarser_products(Options& opt, std::string const& fine_prefix,
+			    cartography::GeoReference const& fine_georef, int factor){
+
+  cartography::GeoReference georef = coarser_georef(fine_georef, factor);
+  std::string ext = "." + opt.output_file_type;
+  int hole_fill_len = 0; // holes were filled at the finest spacing
+
+  if ( !opt.no_dem ){
+    DiskImageView<float> dem(fine_prefix + "-DEM" + ext);
+    asp::save_image(opt,
+		    asp::round_image_pixels_skip_nodata
+		    (asp::block_average(dem, factor, opt.nodata_value),
+		     opt.rounding_error, opt.nodata_value),
+		    georef, hole_fill_len, "DEM");
+  }
+
+  std::string err_file = fine_prefix + "-IntersectionErr" + ext;
+  if ( opt.do_error && fs::exists(err_file) ){
+    if (get_num_channels(err_file) == 1){
+      DiskImageView<float> err(err_file);
+      asp::save_image(opt,
+		      asp::round_image_pixels_skip_nodata
+		      (asp::block_average(err, factor, opt.nodata_value),
+		       opt.rounding_error, opt.nodata_value),
+		      georef, hole_fill_len, "IntersectionErr");
+    }else{
+      // Cache the averaged tiles, as combine_channels reads them
+      // pixel by pixel and block_average works only on whole tiles.
+      DiskImageView<Vector3f> err(err_file);
+      Vector2 tile_size(vw_settings().default_tile_size(),
+			vw_settings().default_tile_size());
+      std::vector< ImageViewRef<float> > averaged(3);
+      for (int ch_index = 0; ch_index < 3; ch_index++)
+	averaged[ch_index] = block_cache(asp::block_average(select_channel(err, ch_index),
+							    factor, opt.nodata_value),
+					 tile_size, opt.num_threads);
+      asp::save_image(opt,
+		      asp::round_image_pixels_skip_nodata
+		      (asp::combine_channels(opt.nodata_value,
+					     averaged[0], averaged[1], averaged[2]),
+		       opt.rounding_error, opt.nodata_value),
+		      georef, hole_fill_len, "IntersectionErr");
+    }
+  }
+
+  if ( opt.do_ortho ){
+    DiskImageView<float> drg(fine_prefix + "-DRG" + ext);
+    asp::save_image(opt, asp::block_average(drg, factor, opt.nodata_value),
+		    georef, hole_fill_len, "DRG");
+  }
+}
+
 // Wrapper for do_software_rasterization that goes through all spacing values
 void do_software_rasterization_multi_spacing( const ImageViewRef<Vector3>& proj_point_input,
 					      Options& opt,
@@ -1069,6 +1365,33 @@ void do_software_rasterization_multi_spacing( const ImageViewRef<Vector3>& proj_
 
   std::string base_out_prefix = opt.out_prefix;
 
+  if (opt.dem_pyramid && opt.dem_spacing.size() > 1){
+    // Rasterize the cloud only at the finest spacing, and average
+    // its products to get the coarser ones.
+    size_t fine = std::min_element(opt.dem_spacing.begin(), opt.dem_spacing.end())
+      - opt.dem_spacing.begin();
+    rasterizer.initialize_spacing(opt.dem_spacing[fine]);
+    opt.out_prefix = base_out_prefix;
+    if (fine > 0)
+      opt.out_prefix = base_out_prefix + "_" + vw::num_to_str(fine);
+    do_software_rasterization( rasterizer, opt, georef,
+			       error_image, estim_max_error);
+
+    std::string fine_prefix = opt.out_prefix;
+    cartography::GeoReference fine_georef = georef;
+    for (size_t i=0; i<opt.dem_spacing.size(); ++i) {
+      if (i == fine) continue;
+      int factor = (int)round(opt.dem_spacing[i]/opt.dem_spacing[fine]);
+      opt.out_prefix = base_out_prefix;
+      if (i > 0)
+	opt.out_prefix = base_out_prefix + "_" + vw::num_to_str(i);
+      write_coarser_products(opt, fine_prefix, fine_georef, factor);
+    }
+
+    opt.out_prefix = base_out_prefix; // Restore the original value
+    return;
+  }
+
   // Call the function for each dem spacing
   for (size_t i=0; i<opt.dem_spacing.size(); ++i) {
     double this_spacing = opt.dem_spacing[i];
@@ -1197,11 +1520,11 @@ int main( int argc, char *argv[] ) {
 
           Stopwatch sw2;
           sw2.start();
-          PixelAccumulator<asp::ErrorRangeEstimAccum> error_accum;
-          for_each_pixel( subsample(error_image, subsample_amt),
-	            error_accum,
-	            TerminalProgressCallback
-	            ("asp","Triangulation error range estimation: ") );
+          asp::ErrorRangeEstimAccum error_accum;
+          asp::parallel_accumulate(subsample(error_image, subsample_amt),
+                                   error_accum,
+                                   TerminalProgressCallback
+                                   ("asp","Triangulation error range estimation: ") );
           if (error_accum.size() > 0){
             success = true;
             estim_max_error = error_accum.value(opt.remove_outliers_params);
@@ -29,6 +29,7 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/PointUtils.h>
 
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO.h>
 #include <vw/Image.h>
 #include <vw/Math.h>
@@ -56,6 +57,50 @@ struct Options : vw::cartography::GdalWriteOptions {
   Options() : compressed(false){}
 };
 
+// Collect the valid points of one tile of the cloud. This is where
+// the cloud is read and converted to the output projection.
+class CollectPointsTask : public vw::Task, private boost::noncopyable {
+  ImageViewRef<Vector3> const& m_point_image;
+  BBox2i                       m_bbox;
+  bool                         m_is_geodetic;
+  std::vector<Vector3>       & m_points;
+public:
+  CollectPointsTask(ImageViewRef<Vector3> const& point_image, BBox2i const& bbox,
+                    bool is_geodetic, std::vector<Vector3> & points):
+    m_point_image(point_image), m_bbox(bbox), m_is_geodetic(is_geodetic),
+    m_points(points){}
+
+  void operator()() {
+    ImageView<Vector3> tile = crop(m_point_image, m_bbox);
+    m_points.clear();
+    for (int row = 0; row < tile.rows(); row++){
+      for (int col = 0; col < tile.cols(); col++){
+        Vector3 point = tile(col, row);
+
+        // Skip no-data points
+        bool is_good = ( (!m_is_geodetic && point != vw::Vector3()) ||
+                         (m_is_geodetic  && !boost::math::isnan(point.z())) );
+        if (is_good)
+          m_points.push_back(point);
+      }
+    }
+  }
+};
+
+// Start collecting the points for the tiles in the given batch
+void start_batch(ImageViewRef<Vector3> const& point_image,
+                 std::vector<BBox2i> const& tiles, size_t batch, size_t batch_size,
+                 bool is_geodetic, std::vector< std::vector<Vector3> > & points,
+                 FifoWorkQueue & queue){
+  size_t beg = batch*batch_size, end = std::min(beg + batch_size, tiles.size());
+  points.resize(end - beg);
+  for (size_t i = beg; i < end; i++) {
+    boost::shared_ptr<CollectPointsTask>
+      task(new CollectPointsTask(point_image, tiles[i], is_geodetic, points[i - beg]));
+    queue.add_task(task);
+  }
+}
+
 void handle_arguments( int argc, char *argv[], Options& opt ) {
 
   po::options_description general_options("General Options");
@@ -194,30 +239,40 @@ int main( int argc, char *argv[] ) {
     ofs.open(lasFile.c_str(), std::ios::out | std::ios::binary);
     liblas::Writer writer(ofs, header);
 
-    TerminalProgressCallback tpc("asp", "\t--> ");
-    for (int row = 0; row < point_image.rows(); row++){
-      tpc.report_fractional_progress(row, point_image.rows());
-      for (int col = 0; col < point_image.cols(); col++){
-
-        Vector3 point = point_image(col, row);
-
-        // Skip no-data points
-        bool is_good = ( (!is_geodetic && point != vw::Vector3()) ||
-                         (is_geodetic  && !boost::math::isnan(point.z())) );
-        if (!is_good) continue;
-
-#if 0
-        // For comparison later with las2txt.
-        std::cout.precision(16);
-        std::cout << "\npoint " << point[0] << ' ' << point[1] << ' '
-                  << point[2] << std::endl;
-#endif
-
-        liblas::Point las_point(&header);
-        las_point.SetCoordinates(point[0], point[1], point[2]);
-        writer.WritePoint(las_point);
+    // The tiles are converted in parallel in batches, while the points
+    // of the previous batch are written in order by this thread.
+    int tile_size   = vw_settings().default_tile_size();
+    int num_threads = vw_settings().default_num_threads();
+    std::vector<BBox2i> tiles = subdivide_bbox(point_image, tile_size, tile_size);
+    size_t batch_size  = 2*num_threads;
+    size_t num_batches = (tiles.size() + batch_size - 1)/batch_size;
+    std::vector< std::vector<Vector3> > points[2];
 
+    TerminalProgressCallback tpc("asp", "\t--> ");
+    boost::shared_ptr<FifoWorkQueue> curr_queue(new FifoWorkQueue(num_threads));
+    if (num_batches > 0)
+      start_batch(point_image, tiles, 0, batch_size, is_geodetic, points[0], *curr_queue);
+    for (size_t batch = 0; batch < num_batches; batch++) {
+      curr_queue->join_all();
+
+      boost::shared_ptr<FifoWorkQueue> next_queue(new FifoWorkQueue(num_threads));
+      if (batch + 1 < num_batches)
+        start_batch(point_image, tiles, batch + 1, batch_size, is_geodetic,
+                    points[(batch + 1) % 2], *next_queue);
+
+      std::vector< std::vector<Vector3> > & batch_points = points[batch % 2];
+      for (size_t tile = 0; tile < batch_points.size(); tile++) {
+        for (size_t i = 0; i < batch_points[tile].size(); i++) {
+          Vector3 const& point = batch_points[tile][i];
+          liblas::Point las_point(&header);
+          las_point.SetCoordinates(point[0], point[1], point[2]);
+          writer.WritePoint(las_point);
+        }
+        batch_points[tile] = std::vector<Vector3>(); // free the memory
       }
+
+      tpc.report_fractional_progress(batch + 1, num_batches);
+      curr_queue = next_queue;
     }
     tpc.report_finished();
 
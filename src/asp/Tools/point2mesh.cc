@@ -31,6 +31,7 @@
 #include <vw/Image/Transform.h>
 #include <vw/Cartography/PointImageManipulation.h>
 #include <vw/Image/MaskViews.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/PointUtils.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
@@ -46,6 +47,7 @@ namespace po = boost::program_options;
 #include <osgUtil/SmoothingVisitor>
 #include <osgUtil/Simplifier>
 #include <osg/Node>
+#include <osg/PagedLOD>
 #include <osg/Texture1D>
 #include <osg/Texture2D>
 #include <osg/TexGen>
@@ -58,6 +60,8 @@ namespace po = boost::program_options;
 #include <osgFX/Version>
 #include <osgTerrain/Version>
 #include <osgVolume/Version>
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
 
 
 // ---------------------------------------------------------
@@ -73,7 +77,7 @@ namespace vw {
 }
 
 struct Options : vw::cartography::GdalWriteOptions {
-  Options() : root( new osg::Group() ), simplify_percent(0) {};
+  Options() : root( new osg::Group() ), simplify_percent(0), tile_size(0), num_lod_levels(0) {};
   // Input
   std::string pointcloud_filename, texture_file_name;
 
@@ -85,6 +89,7 @@ struct Options : vw::cartography::GdalWriteOptions {
   std::string rot_order;
   double phi_rot, omega_rot, kappa_rot;
   bool center, enable_lighting, smooth_mesh, simplify_mesh;
+  int tile_size, num_lod_levels;
   std::string osg_version;
 
   // Output
@@ -155,36 +160,23 @@ osg::StateSet* create1DTexture( osg::Node* loadedModel , const osg::Vec3f& Direc
 }
 
 // ---------------------------------------------------------
-// BUILD MESH
+// PREPARE TEXTURE
 //
-// Takes in an image and builds geodes for every triangle strip.
+// Save the texture as an 8-bit jpg which osg can load, reducing its
+// size if needed. Return the name of that file, or an empty string if
+// there is no texture.
 // ---------------------------------------------------------
-template <class ViewT>
-osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
-                       Options& opt ) {
-
-  //const ViewT& point_image_impl = point_image.impl();
-  osg::Geode* mesh = new osg::Geode();
-  osg::Geometry* geometry = new osg::Geometry();
-  osg::Vec3Array* vertices = new osg::Vec3Array();
-  osg::Vec2Array* texcoords = new osg::Vec2Array();
-  osg::Vec3Array* normals = new osg::Vec3Array();
-
-  opt.dataNormal = osg::Vec3f( 0.0f , 0.0f , 0.0f );
-
-  vw_out() << "\t--> Orginal size: [" << point_image.impl().cols() << ", " << point_image.impl().rows() << "]\n";
-  vw_out() << "\t--> Subsampled:   [" << point_image.impl().cols()/opt.step_size << ", "
-            << point_image.impl().rows()/opt.step_size << "]\n";
+std::string prepare_texture(int cols, int rows, Options const& opt) {
 
+  std::string tex_file;
   //////////////////////////////////////////////////
   // Deciding how to reduce the texture size
   //   Max texture width or height is 4096
-  std::string tex_file;
   if ( opt.texture_file_name.size() ) {
     DiskImageView<PixelGray<uint8> > previous_texture(opt.texture_file_name);
     tex_file = asp::prefix_from_pointcloud_filename(opt.output_prefix) + "-tex";
-    if (point_image.impl().cols() > 4096 ||
-        point_image.impl().rows() > 4096 ) {
+    if (cols > 4096 ||
+        rows > 4096 ) {
       vw_out() << "Resampling to reduce texture size:\n";
       float tex_sub_scale = 4096.0/float(std::max(previous_texture.cols(),previous_texture.rows()));
       ImageViewRef<PixelGray<uint8> > new_texture = resample(previous_texture,tex_sub_scale);
@@ -213,6 +205,110 @@ osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
     tex_file += ".jpg";
   }
 
+  return tex_file;
+}
+
+// Attach the texture in the given file to a state set
+void attach_texture(std::string const& tex_file, osg::StateSet* stateset) {
+
+  vw_out() << "Attaching texture data\n";
+
+  osg::Image* textureImage = osgDB::readImageFile(tex_file.c_str());
+
+  if ( textureImage ) {
+    if ( textureImage->valid() ){
+      osg::Texture2D* texture = new osg::Texture2D;
+      texture->setImage(textureImage);
+      stateset->setTextureAttributeAndModes(0,texture,osg::StateAttribute::ON);
+    } else {
+      vw_out() << "Failed to open texture data in " << tex_file << std::endl;
+    }
+  } else {
+    vw_out() << "Failed to open texture data in " << tex_file << std::endl;
+  }
+}
+
+// A vertex with all coordinates zero is no-data
+bool is_valid_vertex(osg::Vec3f const& v) {
+  return (v[0] != 0) && (v[1] != 0) && (v[2] != 0);
+}
+
+// ---------------------------------------------------------
+// TRIANGLE STRIPS
+//
+// Connect with triangle strips the valid vertices of consecutive rows
+// of a grid of vertices stored row by row.
+// ---------------------------------------------------------
+void add_triangle_strips(osg::Vec3Array const* vertices, uint32 num_rows,
+                         uint32 col_steps, osg::Geometry* geometry) {
+
+  for (uint32 r = 0; r + 1 < num_rows; ++r){
+
+    bool add_direction_down = true;
+    osg::DrawElementsUInt* dui = new osg::DrawElementsUInt(GL_TRIANGLE_STRIP);
+
+    for (uint32 c = 0; c < ( col_steps ); ++c){
+
+      uint32 pointing_index = r*(col_steps) + c;
+
+      if (add_direction_down) {
+
+        // Adding top point ...
+        if ( is_valid_vertex(vertices->at(pointing_index)) )
+          dui->push_back( pointing_index );
+
+        // Adding bottom point ..
+        if ( is_valid_vertex(vertices->at(pointing_index+col_steps)) ) {
+          dui->push_back( pointing_index+col_steps );
+        } else {
+          // If there's a drop out here... we switch adding direction.
+          add_direction_down = false;
+        }
+
+      } else {
+
+        // Adding bottom point ..
+        if ( is_valid_vertex(vertices->at(pointing_index+col_steps)) )
+          dui->push_back( pointing_index+col_steps );
+
+        // Adding top point ...
+        if ( is_valid_vertex(vertices->at(pointing_index)) ) {
+          dui->push_back( pointing_index );
+        } else {
+          // If there's a drop out here... we switch adding direction.
+          add_direction_down = true;
+        }
+      }
+    }
+
+    geometry->addPrimitiveSet(dui);
+  }
+}
+
+// ---------------------------------------------------------
+// BUILD MESH
+//
+// Takes in an image and builds geodes for every triangle strip.
+// ---------------------------------------------------------
+template <class ViewT>
+osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
+                       Options& opt ) {
+
+  //const ViewT& point_image_impl = point_image.impl();
+  osg::Geode* mesh = new osg::Geode();
+  osg::Geometry* geometry = new osg::Geometry();
+  osg::Vec3Array* vertices = new osg::Vec3Array();
+  osg::Vec2Array* texcoords = new osg::Vec2Array();
+  osg::Vec3Array* normals = new osg::Vec3Array();
+
+  opt.dataNormal = osg::Vec3f( 0.0f , 0.0f , 0.0f );
+
+  vw_out() << "\t--> Orginal size: [" << point_image.impl().cols() << ", " << point_image.impl().rows() << "]\n";
+  vw_out() << "\t--> Subsampled:   [" << point_image.impl().cols()/opt.step_size << ", "
+            << point_image.impl().rows()/opt.step_size << "]\n";
+
+  std::string tex_file = prepare_texture(point_image.impl().cols(), point_image.impl().rows(), opt);
+
   //////////////////////////////////////////////////
   /// Setting name of geode
   {
@@ -336,96 +432,254 @@ osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
   //////////////////////////////////////////////////
   // Deciding How to draw triangle strips
   vw_out() << "Drawing triangle strips\n";
-  {
-    uint32 col_steps = point_image.impl().cols()/opt.step_size;
+  add_triangle_strips(vertices, point_image.impl().rows()/opt.step_size,
+                      point_image.impl().cols()/opt.step_size, geometry);
 
-    for (uint32 r = 0;
-         r < ( point_image.impl().rows()/opt.step_size - 1); ++r){
+  ////////////////////////////////////////////////
+  /// Adding texture to the DTM
+  if (tex_file.size())
+    attach_texture(tex_file, geometry->getOrCreateStateSet());
 
-      bool add_direction_down = true;
-      osg::DrawElementsUInt* dui = new osg::DrawElementsUInt(GL_TRIANGLE_STRIP);
+  mesh->addDrawable( geometry );
 
-      for (uint32 c = 0; c < ( col_steps ); ++c){
+  return mesh;
 
-        uint32 pointing_index = r*(col_steps) + c;
+}
 
-        //vw_out() << "V: " << vertices->at(pointing_index)[0] << " " << vertices->at(pointing_index)[1] << " " << vertices->at(pointing_index)[2] << std::endl;
+// ---------------------------------------------------------
+// TILED MESH
+//
+// The point image is split into tiles, each meshed on its own at
+// several levels of detail and saved to disk, so that neither the
+// mesher nor a viewer has to hold the full mesh in memory. Adjacent
+// tiles share their boundary vertices, so there are no cracks between
+// tiles at the same level of detail.
+// ---------------------------------------------------------
 
-        if (add_direction_down) {
+// The normal at a vertex of a tile, averaged over the four quadrants
+// around it, as in build_mesh(). The points are a crop of the point
+// image starting at crop_origin, which extends beyond the tile so
+// that the normals are continuous across tiles.
+Vector3 tile_vertex_normal(ImageView<Vector3> const& points, Vector2i const& crop_origin,
+                           Vector2i const& image_size, int c, int r, int step) {
+
+  // The neighbors to the right, bottom, left, and top, in quadrant order
+  int dc[4] = {step, 0, -step, 0};
+  int dr[4] = {0, step, 0, -step};
+
+  Vector3 center = points(c - crop_origin.x(), r - crop_origin.y());
+  Vector3 temp_normal;
+  for (int q = 0; q < 4; q++) {
+    int c1 = c + dc[q],       r1 = r + dr[q];
+    int c2 = c + dc[(q+3)%4], r2 = r + dr[(q+3)%4];
+    if (c1 < 0 || c1 >= image_size.x() || r1 < 0 || r1 >= image_size.y() ||
+        c2 < 0 || c2 >= image_size.x() || r2 < 0 || r2 >= image_size.y())
+      continue;
+    Vector3 p1 = points(c1 - crop_origin.x(), r1 - crop_origin.y());
+    Vector3 p2 = points(c2 - crop_origin.x(), r2 - crop_origin.y());
+    if (p1 != Vector3(0,0,0) && p2 != Vector3(0,0,0))
+      temp_normal += normalize(cross_prod(p1 - center, p2 - center));
+  }
 
-          // Adding top point ...
-          if ( (vertices->at(pointing_index)[0] != 0) &&
-               (vertices->at(pointing_index)[1] != 0) &&
-               (vertices->at(pointing_index)[2] != 0) ) {
+  return normalize(temp_normal);
+}
 
-            dui->push_back( pointing_index );
-          }
+// Mesh the vertices of a tile with the given step. The tile spans the
+// point image pixels from tile.min() to tile.max(), inclusive. Also
+// accumulate the sum of the valid points.
+osg::Geode* build_tile_mesh(ImageView<Vector3> const& points, Vector2i const& crop_origin,
+                            Vector2i const& image_size, BBox2i const& tile, int step,
+                            bool has_texture, bool enable_lighting,
+                            Vector3 & point_sum) {
 
-          // Adding bottom point ..
-          if ( (vertices->at(pointing_index+col_steps)[0] != 0) &&
-               (vertices->at(pointing_index+col_steps)[1] != 0) &&
-               (vertices->at(pointing_index+col_steps)[2] != 0) ) {
+  osg::Geode* mesh = new osg::Geode();
+  osg::Geometry* geometry = new osg::Geometry();
+  osg::Vec3Array* vertices = new osg::Vec3Array();
+  osg::Vec2Array* texcoords = new osg::Vec2Array();
+  osg::Vec3Array* normals = new osg::Vec3Array();
 
-            dui->push_back( pointing_index+col_steps );
-          } else {
-            // If there's a drop out here... we switch adding direction.
-            add_direction_down = false;
-          }
+  uint32 num_cols = (tile.max().x() - tile.min().x())/step + 1;
+  uint32 num_rows = (tile.max().y() - tile.min().y())/step + 1;
+  for (uint32 r = 0; r < num_rows; r++) {
+    for (uint32 c = 0; c < num_cols; c++) {
+      int c_step = tile.min().x() + c*step;
+      int r_step = tile.min().y() + r*step;
+      Vector3 point = points(c_step - crop_origin.x(), r_step - crop_origin.y());
+      vertices->push_back( osg::Vec3f( point[0], point[1], point[2] ) );
+
+      if (enable_lighting) {
+        Vector3 normal = tile_vertex_normal(points, crop_origin, image_size,
+                                            c_step, r_step, step);
+        normals->push_back( osg::Vec3f( normal[0], normal[1], normal[2] ) );
+      }
 
-        } else {
+      if (has_texture)
+        texcoords->push_back( osg::Vec2f ( (float)c_step / (float)image_size.x() ,
+                                           1-(float)r_step / (float)image_size.y() ) );
+      else if (is_valid_vertex(vertices->back()))
+        point_sum += point;
+    }
+  }
 
-          // Adding bottom point ..
-          if ( (vertices->at(pointing_index+col_steps)[0] != 0) &&
-               (vertices->at(pointing_index+col_steps)[1] != 0) &&
-               (vertices->at(pointing_index+col_steps)[2] != 0) ) {
+  geometry->setVertexArray( vertices );
+  if (enable_lighting)
+    geometry->setNormalArray( normals );
+  if (has_texture)
+    geometry->setTexCoordArray( 0,texcoords );
 
-            dui->push_back( pointing_index+col_steps );
-          }
+  osg::Vec4Array* colour = new osg::Vec4Array();
+  colour->push_back( osg::Vec4f( 1.0f, 1.0f, 1.0f, 1.0f ) );
+  geometry->setColorArray( colour );
+  geometry->setColorBinding( osg::Geometry::BIND_OVERALL );
 
-          // Adding top point ...
-          if ( (vertices->at(pointing_index)[0] != 0) &&
-               (vertices->at(pointing_index)[1] != 0) &&
-               (vertices->at(pointing_index)[2] != 0) ) {
+  add_triangle_strips(vertices, num_rows, num_cols, geometry);
 
-            dui->push_back( pointing_index );
-          } else {
-            // If there's a drop out here... we switch adding direction.
-            add_direction_down = true;
-          }
-        }
-      }
+  mesh->addDrawable( geometry );
+  return mesh;
+}
 
-      geometry->addPrimitiveSet(dui);
+// Mesh one tile at all levels of detail, write the meshes to disk,
+// and create the node which pages them in.
+class MeshTileTask : public vw::Task, private boost::noncopyable {
+  ImageViewRef<Vector3> const& m_point_image;
+  BBox2i                       m_tile;
+  std::string                  m_tile_prefix, m_tile_name;
+  bool                         m_has_texture;
+  Options const&               m_opt;
+  osg::ref_ptr<osg::PagedLOD>& m_lod;
+  Vector3                    & m_point_sum;
+  vw::Mutex                  & m_mutex;
+  vw::ProgressCallback const&  m_progress;
+  double                       m_inc_amt;
+public:
+  MeshTileTask(ImageViewRef<Vector3> const& point_image, BBox2i const& tile,
+               std::string const& tile_prefix, std::string const& tile_name,
+               bool has_texture, Options const& opt, osg::ref_ptr<osg::PagedLOD>& lod,
+               Vector3 & point_sum, vw::Mutex & mutex,
+               vw::ProgressCallback const& progress, double inc_amt):
+    m_point_image(point_image), m_tile(tile), m_tile_prefix(tile_prefix),
+    m_tile_name(tile_name), m_has_texture(has_texture), m_opt(opt), m_lod(lod),
+    m_point_sum(point_sum), m_mutex(mutex), m_progress(progress), m_inc_amt(inc_amt){}
+
+  void operator()() {
+
+    // Read the tile with a margin, for the normals
+    int max_step = m_opt.step_size << (m_opt.num_lod_levels - 1);
+    BBox2i crop_box = m_tile;
+    crop_box.max() += Vector2i(1, 1); // the tile max is inclusive
+    crop_box.expand(max_step);
+    crop_box.crop(bounding_box(m_point_image));
+    ImageView<Vector3> points = crop(m_point_image, crop_box);
+    Vector2i image_size(m_point_image.cols(), m_point_image.rows());
+
+    m_lod = new osg::PagedLOD;
+    Vector3 point_sum;
+    float radius = 0;
+    for (int level = 0; level < m_opt.num_lod_levels; level++) {
+      Vector3 level_sum;
+      osg::ref_ptr<osg::Geode> mesh
+        = build_tile_mesh(points, crop_box.min(), image_size, m_tile,
+                          m_opt.step_size << level, m_has_texture,
+                          m_opt.enable_lighting, level_sum);
+      if (m_opt.smooth_mesh) {
+        osgUtil::SmoothingVisitor sv;
+        mesh->accept(sv);
+      }
 
-    }
-  }
+      if (level == 0) {
+        point_sum = level_sum;
+        osg::BoundingSphere const& bs = mesh->getBound();
+        m_lod->setCenter(bs.center());
+        radius = bs.radius();
+        m_lod->setRadius(radius);
+      }
 
-  ////////////////////////////////////////////////
-  /// Adding texture to the DTM
-  if (tex_file.size()){
+      // The file names are relative to the directory of the top-level file
+      std::ostringstream os;
+      os << "_L" << level << "." << m_opt.output_file_type;
+      m_lod->setFileName(level, m_tile_name + os.str());
+      {
+        // OSG plugins are not guaranteed to be thread-safe
+        vw::Mutex::Lock lock(m_mutex);
+        osgDB::writeNodeFile(*mesh.get(), m_tile_prefix + os.str(),
+                             new osgDB::Options("Compressor=zlib"));
+      }
 
-    vw_out() << "Attaching texture data\n";
+      // Each coarser level is shown at twice the distance of the finer one
+      float min_range = (level == 0) ? 0 : 3.0*radius*(1 << level);
+      float max_range = (level + 1 == m_opt.num_lod_levels) ?
+        std::numeric_limits<float>::max() : 3.0*radius*(1 << (level + 1));
+      m_lod->setRange(level, min_range, max_range);
+    }
 
-    osg::Image* textureImage = osgDB::readImageFile(tex_file.c_str());
+    vw::Mutex::Lock lock(m_mutex);
+    m_point_sum += point_sum;
+    m_progress.report_incremental_progress(m_inc_amt);
+  }
+};
 
-    if ( textureImage ) {
-      if ( textureImage->valid() ){
-        osg::Texture2D* texture = new osg::Texture2D;
-        texture->setImage(textureImage);
-        osg::StateSet* stateset = geometry->getOrCreateStateSet();
-        stateset->setTextureAttributeAndModes(0,texture,osg::StateAttribute::ON);
-      } else {
-        vw_out() << "Failed to open texture data in " << tex_file << std::endl;
-      }
-    } else {
-      vw_out() << "Failed to open texture data in " << tex_file << std::endl;
+// Mesh the point image in tiles, in parallel. The tiles are saved in
+// a subdirectory next to the output file, and the returned node
+// refers to them.
+osg::Node* build_tiled_mesh(ImageViewRef<Vector3> const& point_image, Options& opt) {
+
+  // Make the tile size a multiple of the coarsest step, so that the
+  // vertices on tile boundaries are shared at all levels
+  int max_step  = opt.step_size << (opt.num_lod_levels - 1);
+  int tile_size = max_step*(int)ceil(double(opt.tile_size)/max_step);
+  int cols = point_image.cols(), rows = point_image.rows();
+
+  std::string tile_dir  = opt.output_prefix + "-tiles";
+  std::string tile_base = fs::path(opt.output_prefix).filename().string() + "-tiles";
+  fs::create_directories(tile_dir);
+
+  vw_out() << "\t--> Orginal size: [" << cols << ", " << rows << "]\n";
+  vw_out() << "\t--> Tile size:    " << tile_size << "\n";
+  vw_out() << "Writing tiles to: " << tile_dir << "\n";
+
+  std::string tex_file = prepare_texture(cols, rows, opt);
+
+  // Adjacent tiles overlap by one pixel, which holds the shared vertices
+  std::vector<BBox2i> tiles;
+  std::vector<std::string> tile_names;
+  for (int r = 0; r + 1 < rows; r += tile_size) {
+    for (int c = 0; c + 1 < cols; c += tile_size) {
+      tiles.push_back(BBox2i(Vector2i(c, r), Vector2i(std::min(c + tile_size, cols - 1),
+                                                      std::min(r + tile_size, rows - 1))));
+      std::ostringstream os;
+      os << "tile_" << c/tile_size << "_" << r/tile_size;
+      tile_names.push_back(os.str());
     }
   }
 
-  mesh->addDrawable( geometry );
+  std::vector< osg::ref_ptr<osg::PagedLOD> > lods(tiles.size());
+  Vector3 point_sum;
+  vw::Mutex mutex;
+  TerminalProgressCallback progress("asp", "\tTiles:      ");
+  FifoWorkQueue queue(vw_settings().default_num_threads());
+  for (size_t i = 0; i < tiles.size(); i++) {
+    boost::shared_ptr<MeshTileTask>
+      task(new MeshTileTask(point_image, tiles[i], tile_dir + "/" + tile_names[i],
+                            tile_base + "/" + tile_names[i], !tex_file.empty(), opt,
+                            lods[i], point_sum, mutex, progress, 1.0/tiles.size()));
+    queue.add_task(task);
+  }
+  queue.join_all();
+  progress.report_finished();
+
+  osg::Group* mesh = new osg::Group();
+  mesh->setName("Tiled Mesh");
+  for (size_t i = 0; i < lods.size(); i++)
+    mesh->addChild(lods[i].get());
+
+  if (tex_file.size())
+    attach_texture(tex_file, mesh->getOrCreateStateSet());
+  else {
+    opt.dataNormal = osg::Vec3f(point_sum[0], point_sum[1], point_sum[2]);
+    opt.dataNormal.normalize();
+  }
 
   return mesh;
-
 }
 
 // MAIN
@@ -450,7 +704,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      po::bool_switch(&opt.enable_lighting)->default_value(false),
      "Enables shades and lighting on the mesh" )
     ("center", po::bool_switch(&opt.center)->default_value(false),
-     "Center the model around the origin. Use this option if you are experiencing numerical precision issues.");
+     "Center the model around the origin. Use this option if you are experiencing numerical precision issues.")
+    ("tile-size", po::value(&opt.tile_size)->default_value(0),
+     "Mesh the point cloud in tiles of this size in pixels, in parallel, and save them at several levels of detail in a directory next to the output file, which refers to them. This allows creating meshes too large to fit in memory. Not used if 0.")
+    ("num-lod-levels", po::value(&opt.num_lod_levels)->default_value(3),
+     "The number of levels of detail when using --tile-size. Each level uses twice the step of the previous one.");
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
   po::options_description positional("");
@@ -487,6 +745,18 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 
   opt.simplify_mesh = vm.count("simplify-mesh");
 
+  if (opt.step_size < 1)
+    vw_throw( ArgumentErr() << "The step size must be positive.\n" );
+  if (opt.tile_size < 0)
+    vw_throw( ArgumentErr() << "The tile size must be non-negative.\n" );
+  if (opt.tile_size > 0) {
+    if (opt.num_lod_levels < 1)
+      vw_throw( ArgumentErr() << "The number of levels of detail must be positive.\n" );
+    if (opt.simplify_mesh)
+      vw_throw( ArgumentErr() << "The option --simplify-mesh cannot be used with "
+                << "--tile-size, as it would move the vertices shared among tiles.\n" );
+  }
+
   // The purpose of this is to force ASP to link to the OSG libraries
   // at link-time, otherwise it fails to find them at run-time
   // due to peculiarities in OSG's functionality for library search.
@@ -538,7 +808,10 @@ int main( int argc, char *argv[] ){
 
     {
       vw_out() << "\nGenerating 3D mesh from point cloud:\n";
-      opt.root->addChild(build_mesh(point_image, opt));
+      if (opt.tile_size > 0)
+        opt.root->addChild(build_tiled_mesh(point_image, opt));
+      else
+        opt.root->addChild(build_mesh(point_image, opt));
 
       if ( !opt.texture_file_name.empty() ) {
         // Turning off lighting and other likes
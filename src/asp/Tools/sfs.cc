@@ -35,6 +35,7 @@
 #include <vw/Image/AntiAliasing.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Sessions/StereoSessionFactory.h>
@@ -136,6 +137,167 @@ namespace vw { namespace camera {
     mutable int m_count;
     boost::shared_ptr<asp::RPCModel> m_rpc_model;
     bool m_model_is_valid;
+
+    // Form a string which identifies the inputs of this model. A model
+    // saved to disk is reused only if its key is the same.
+    std::string cache_key(std::string const& tag,
+                          AdjustedCameraModel const& adj_camera,
+                          ImageView<double> const& dem,
+                          double mean_sq_ht, double rpc_penalty_weight) const {
+      std::ostringstream os;
+      os.precision(17);
+      os << "ApproxCameraModel 1\n"
+         << tag << "\n"
+         << m_img_bbox << "\n"
+         << dem.cols() << ' ' << dem.rows() << "\n"
+         << m_geo.transform() << "\n"
+         << m_geo.overall_proj4_str() << "\n"
+         << m_mean_ht << ' ' << mean_sq_ht << "\n"
+         << m_use_rpc_approximation << ' ' << rpc_penalty_weight << "\n"
+         << adj_camera.translation() << ' ' << adj_camera.rotation() << ' '
+         << adj_camera.pixel_offset() << ' ' << adj_camera.scale() << "\n";
+      return os.str();
+    }
+
+    template<class T>
+    static void write_val(std::ofstream & ofs, T const& val){
+      ofs.write(reinterpret_cast<const char*>(&val), sizeof(T));
+    }
+    template<class T>
+    static void read_val(std::ifstream & ifs, T & val){
+      ifs.read(reinterpret_cast<char*>(&val), sizeof(T));
+    }
+    template<class VecT>
+    static void write_vec(std::ofstream & ofs, VecT const& vec){
+      for (size_t i = 0; i < vec.size(); i++) write_val(ofs, double(vec[i]));
+    }
+    template<class VecT>
+    static void read_vec(std::ifstream & ifs, VecT & vec){
+      for (size_t i = 0; i < vec.size(); i++) read_val(ifs, vec[i]);
+    }
+    template<class PixelT>
+    static void write_table(std::ofstream & ofs, ImageView< PixelMask<PixelT> > const& table){
+      write_val(ofs, int(table.cols()));
+      write_val(ofs, int(table.rows()));
+      for (int col = 0; col < table.cols(); col++) {
+        for (int row = 0; row < table.rows(); row++) {
+          write_val(ofs, char(is_valid(table(col, row))));
+          write_vec(ofs, table(col, row).child());
+        }
+      }
+    }
+    template<class PixelT>
+    static void read_table(std::ifstream & ifs, ImageView< PixelMask<PixelT> > & table){
+      int cols = 0, rows = 0;
+      read_val(ifs, cols);
+      read_val(ifs, rows);
+      if (!ifs || cols < 0 || rows < 0) return;
+      table.set_size(cols, rows);
+      for (int col = 0; col < cols; col++) {
+        for (int row = 0; row < rows; row++) {
+          char valid = 0;
+          PixelT val;
+          read_val(ifs, valid);
+          read_vec(ifs, val);
+          table(col, row) = val;
+          if (!valid) table(col, row).invalidate();
+        }
+      }
+    }
+    
+    // Save the result of the expensive part of the constructor
+    void save_to_cache(std::string const& file, std::string const& key) const {
+      std::ofstream ofs(file.c_str(), std::ios::out | std::ios::binary);
+      if (!ofs) {
+        vw_out(WarningMessage) << "Cannot write: " << file << std::endl;
+        return;
+      }
+      vw_out() << "Writing: " << file << std::endl;
+      write_val(ofs, key.size());
+      ofs.write(key.c_str(), key.size());
+      write_val(ofs, m_model_is_valid);
+      write_vec(ofs, m_crop_box.min());
+      write_vec(ofs, m_crop_box.max());
+      if (m_use_rpc_approximation) {
+        if (!m_model_is_valid) return;
+        write_vec(ofs, m_rpc_model->line_num_coeff());
+        write_vec(ofs, m_rpc_model->line_den_coeff());
+        write_vec(ofs, m_rpc_model->sample_num_coeff());
+        write_vec(ofs, m_rpc_model->sample_den_coeff());
+        write_vec(ofs, m_rpc_model->xy_offset());
+        write_vec(ofs, m_rpc_model->xy_scale());
+        write_vec(ofs, m_rpc_model->lonlatheight_offset());
+        write_vec(ofs, m_rpc_model->lonlatheight_scale());
+      }else{
+        write_val(ofs, m_approx_table_gridx);
+        write_val(ofs, m_approx_table_gridy);
+        write_vec(ofs, m_mean_dir);
+        write_val(ofs, m_begX); write_val(ofs, m_endX);
+        write_val(ofs, m_begY); write_val(ofs, m_endY);
+        write_table(ofs, m_pixel_to_vec_mat);
+        write_table(ofs, m_point_to_pix_mat);
+      }
+    }
+
+    // Read the model saved by save_to_cache(). Return false if the
+    // file is missing, corrupted, or was created with different inputs.
+    bool load_from_cache(std::string const& file, std::string const& key) {
+      std::ifstream ifs(file.c_str(), std::ios::in | std::ios::binary);
+      if (!ifs) 
+        return false;
+      size_t len = 0;
+      read_val(ifs, len);
+      if (!ifs || len != key.size()) {
+        vw_out() << "Will not use the stale approximate camera model: " << file << std::endl;
+        return false;
+      }
+      std::string file_key(len, ' ');
+      ifs.read(&file_key[0], len);
+      if (!ifs || file_key != key) {
+        vw_out() << "Will not use the stale approximate camera model: " << file << std::endl;
+        return false;
+      }
+      
+      Vector2 crop_min, crop_max;
+      read_val(ifs, m_model_is_valid);
+      read_vec(ifs, crop_min);
+      read_vec(ifs, crop_max);
+      m_crop_box = BBox2(crop_min, crop_max);
+      if (m_use_rpc_approximation) {
+        if (m_model_is_valid) {
+          asp::RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
+          Vector2 pixel_offset, pixel_scale;
+          Vector3 llh_offset, llh_scale;
+          read_vec(ifs, line_num);     read_vec(ifs, line_den);
+          read_vec(ifs, samp_num);     read_vec(ifs, samp_den);
+          read_vec(ifs, pixel_offset); read_vec(ifs, pixel_scale);
+          read_vec(ifs, llh_offset);   read_vec(ifs, llh_scale);
+          m_rpc_model = boost::shared_ptr<asp::RPCModel>
+            (new asp::RPCModel(m_geo.datum(), line_num, line_den,
+                               samp_num, samp_den, pixel_offset, pixel_scale,
+                               llh_offset, llh_scale));
+        }
+      }else{
+        read_val(ifs, m_approx_table_gridx);
+        read_val(ifs, m_approx_table_gridy);
+        read_vec(ifs, m_mean_dir);
+        read_val(ifs, m_begX); read_val(ifs, m_endX);
+        read_val(ifs, m_begY); read_val(ifs, m_endY);
+        read_table(ifs, m_pixel_to_vec_mat);
+        read_table(ifs, m_point_to_pix_mat);
+      }
+      
+      if (!ifs) {
+        vw_out() << "Could not read the approximate camera model: " << file << std::endl;
+        m_model_is_valid = true;
+        m_crop_box = BBox2();
+        return false;
+      }
+      
+      m_compute_mean = false; // the mean direction was read as well
+      vw_out() << "Read the approximate camera model: " << file << std::endl;
+      return true;
+    }
     
     bool comp_rpc_approx_table(AdjustedCameraModel const& adj_camera,
                                boost::shared_ptr<CameraModel> exact_camera,
@@ -413,7 +575,9 @@ namespace vw { namespace camera {
 		      double nodata_val,
 		      bool use_rpc_approximation, bool use_semi_approx,
                       double rpc_penalty_weight,
-		      vw::Mutex &camera_mutex):
+		      vw::Mutex &camera_mutex,
+                      std::string const& cache_file = "",
+                      std::string const& cache_tag = ""):
       m_exact_camera(exact_camera), m_img_bbox(img_bbox), m_geo(geo),
       m_use_rpc_approximation(use_rpc_approximation),
       m_use_semi_approx(use_semi_approx),
@@ -432,17 +596,19 @@ namespace vw { namespace camera {
       //Compute the mean DEM height.
       // We expect all DEM entries to be valid.
       m_mean_ht = 0;
-      double num = 0.0;
+      double num = 0.0, mean_sq_ht = 0.0;
       for (int col = 0; col < dem.cols(); col++) {
 	for (int row = 0; row < dem.rows(); row++) {
 	  if (dem(col, row) == nodata_val)
 	    vw_throw( ArgumentErr()
 		      << "ApproxCameraModel: Expecting a DEM without nodata values.\n");
 	  m_mean_ht += dem(col, row);
+          mean_sq_ht += dem(col, row)*dem(col, row);
 	  num += 1.0;
 	}
       }
       if (num > 0) m_mean_ht /= num;
+      if (num > 0) mean_sq_ht /= num;
 
       // The area we're supposed to work around
       m_point_box = m_geo.pixel_to_point_bbox(bounding_box(dem));
@@ -466,6 +632,14 @@ namespace vw { namespace camera {
 
       if (m_use_semi_approx)
         return;
+
+      // See if the model was computed in a previous run
+      std::string key;
+      if (!cache_file.empty()) {
+        key = cache_key(cache_tag, adj_camera, dem, mean_sq_ht, rpc_penalty_weight);
+        if (load_from_cache(cache_file, key))
+          return;
+      }
       
       // Bypass everything if doing RPC
       if (m_use_rpc_approximation) {
@@ -489,6 +663,9 @@ namespace vw { namespace camera {
         m_crop_box.crop(m_img_bbox);
 #endif
 
+        if (!cache_file.empty())
+          save_to_cache(cache_file, key);
+        
         return;
       }
       
@@ -571,6 +748,10 @@ namespace vw { namespace camera {
 	}
       }
 #endif
+      
+      if (!cache_file.empty())
+        save_to_cache(cache_file, key);
+      
       return;
     }
 
@@ -973,18 +1154,20 @@ struct Options : public vw::cartography::GdalWriteOptions {
   std::vector< std::set<int> > skip_images;
 
   int max_iterations, max_coarse_iterations, reflectance_type, coarse_levels, blending_dist,
-    blending_power;
+    blending_power, tile_size, padding, num_halo_updates;
   bool float_albedo, float_exposure, float_cameras, float_all_cameras, model_shadows,
     save_computed_intensity_only,
     save_dem_with_nodata, use_approx_camera_models, use_rpc_approximation, use_semi_approx, crop_input_images,
     use_blending_weights,
-    float_dem_at_boundary, fix_dem, float_reflectance_model, query, save_sparingly;
+    float_dem_at_boundary, fix_dem, float_reflectance_model, query, save_sparingly,
+    cache_approx_camera_models;
   double smoothness_weight, init_dem_height, nodata_val, initial_dem_constraint_weight,
     albedo_constraint_weight, camera_position_step_size, rpc_penalty_weight, unreliable_intensity_threshold;
   vw::BBox2 crop_win;
 
   Options():max_iterations(0), max_coarse_iterations(0), reflectance_type(0),
 	    coarse_levels(0), blending_dist(10), blending_power(2),
+            tile_size(0), padding(50), num_halo_updates(3),
             float_albedo(false), float_exposure(false), float_cameras(false),
             float_all_cameras(false),
 	    model_shadows(false),
@@ -996,6 +1179,7 @@ struct Options : public vw::cartography::GdalWriteOptions {
 	    crop_input_images(false), use_blending_weights(false),
             float_dem_at_boundary(false), fix_dem(false),
             float_reflectance_model(false), query(false), save_sparingly(false),
+            cache_approx_camera_models(false),
 	    smoothness_weight(0), initial_dem_constraint_weight(0.0),
 	    albedo_constraint_weight(0.0),
 	    camera_position_step_size(1.0), rpc_penalty_weight(0.0),
@@ -2487,6 +2671,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Use RPC approximations for the camera models instead of approximate tabulated camera models (invoke with --use-approx-camera-models).")
     ("rpc-penalty-weight", po::value(&opt.rpc_penalty_weight)->default_value(0.1),
      "The RPC penalty weight to use to keep the higher-order RPC coefficients small, if the RPC model approximation is used. Higher penalty weight results in smaller such coefficients.")
+    ("cache-approx-camera-models",   po::bool_switch(&opt.cache_approx_camera_models)->default_value(false)->implicit_value(true),
+     "Save the approximate camera models to disk using the output prefix, and reuse them in later runs with the same output prefix if the images, cameras, DEM, and camera adjustments did not change.")
     ("use-semi-approx",   po::bool_switch(&opt.use_semi_approx)->default_value(false)->implicit_value(true),
      "This is an undocumented experiment.")
     ("coarse-levels", po::value(&opt.coarse_levels)->default_value(0),
@@ -2524,7 +2710,13 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("save-sparingly",   po::bool_switch(&opt.save_sparingly)->default_value(false)->implicit_value(true),
      "Avoid saving any results except the adjustments and the DEM, as that's a lot of files.")
     ("camera-position-step-size", po::value(&opt.camera_position_step_size)->default_value(1.0),
-     "Larger step size will result in more aggressiveness in varying the camera position if it is being floated (which may result in a better solution or in divergence).");
+     "Larger step size will result in more aggressiveness in varying the camera position if it is being floated (which may result in a better solution or in divergence).")
+    ("tile-size", po::value(&opt.tile_size)->default_value(0),
+     "If positive, split the DEM into tiles of this size (not counting the padding) and solve them concurrently in this process, sharing the images and camera models. This is an alternative to parallel_sfs on a single machine.")
+    ("padding", po::value(&opt.padding)->default_value(50),
+     "How much to expand each tile in each direction when using --tile-size. The padded heights are refreshed from the neighboring tiles between passes. Must be at least 2.")
+    ("num-halo-updates", po::value(&opt.num_halo_updates)->default_value(3),
+     "When using --tile-size, how many times to solve all tiles, updating the padding of each tile from its neighbors in between. The iterations are divided among these passes.");
 
   general_options.add( vw::cartography::GdalWriteOptionsDescription(opt) );
 
@@ -2737,6 +2929,28 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     vw_throw( ArgumentErr()
               << "Using cropped input images implies using an approximate camera model.\n" );
   }
+
+  if (opt.tile_size < 0)
+    vw_throw( ArgumentErr() << "The tile size must be non-negative.\n" );
+  
+  if (opt.tile_size > 0) {
+    if (num_dems > 1)
+      vw_throw( ArgumentErr() << "Cannot use --tile-size with multiple DEM clips.\n" );
+    // With less padding, a tile at the DEM edge which owns a single
+    // row or column could be too thin to have any interior pixels.
+    if (opt.padding < 2)
+      vw_throw( ArgumentErr() << "When using --tile-size the padding must be at least 2.\n" );
+    if (opt.num_halo_updates <= 0)
+      vw_throw( ArgumentErr() << "The number of halo updates must be positive.\n" );
+    // The tiles are solved independently, so quantities shared among
+    // all of them cannot float.
+    if (opt.float_cameras || opt.float_exposure || opt.float_reflectance_model)
+      vw_throw( ArgumentErr() << "Cannot float the cameras, exposures, or reflectance "
+                << "model when using --tile-size.\n" );
+    if (opt.fix_dem || opt.save_computed_intensity_only)
+      vw_throw( ArgumentErr() << "The options --fix-dem and --save-computed-intensity-only "
+                << "cannot be used with --tile-size.\n" );
+  }
   
 }
 
@@ -3047,6 +3261,347 @@ void run_sfs_level(// Fixed inputs
   vw_out() << summary.FullReport() << "\n" << std::endl;
 }
 
+// Data for one tile of the DEM when solving in tiled mode. The tile
+// DEM includes the padding (the halo), which is refreshed from the
+// neighboring tiles between passes. The owned box is the region of
+// the full DEM this tile is responsible for. Both boxes are in the
+// pixels of the full DEM at the current level.
+struct SfsTile {
+  BBox2i padded_box, owned_box;
+  GeoReference geo;
+  ImageView<double> dem, orig_dem, albedo;
+  // Private copies of the shared quantities. These are kept fixed.
+  std::vector<double> exposures, adjustments, coeffs;
+  ceres::Solver::Summary summary;
+};
+
+// Solve the SfS problem for a single tile. The boundary of the tile
+// is kept fixed, which is where the heights of the neighbors enter.
+void solve_sfs_tile(int num_iterations, Options const& opt,
+                    double smoothness_weight, double gridx, double gridy,
+                    double const& max_dem_height, double initial_albedo,
+                    std::vector<BBox2i>     const& crop_boxes,
+                    std::vector<MaskedImgT> const& masked_images,
+                    std::vector<DoubleImgT> const& blend_weights,
+                    GlobalParams            const& global_params,
+                    std::vector<ModelParams> const& model_params,
+                    std::vector<boost::shared_ptr<CameraModel> > const& cameras,
+                    SfsTile & tile){
+
+  int num_images = opt.input_images.size();
+  std::set<int> const& skip_images = opt.skip_images[0];
+  ImageView<double> & dem    = tile.dem;
+  ImageView<double> & albedo = tile.albedo;
+  
+  ceres::Problem problem;
+  bool has_images = false;
+  for (int col = 1; col < dem.cols()-1; col++) {
+    for (int row = 1; row < dem.rows()-1; row++) {
+
+      for (int image_iter = 0; image_iter < num_images; image_iter++) {
+        if (skip_images.find(image_iter) != skip_images.end()) 
+          continue;
+        ceres::LossFunction* loss_function_img = NULL;
+        ceres::CostFunction* cost_function_img =
+          IntensityError::Create(col, row, dem, tile.geo,
+                                 opt.model_shadows,
+                                 opt.camera_position_step_size,
+                                 max_dem_height,
+                                 gridx, gridy,
+                                 global_params, model_params[image_iter],
+                                 crop_boxes[image_iter],
+                                 masked_images[image_iter],
+                                 blend_weights[image_iter],
+                                 cameras[image_iter]);
+        problem.AddResidualBlock(cost_function_img, loss_function_img,
+                                 &tile.exposures[image_iter],      // exposure
+                                 &dem(col-1, row),                 // left
+                                 &dem(col, row),                   // center
+                                 &dem(col+1, row),                 // right
+                                 &dem(col, row+1),                 // bottom
+                                 &dem(col, row-1),                 // top
+                                 &albedo(col, row),                // albedo
+                                 &tile.adjustments[6*image_iter],  // camera
+                                 &tile.coeffs[0]);                 // reflectance model coeffs
+        has_images = true;
+      }
+
+      ceres::LossFunction* loss_function_sm = NULL;
+      ceres::CostFunction* cost_function_sm =
+        SmoothnessError::Create(smoothness_weight, gridx, gridy);
+      problem.AddResidualBlock(cost_function_sm, loss_function_sm,
+                               &dem(col-1, row+1), &dem(col, row+1), &dem(col+1, row+1),
+                               &dem(col-1, row  ), &dem(col, row  ), &dem(col+1, row  ),
+                               &dem(col-1, row-1), &dem(col, row-1), &dem(col+1, row-1));
+
+      if (opt.initial_dem_constraint_weight > 0) {
+        ceres::LossFunction* loss_function_hc = NULL;
+        ceres::CostFunction* cost_function_hc =
+          HeightChangeError::Create(tile.orig_dem(col, row),
+                                    opt.initial_dem_constraint_weight);
+        problem.AddResidualBlock(cost_function_hc, loss_function_hc, &dem(col, row));
+      }
+
+      if (opt.float_albedo && opt.albedo_constraint_weight > 0) {
+        ceres::LossFunction* loss_function_hc = NULL;
+        ceres::CostFunction* cost_function_hc =
+          AlbedoChangeError::Create(initial_albedo, opt.albedo_constraint_weight);
+        problem.AddResidualBlock(cost_function_hc, loss_function_hc, &albedo(col, row));
+      }
+    }
+  }
+
+  // The boundary of the tile is fixed. Where the tile touches a
+  // neighbor, the fixed values come from that neighbor's solution.
+  // The boundary of the full DEM floats only if requested.
+  BBox2i const& pbox = tile.padded_box;
+  BBox2i const& obox = tile.owned_box;
+  for (int col = 0; col < dem.cols(); col++) {
+    for (int row = 0; row < dem.rows(); row++) {
+      bool shared_edge = ( (col == 0              && pbox.min().x() < obox.min().x()) ||
+                           (col == dem.cols() - 1 && pbox.max().x() > obox.max().x()) ||
+                           (row == 0              && pbox.min().y() < obox.min().y()) ||
+                           (row == dem.rows() - 1 && pbox.max().y() > obox.max().y()) );
+      bool dem_edge = ( col == 0 || col == dem.cols() - 1 ||
+                        row == 0 || row == dem.rows() - 1 ) && !shared_edge;
+      if (shared_edge || (dem_edge && !opt.float_dem_at_boundary))
+        problem.SetParameterBlockConstant(&dem(col, row));
+    }
+  }
+
+  if (has_images) {
+    for (int image_iter = 0; image_iter < num_images; image_iter++) {
+      if (skip_images.find(image_iter) != skip_images.end()) 
+        continue;
+      problem.SetParameterBlockConstant(&tile.exposures[image_iter]);
+      problem.SetParameterBlockConstant(&tile.adjustments[6*image_iter]);
+    }
+    problem.SetParameterBlockConstant(&tile.coeffs[0]);
+    
+    if (!opt.float_albedo) {
+      for (int col = 1; col < dem.cols() - 1; col++) {
+        for (int row = 1; row < dem.rows() - 1; row++) {
+          problem.SetParameterBlockConstant(&albedo(col, row));
+        }
+      }
+    }
+  }
+  
+  // The parallelism is over tiles, so each solver uses one thread.
+  ceres::Solver::Options options;
+  options.gradient_tolerance = 1e-16;
+  options.function_tolerance = 1e-16;
+  options.max_num_iterations = num_iterations;
+  options.minimizer_progress_to_stdout = 0;
+  options.num_threads = 1;
+  options.linear_solver_type = ceres::SPARSE_SCHUR;
+
+  tile.summary = ceres::Solver::Summary();
+  if (num_iterations > 0 && has_images)
+    ceres::Solve(options, &problem, &tile.summary);
+}
+
+// Task to solve one tile from the thread pool
+class SfsTileTask: public vw::Task, private boost::noncopyable {
+  int m_num_iterations;
+  Options const& m_opt;
+  double m_smoothness_weight, m_gridx, m_gridy;
+  double const& m_max_dem_height;
+  double m_initial_albedo;
+  std::vector<BBox2i>      const& m_crop_boxes;
+  std::vector<MaskedImgT>  const& m_masked_images;
+  std::vector<DoubleImgT>  const& m_blend_weights;
+  GlobalParams             const& m_global_params;
+  std::vector<ModelParams> const& m_model_params;
+  std::vector<boost::shared_ptr<CameraModel> > const& m_cameras;
+  SfsTile & m_tile;
+public:
+  SfsTileTask(int num_iterations, Options const& opt,
+              double smoothness_weight, double gridx, double gridy,
+              double const& max_dem_height, double initial_albedo,
+              std::vector<BBox2i>      const& crop_boxes,
+              std::vector<MaskedImgT>  const& masked_images,
+              std::vector<DoubleImgT>  const& blend_weights,
+              GlobalParams             const& global_params,
+              std::vector<ModelParams> const& model_params,
+              std::vector<boost::shared_ptr<CameraModel> > const& cameras,
+              SfsTile & tile):
+    m_num_iterations(num_iterations), m_opt(opt),
+    m_smoothness_weight(smoothness_weight), m_gridx(gridx), m_gridy(gridy),
+    m_max_dem_height(max_dem_height), m_initial_albedo(initial_albedo),
+    m_crop_boxes(crop_boxes), m_masked_images(masked_images),
+    m_blend_weights(blend_weights), m_global_params(global_params),
+    m_model_params(model_params), m_cameras(cameras), m_tile(tile){}
+
+  void operator()() {
+    solve_sfs_tile(m_num_iterations, m_opt, m_smoothness_weight, m_gridx, m_gridy,
+                   m_max_dem_height, m_initial_albedo, m_crop_boxes, m_masked_images,
+                   m_blend_weights, m_global_params, m_model_params, m_cameras, m_tile);
+  }
+};
+
+// Run sfs at a given coarseness level by splitting the DEM into
+// padded tiles which are solved concurrently. All tiles share the
+// images and the (approximate) camera models. Between passes, the
+// padding of each tile is overwritten with the heights its
+// neighbors found, so the tiles converge towards a seamless
+// solution without the need to mosaic them later.
+void run_sfs_level_tiled(// Fixed inputs
+                         int num_iterations, Options & opt,
+                         std::vector<GeoReference> const& geo,
+                         double smoothness_weight,
+                         double dem_nodata_val,
+                         std::vector< std::vector<BBox2i>     > const& crop_boxes,
+                         std::vector< std::vector<MaskedImgT> > const& masked_images,
+                         std::vector< std::vector<DoubleImgT> > const& blend_weights,
+                         GlobalParams const& global_params,
+                         std::vector<ModelParams> const & model_params,
+                         std::vector< ImageView<double> > const& orig_dems, 
+                         double initial_albedo,
+                         // Quantities that will float
+                         std::vector< ImageView<double> > & dems,
+                         std::vector< ImageView<double> > & albedos,
+                         std::vector< std::vector<boost::shared_ptr<CameraModel> > > & cameras,
+                         std::vector<double> & exposures,
+                         std::vector<double> & adjustments,
+                         std::vector<double> & coeffs){
+
+  // Sanity check. Multiple clips are ruled out in handle_arguments().
+  if (dems.size() != 1)
+    vw_throw( ArgumentErr() << "Expecting a single DEM in tiled mode.\n" );
+  
+  ImageView<double> & dem    = dems[0];
+  ImageView<double> & albedo = albedos[0];
+  
+  double gridx, gridy;
+  compute_grid_sizes_in_meters(dem, geo[0], dem_nodata_val, gridx, gridy);
+  vw_out() << "grid in x and y in meters: "
+	   << gridx << ' ' << gridy << std::endl;
+  g_gridx = &gridx;
+  g_gridy = &gridy;
+
+  std::vector<double> max_dem_height(1, -std::numeric_limits<double>::max());
+  if (opt.model_shadows) {
+    for (int col = 0; col < dem.cols(); col++) {
+      for (int row = 0; row < dem.rows(); row++) {
+        max_dem_height[0] = std::max(max_dem_height[0], dem(col, row));
+      }
+    }
+  }
+  g_max_dem_height = &max_dem_height;
+
+  // Needed by the cost functions
+  g_opt = &opt;
+  
+  if (opt.num_threads > 1 && !opt.use_approx_camera_models) {
+    vw_out() << "Using exact ISIS camera models. Can run with only a single thread.\n";
+    opt.num_threads = 1;
+  }
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  
+  // Break up the DEM into tiles. The owned boxes partition the DEM.
+  // A tile with no interior pixels has nothing to solve for, as all
+  // its heights are fixed, so it is skipped and keeps its input heights.
+  // With the padding validated in handle_arguments(), this happens
+  // only if the DEM itself is thinner than 3 pixels.
+  std::vector<SfsTile> tiles;
+  int num_skipped = 0;
+  BBox2i dem_box = bounding_box(dem);
+  for (int begx = 0; begx < dem.cols(); begx += opt.tile_size) {
+    for (int begy = 0; begy < dem.rows(); begy += opt.tile_size) {
+      SfsTile tile;
+      tile.owned_box = BBox2i(begx, begy,
+                              std::min(opt.tile_size, dem.cols() - begx),
+                              std::min(opt.tile_size, dem.rows() - begy));
+      tile.padded_box = tile.owned_box;
+      tile.padded_box.expand(opt.padding);
+      tile.padded_box.crop(dem_box);
+      if (tile.padded_box.width() < 3 || tile.padded_box.height() < 3) {
+        num_skipped++;
+        continue;
+      }
+      tile.geo         = crop(geo[0], tile.padded_box);
+      tile.orig_dem    = crop(orig_dems[0], tile.padded_box);
+      tile.exposures   = exposures;
+      tile.adjustments = adjustments;
+      tile.coeffs      = coeffs;
+      tiles.push_back(tile);
+    }
+  }
+  
+  if (num_skipped > 0)
+    vw_out(WarningMessage) << "Skipping " << num_skipped << " tile(s) which are "
+                           << "too thin to solve.\n";
+  
+  int num_passes = opt.num_halo_updates;
+  int iters_per_pass = (num_iterations + num_passes - 1)/num_passes;
+  vw_out() << "Solving " << tiles.size() << " tiles using " << num_threads
+           << " threads, with " << num_passes << " passes of at most "
+           << iters_per_pass << " iterations.\n";
+
+  for (int pass = 0; pass < num_passes && iters_per_pass > 0; pass++) {
+
+    // Refresh the tiles from the current full DEM. This updates the
+    // padding with the heights found by the neighbors in the previous pass.
+    for (size_t tile_iter = 0; tile_iter < tiles.size(); tile_iter++) {
+      tiles[tile_iter].dem    = crop(dem,    tiles[tile_iter].padded_box);
+      tiles[tile_iter].albedo = crop(albedo, tiles[tile_iter].padded_box);
+    }
+
+    Stopwatch sw;
+    sw.start();
+    FifoWorkQueue queue(num_threads);
+    for (size_t tile_iter = 0; tile_iter < tiles.size(); tile_iter++) {
+      boost::shared_ptr<SfsTileTask>
+        task(new SfsTileTask(iters_per_pass, opt, smoothness_weight, gridx, gridy,
+                             max_dem_height[0], initial_albedo,
+                             crop_boxes[0], masked_images[0], blend_weights[0],
+                             global_params, model_params, cameras[0],
+                             tiles[tile_iter]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+    sw.stop();
+    
+    // Copy back to the full DEM only the region each tile owns
+    double initial_cost = 0.0, final_cost = 0.0;
+    for (size_t tile_iter = 0; tile_iter < tiles.size(); tile_iter++) {
+      SfsTile const& tile = tiles[tile_iter];
+      for (int col = tile.owned_box.min().x(); col < tile.owned_box.max().x(); col++) {
+        for (int row = tile.owned_box.min().y(); row < tile.owned_box.max().y(); row++) {
+          int lcol = col - tile.padded_box.min().x();
+          int lrow = row - tile.padded_box.min().y();
+          dem(col, row)    = tile.dem(lcol, lrow);
+          albedo(col, row) = tile.albedo(lcol, lrow);
+        }
+      }
+      initial_cost += tile.summary.initial_cost;
+      final_cost   += tile.summary.final_cost;
+    }
+    vw_out() << "Finished pass " << pass + 1 << " of " << num_passes << " in "
+             << sw.elapsed_seconds() << " s. Total cost over tiles: "
+             << initial_cost << " -> " << final_cost << std::endl;
+  }
+
+  // Save the final results, with the same globals as in run_sfs_level().
+  g_dem            = &dems;
+  g_albedo         = &albedos;
+  g_geo            = &geo;
+  g_global_params  = &global_params;
+  g_model_params   = &model_params;
+  g_crop_boxes     = &crop_boxes;
+  g_masked_images  = &masked_images;
+  g_blend_weights  = &blend_weights;
+  g_cameras        = &cameras;
+  g_iter           = -1;
+  g_final_iter     = true;
+  SfsCallback callback;
+  ceres::IterationSummary callback_summary;
+  callback(callback_summary);
+}
+
 int main(int argc, char* argv[]) {
   
   Stopwatch sw_total;
@@ -3323,12 +3878,34 @@ int main(int argc, char* argv[]) {
                    << opt.input_cameras[image_iter] << " and clip "
                    << opt.input_dems[dem_iter] <<".\n";
           BBox2i img_bbox = crop_boxes[0][dem_iter][image_iter];
+
+          // Where to save the model for later runs. The file
+          // modification times are part of the key.
+          std::string cache_file, cache_tag;
+          if (opt.cache_approx_camera_models) {
+            std::ostringstream os;
+            os << fs::path(asp::bundle_adjust_file_name(opt.out_prefix,
+                                                        opt.input_images[image_iter],
+                                                        opt.input_cameras[image_iter]))
+              .replace_extension("").string();
+            if (num_dems > 1) os << "-clip" << dem_iter;
+            os << "-approx-camera.bin";
+            cache_file = os.str();
+
+            std::ostringstream ts;
+            ts << opt.input_images[image_iter] << ' '
+               << fs::last_write_time(opt.input_images[image_iter]) << ' '
+               << opt.input_cameras[image_iter] << ' '
+               << fs::last_write_time(opt.input_cameras[image_iter]);
+            cache_tag = ts.str();
+          }
+          
           Stopwatch sw;
           sw.start();
           boost::shared_ptr<CameraModel> apcam
             (new ApproxCameraModel(adj_cam, exact_cam, img_bbox, dems[0][dem_iter], geos[0][dem_iter],
                                    dem_nodata_val, opt.use_rpc_approximation, opt.use_semi_approx,
-                                   opt.rpc_penalty_weight, camera_mutex));
+                                   opt.rpc_penalty_weight, camera_mutex, cache_file, cache_tag));
           sw.stop();
           vw_out() << "Approximate model generation time: " << sw.elapsed_seconds()
                    << " s." << std::endl;
@@ -3807,17 +4384,31 @@ int main(int argc, char* argv[]) {
         }
       }
       
-      run_sfs_level(// Fixed inputs
-                    num_iterations, opt, geos[level],
-                    opt.smoothness_weight*factors[level]*factors[level],
-                    dem_nodata_val, crop_boxes[level],
-                    masked_images_vec[level], blend_weights_vec[level],
-                    global_params, model_params,
-                    orig_dems[level], initial_albedo,
-                    // Quantities that will float
-                    dems[level], albedos[level], cameras,
-                    opt.image_exposures_vec,
-                    adjustments, opt.model_coeffs_vec);
+      if (opt.tile_size <= 0) {
+        run_sfs_level(// Fixed inputs
+                      num_iterations, opt, geos[level],
+                      opt.smoothness_weight*factors[level]*factors[level],
+                      dem_nodata_val, crop_boxes[level],
+                      masked_images_vec[level], blend_weights_vec[level],
+                      global_params, model_params,
+                      orig_dems[level], initial_albedo,
+                      // Quantities that will float
+                      dems[level], albedos[level], cameras,
+                      opt.image_exposures_vec,
+                      adjustments, opt.model_coeffs_vec);
+      }else{
+        run_sfs_level_tiled(// Fixed inputs
+                            num_iterations, opt, geos[level],
+                            opt.smoothness_weight*factors[level]*factors[level],
+                            dem_nodata_val, crop_boxes[level],
+                            masked_images_vec[level], blend_weights_vec[level],
+                            global_params, model_params,
+                            orig_dems[level], initial_albedo,
+                            // Quantities that will float
+                            dems[level], albedos[level], cameras,
+                            opt.image_exposures_vec,
+                            adjustments, opt.model_coeffs_vec);
+      }
 
       // TODO: Study this. Discarding the coarse DEM and exposure so
       // keeping only the cameras seem to work better.
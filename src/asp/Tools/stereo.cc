@@ -80,6 +80,49 @@ namespace asp {
     return b;
   }
 
+  bool read_worker_tile(ASPGlobalOptions & opt){
+
+    // Processing a tile may change the stereo settings, such as the
+    // search range in stereo_corr, so each tile starts from the
+    // settings as they were before the first one.
+    static bool have_settings = false;
+    static StereoSettings orig_settings;
+    if (!have_settings) {
+      orig_settings = stereo_settings();
+      have_settings = true;
+    } else {
+      stereo_settings() = orig_settings;
+    }
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+      std::istringstream is(line);
+      std::string tile_prefix;
+      int xoff, yoff, xsize, ysize;
+      if (!(is >> tile_prefix))
+        continue; // skip empty lines
+      if (!(is >> xoff >> yoff >> xsize >> ysize))
+        vw_throw(ArgumentErr() << "Could not parse the tile: " << line << "\n");
+
+      opt.out_prefix = tile_prefix;
+      stereo_settings().trans_crop_win = BBox2i(xoff, yoff, xsize, ysize);
+
+      // As in handle_arguments(), without a left crop window the tile
+      // is intersected with L.tif.
+      if (stereo_settings().left_image_crop_win == BBox2i(0, 0, 0, 0) &&
+          fs::exists(opt.out_prefix+"-L.tif") ){
+        DiskImageView<PixelGray<float> > L_img(opt.out_prefix+"-L.tif");
+        stereo_settings().trans_crop_win.crop(bounding_box(L_img));
+      }
+
+      vw_out() << "\n[ " << current_posix_time_string() << " ] : Processing tile: "
+               << opt.out_prefix << " " << stereo_settings().trans_crop_win << "\n";
+      return true;
+    }
+
+    return false;
+  }
+
   void parse_multiview(int argc, char* argv[],
                        boost::program_options::options_description const&
                        additional_options,
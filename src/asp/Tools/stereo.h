@@ -100,6 +100,15 @@ namespace asp {
 
   bool skip_image_normalization(ASPGlobalOptions const& opt);
 
+  /// With --tile-worker, read from standard input the next tile to
+  /// process, as a line of the form "<tile prefix> <xoff> <yoff> <xsize> <ysize>".
+  /// Set the output prefix and trans_crop_win to those of the tile, as
+  /// if the tool was invoked for that tile, with the stereo settings
+  /// restored to those before the first tile. Return false when there
+  /// are no more tiles. --tile-worker is an internal option, passed by
+  /// parallel_stereo with --tile-workers.
+  bool read_worker_tile(ASPGlobalOptions & opt);
+
 } // end namespace vw
 
 #endif//__ASP_STEREO_H__
@@ -26,7 +26,10 @@ when running the SGM algorithm on large data sets using parallel_stereo.
 #include <asp/Tools/stereo.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <asp/Sessions/ResourceLoader.h>
+#include <vw/Core/ThreadPool.h>
 #include <boost/filesystem.hpp>
+#include <algorithm>
+#include <set>
 
 using namespace vw;
 using namespace vw::stereo;
@@ -100,6 +103,15 @@ BBox2i bbox_from_folder(std::string const& s) {
   return BBox2i(x, y, width, height);
 }
 
+/// Whether the output prefix is that of a parallel_stereo tile, such
+/// as "out-2048_0_1487_2048/2048_0_1487_2048".
+bool is_tile_prefix(std::string const& prefix) {
+  boost::filesystem::path path(prefix);
+  std::string folder = path.parent_path().filename().string();
+  std::string name   = path.filename().string();
+  return !name.empty() && folder.size() > name.size() &&
+    folder.substr(folder.size() - name.size() - 1) == "-" + name;
+}
 
 /// Returns one of eight possible ROI locations for the given tile.
 /// - If get_buffer is set, fetch the ROI from the buffer region.
@@ -563,6 +575,232 @@ void stereo_blending( ASPGlobalOptions const& opt ) {
                                           TerminalProgressCallback("asp", "\t--> Blending :") );
 }
 
+//==========================================================================
+// Blending all tiles in one pass
+
+/// The parts of a tile needed to blend it and its neighbors, each with
+/// its blending weights. Each tile is read and has its weights computed
+/// only once, rather than once for itself and once for each neighbor.
+struct TileParts {
+  std::string   path;
+  DispImageType main_image;
+  WeightsType   main_weights;
+  BBox2i        buffer_rois   [NUM_NEIGHBORS]; // ROIs in the tile, empty if no buffer
+  DispImageType buffers       [NUM_NEIGHBORS];
+  WeightsType   buffer_weights[NUM_NEIGHBORS];
+  bool          is_valid;
+  TileParts(): is_valid(false){}
+};
+
+/// Read a tile and extract its central area and its buffers.
+void load_tile_parts(std::string const& path, int buff_size, TileParts & parts) {
+
+  parts.path = path;
+  DispImageType full_image = DiskImageType(path);
+
+  BBox2i main_roi;
+  get_roi_from_tile(path, M, buff_size, false, main_roi);
+  parts.main_image = crop(full_image, main_roi);
+  centerline_weights(full_image, parts.main_weights, main_roi);
+
+  for (size_t i=0; i<NUM_NEIGHBORS; ++i) {
+    BBox2i roi;
+    if (!get_roi_from_tile(path, Position(i), buff_size, true, roi))
+      continue;
+    parts.buffer_rois[i] = roi;
+    parts.buffers    [i] = crop(full_image, roi);
+    centerline_weights(full_image, parts.buffer_weights[i], roi);
+  }
+  parts.is_valid = true;
+}
+
+/// Load the parts of a tile, as a task in a thread pool
+class LoadTilePartsTask : public Task, private boost::noncopyable {
+  std::string m_path;
+  int         m_buff_size;
+  TileParts & m_parts;
+public:
+  LoadTilePartsTask(std::string const& path, int buff_size, TileParts & parts):
+    m_path(path), m_buff_size(buff_size), m_parts(parts){}
+  void operator()() {
+    try {
+      load_tile_parts(m_path, m_buff_size, m_parts);
+    } catch(...) {
+      vw_out(WarningMessage) << "Error loading tile " << m_path
+                             << " but will proceed with the available tiles.\n";
+      m_parts = TileParts(); // Mark this tile as invalid
+    }
+  }
+};
+
+/// Blend a tile with its neighbors, as done by tile_blend(), but using
+/// the parts of the tiles already in memory. Neighbors which are not
+/// present are null.
+DispImageType blend_tile_parts(TileParts const& main_parts,
+                               TileParts const* neighbors[NUM_NEIGHBORS],
+                               int buff_size) {
+
+  const bool NOT_BUFFER   = false;
+  const bool BUFFERS_GONE = true;
+
+  DispImageType output_image = copy(main_parts.main_image);
+  WeightsType   main_weights = copy(main_parts.main_weights);
+
+  // Multiply the main image values by blend weights
+  output_image *= main_weights;
+
+  // Blend in the neighbors one section at a time.
+  for (size_t i=0; i<NUM_NEIGHBORS; ++i) {
+    if (neighbors[i] == NULL || !neighbors[i]->is_valid)
+      continue;
+    Position opposed = get_opposed_position(Position(i));
+    BBox2i buffer_roi = neighbors[i]->buffer_rois[opposed];
+    if (buffer_roi.empty())
+      continue;
+
+    BBox2i input_roi, tile_roi = buffer_roi;
+    get_roi_from_tile(main_parts.path, Position(i), buff_size, NOT_BUFFER, input_roi, BUFFERS_GONE);
+    check_roi_bounds(input_roi, tile_roi, bounding_box(output_image));
+
+    // The part of the neighbor buffer to use, relative to that buffer
+    BBox2i part_roi = tile_roi;
+    part_roi -= buffer_roi.min();
+    blend_tile_region(output_image, main_weights, input_roi,
+                      validate_mask(crop(neighbors[i]->buffers[opposed], part_roi)),
+                      crop(neighbors[i]->buffer_weights[opposed], part_roi), tile_roi);
+  }
+
+  // Normalize the main image values to account for the applied weighting.
+  output_image /= main_weights;
+
+  return output_image;
+}
+
+/// Blend all tiles of a parallel_stereo run in one pass over the rows of
+/// tiles, writing the result for each tile in its folder. Only the tiles
+/// in the rows above, at, and below the current row are kept in memory,
+/// and only the buffers of the row above.
+void stereo_blending_all_tiles( ASPGlobalOptions const& opt ) {
+
+  int buff_size = stereo_settings().sgm_collar_size;
+
+  // The tile folders are named <out prefix>-<bbox>
+  boost::filesystem::path out_prefix(opt.out_prefix);
+  boost::filesystem::path parallel_stereo_folder = out_prefix.parent_path();
+  if (parallel_stereo_folder.empty())
+    parallel_stereo_folder = ".";
+  std::string folder_start = out_prefix.filename().string() + "-";
+
+  std::vector<BBox2i>      tile_bboxes;
+  std::vector<std::string> tile_prefixes;
+  for (boost::filesystem::directory_iterator iter(parallel_stereo_folder);
+       iter!=boost::filesystem::directory_iterator(); ++iter) {
+    std::string folder = iter->path().filename().string();
+    if (!boost::filesystem::is_directory(iter->status()) ||
+        folder.find(folder_start) != 0)
+      continue;
+    std::string bbox_string = extract_process_folder_bbox_string(folder);
+    std::string tile_prefix = iter->path().string() + "/" + bbox_string;
+    if (!boost::filesystem::exists(tile_prefix + "-Dnosym.tif"))
+      continue;
+
+    // As in stereo_blending(), only SGM disparities are blended
+    boost::scoped_ptr<SrcImageResource>
+      rsrc(DiskImageResource::open(tile_prefix + "-Dnosym.tif"));
+    if (rsrc->channel_type() == VW_CHANNEL_INT32)
+      vw_throw( ArgumentErr() << "Error: stereo_blend should only be called after SGM correlation." );
+
+    tile_bboxes.push_back(bbox_from_folder(folder));
+    tile_prefixes.push_back(tile_prefix);
+  }
+  if (tile_bboxes.empty())
+    vw_throw( ArgumentErr() << "No parallel_stereo tiles found with prefix: "
+                            << opt.out_prefix << "\n" );
+
+  // Arrange the tiles in a grid
+  std::set<int> col_starts, row_starts;
+  for (size_t i = 0; i < tile_bboxes.size(); i++) {
+    col_starts.insert(tile_bboxes[i].min().x());
+    row_starts.insert(tile_bboxes[i].min().y());
+  }
+  std::vector<int> cols(col_starts.begin(), col_starts.end());
+  std::vector<int> rows(row_starts.begin(), row_starts.end());
+  int num_cols = cols.size(), num_rows = rows.size();
+  std::vector<int> grid(num_cols*num_rows, -1);
+  for (size_t i = 0; i < tile_bboxes.size(); i++) {
+    int col = std::lower_bound(cols.begin(), cols.end(), tile_bboxes[i].min().x()) - cols.begin();
+    int row = std::lower_bound(rows.begin(), rows.end(), tile_bboxes[i].min().y()) - rows.begin();
+    grid[row*num_cols + col] = i;
+  }
+  vw_out() << "Blending " << tile_bboxes.size() << " tiles in " << num_rows
+           << " rows and " << num_cols << " columns.\n";
+
+  // The offsets of the neighbors, indexed by Position
+  const int dx[NUM_NEIGHBORS] = {-1, 0, 1, -1, 1, -1, 0, 1};
+  const int dy[NUM_NEIGHBORS] = {-1, -1, -1, 0, 0, 1, 1, 1};
+
+  cartography::GeoReference left_georef;
+  bool   has_left_georef = read_georeference(left_georef,  opt.out_prefix + "-L.tif");
+  bool   has_nodata      = false;
+  double nodata          = -32768.0;
+
+  std::vector<TileParts> parts(tile_bboxes.size());
+  TerminalProgressCallback tpc("asp", "\t--> Blending :");
+  for (int row = 0; row < num_rows; row++) {
+
+    // Load the tiles in this row, if not loaded before, and in the next row
+    FifoWorkQueue queue(vw_settings().default_num_threads());
+    for (int r = row; r <= std::min(row + 1, num_rows - 1); r++) {
+      for (int col = 0; col < num_cols; col++) {
+        int i = grid[r*num_cols + col];
+        if (i < 0 || (r == row && row > 0))
+          continue;
+        boost::shared_ptr<LoadTilePartsTask>
+          task(new LoadTilePartsTask(tile_prefixes[i] + "-Dnosym.tif", buff_size, parts[i]));
+        queue.add_task(task);
+      }
+    }
+    queue.join_all();
+
+    // Blend and write the tiles in this row
+    for (int col = 0; col < num_cols; col++) {
+      int i = grid[row*num_cols + col];
+      if (i < 0 || !parts[i].is_valid)
+        continue;
+
+      TileParts const* neighbors[NUM_NEIGHBORS];
+      for (size_t k = 0; k < NUM_NEIGHBORS; k++) {
+        int c = col + dx[k], r = row + dy[k];
+        neighbors[k] = NULL;
+        if (c >= 0 && c < num_cols && r >= 0 && r < num_rows && grid[r*num_cols + c] >= 0)
+          neighbors[k] = &parts[grid[r*num_cols + c]];
+      }
+
+      DispImageType output = blend_tile_parts(parts[i], neighbors, buff_size);
+      std::string rd_file = tile_prefixes[i] + "-RD.tif";
+      vw_out(DebugMessage, "asp") << "Writing: " << rd_file << "\n";
+      vw::cartography::block_write_gdal_image(rd_file, output,
+                                              has_left_georef, left_georef,
+                                              has_nodata, nodata, opt);
+
+      // The central area of this tile is no longer needed
+      parts[i].main_image   = DispImageType();
+      parts[i].main_weights = WeightsType();
+      tpc.report_incremental_progress(1.0/tile_bboxes.size());
+    }
+
+    // The tiles in the row above are no longer needed
+    if (row > 0) {
+      for (int col = 0; col < num_cols; col++) {
+        int i = grid[(row-1)*num_cols + col];
+        if (i >= 0)
+          parts[i] = TileParts();
+      }
+    }
+  }
+  tpc.report_finished();
+}
+
 int main(int argc, char* argv[]) {
 
   try {
@@ -586,7 +824,16 @@ int main(int argc, char* argv[]) {
 
     // Internal Processes
     //---------------------------------------------------------
-    stereo_blending( opt );
+    // With --blend-all-tiles set in stereo.default, the stereo_blend
+    // runs for single tiles see it too, and must blend just their tile.
+    if (stereo_settings().blend_all_tiles && !is_tile_prefix(opt.out_prefix)) {
+      stereo_blending_all_tiles( opt );
+    } else if (stereo_settings().tile_worker) {
+      while (read_worker_tile(opt))
+        stereo_blending( opt );
+    } else {
+      stereo_blending( opt );
+    }
 
     vw_out() << "\n[ " << current_posix_time_string()
              << " ] : BLENDING FINISHED \n";
@@ -0,0 +1,299 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file stereo_corr.h
+///
+/// The full-resolution correlator, shared by stereo_corr and by
+/// the fused mode of stereo_tri.
+
+#ifndef __ASP_TOOLS_STEREO_CORR_H__
+#define __ASP_TOOLS_STEREO_CORR_H__
+
+#include <vw/Stereo/CorrelationView.h>
+#include <vw/Stereo/CostFunctions.h>
+#include <vw/Stereo/DisparityMap.h>
+#include <asp/Tools/stereo.h>
+#include <asp/Core/LocalHomography.h>
+
+// TODO: Make this into an option?
+#define SAVE_CORR_DEBUG false // Set this to true to generate pyramid correlation debug images
+
+namespace asp {
+
+  using namespace vw;
+
+  /// Returns the properly cast cost mode type
+  inline stereo::CostFunctionType get_cost_mode_value() {
+    switch(stereo_settings().cost_mode) {
+      case 0: return stereo::ABSOLUTE_DIFFERENCE;
+      case 1: return stereo::SQUARED_DIFFERENCE;
+      case 2: return stereo::CROSS_CORRELATION;
+      case 3: return stereo::CENSUS_TRANSFORM;
+      case 4: return stereo::TERNARY_CENSUS_TRANSFORM;
+      default: 
+        vw_throw( ArgumentErr() << "Unknown value " << stereo_settings().cost_mode << " for cost-mode.\n" );
+    };
+  }
+
+
+  // Read the search range from D_sub, and scale it to the full image
+  inline void read_search_range_from_dsub(ASPGlobalOptions & opt){
+
+    // No D_sub is generated or should be used for seed mode 0.
+    if (stereo_settings().seed_mode == 0)
+      return;
+
+    DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif"),
+                             Rmask(opt.out_prefix + "-rMask.tif");
+
+    DiskImageView<PixelGray<float> > left_sub ( opt.out_prefix+"-L_sub.tif" ),
+                                     right_sub( opt.out_prefix+"-R_sub.tif" );
+
+    Vector2 downsample_scale( double(left_sub.cols()) / double(Lmask.cols()),
+                              double(left_sub.rows()) / double(Lmask.rows()) );
+
+    std::string d_sub_file = opt.out_prefix + "-D_sub.tif";
+    if (!fs::exists(d_sub_file))
+      return;
+
+    ImageView<PixelMask<Vector2f> > sub_disp;
+    read_image(sub_disp, d_sub_file);
+    BBox2i search_range = stereo::get_disparity_range( sub_disp );
+    search_range.min() = floor(elem_quot(search_range.min(),downsample_scale));
+    search_range.max() = ceil (elem_quot(search_range.max(),downsample_scale));
+    stereo_settings().search_range = search_range;
+  }
+
+
+  /// This correlator takes a low resolution disparity image as an input
+  /// so that it may narrow its search range for each tile that is processed.
+  class SeededCorrelatorView : public ImageViewBase<SeededCorrelatorView> {
+    DiskImageView<PixelGray<float> >   m_left_image;
+    DiskImageView<PixelGray<float> >   m_right_image;
+    DiskImageView<vw::uint8> m_left_mask;
+    DiskImageView<vw::uint8> m_right_mask;
+    ImageViewRef<PixelMask<Vector2f> > m_sub_disp;
+    ImageViewRef<PixelMask<Vector2i> > m_sub_disp_spread;
+    ImageView<Matrix3x3> const& m_local_hom;
+
+    // Settings
+    Vector2  m_upscale_factor;
+    BBox2i   m_seed_bbox;
+    Vector2i m_kernel_size;
+    stereo::CostFunctionType m_cost_mode;
+    int      m_corr_timeout;
+    double   m_seconds_per_op;
+
+  public:
+
+    // Set these input types here instead of making them template arguments
+    typedef DiskImageView<PixelGray<float> >   ImageType;
+    typedef DiskImageView<vw::uint8>           MaskType;
+    typedef ImageViewRef<PixelMask<Vector2f> > DispSeedImageType;
+    typedef ImageViewRef<PixelMask<Vector2i> > SpreadImageType;
+    typedef ImageType::pixel_type InputPixelType;
+
+    SeededCorrelatorView( ImageType             const& left_image,
+                          ImageType             const& right_image,
+                          MaskType              const& left_mask,
+                          MaskType              const& right_mask,
+                          DispSeedImageType     const& sub_disp,
+                          SpreadImageType       const& sub_disp_spread,
+                          ImageView<Matrix3x3>  const& local_hom,
+                          Vector2i const& kernel_size,
+                          stereo::CostFunctionType cost_mode,
+                          int corr_timeout, double seconds_per_op) :
+      m_left_image(left_image.impl()), m_right_image(right_image.impl()),
+      m_left_mask (left_mask.impl ()), m_right_mask (right_mask.impl ()),
+      m_sub_disp(sub_disp.impl()), m_sub_disp_spread(sub_disp_spread.impl()),
+      m_local_hom(local_hom),
+      m_kernel_size(kernel_size),  m_cost_mode(cost_mode),
+      m_corr_timeout(corr_timeout), m_seconds_per_op(seconds_per_op){
+      m_upscale_factor[0] = double(m_left_image.cols()) / m_sub_disp.cols();
+      m_upscale_factor[1] = double(m_left_image.rows()) / m_sub_disp.rows();
+      m_seed_bbox = bounding_box( m_sub_disp );
+    }
+
+    // Image View interface
+    typedef PixelMask<Vector2f> pixel_type;
+    typedef pixel_type          result_type;
+    typedef ProceduralPixelAccessor<SeededCorrelatorView> pixel_accessor;
+
+    inline int32 cols  () const { return m_left_image.cols(); }
+    inline int32 rows  () const { return m_left_image.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+    inline pixel_type operator()(double /*i*/, double /*j*/, int32 /*p*/ = 0) const {
+      vw_throw(NoImplErr() << "SeededCorrelatorView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    /// Does the work
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+      bool use_local_homography = stereo_settings().use_local_homography;
+
+      Matrix<double> lowres_hom  = math::identity_matrix<3>();
+      Matrix<double> fullres_hom = math::identity_matrix<3>();
+      ImageViewRef<InputPixelType> right_trans_img;
+      ImageViewRef<vw::uint8     > right_trans_mask;
+
+      bool do_round = true; // round integer disparities after transform
+
+      // User strategies
+      BBox2f local_search_range;
+      if ( stereo_settings().seed_mode > 0 ) {
+
+        // The low-res version of bbox
+        BBox2i seed_bbox( elem_quot(bbox.min(), m_upscale_factor),
+  			                  elem_quot(bbox.max(), m_upscale_factor) );
+        seed_bbox.expand(1);
+        seed_bbox.crop( m_seed_bbox );
+        // Get the disparity range in d_sub corresponding to this tile.
+        VW_OUT(DebugMessage, "stereo") << "Getting disparity range for : " << seed_bbox << "\n";
+        DispSeedImageType disparity_in_box = crop( m_sub_disp, seed_bbox );
+
+        if (!use_local_homography){
+          local_search_range = stereo::get_disparity_range( disparity_in_box );
+        }else{ // seed_mode == 0
+          int ts = ASPGlobalOptions::corr_tile_size();
+          lowres_hom = m_local_hom(bbox.min().x()/ts, bbox.min().y()/ts);
+          local_search_range = stereo::get_disparity_range
+            (stereo::transform_disparities(do_round, seed_bbox,
+  			     lowres_hom, disparity_in_box));
+        }
+
+        bool has_sub_disp_spread = ( m_sub_disp_spread.cols() != 0 &&
+  			                             m_sub_disp_spread.rows() != 0 );
+        // Sanity check: If m_sub_disp_spread was provided, it better have the same size as sub_disp.
+        if ( has_sub_disp_spread &&
+             m_sub_disp_spread.cols() != m_sub_disp.cols() &&
+             m_sub_disp_spread.rows() != m_sub_disp.rows() ){
+          vw_throw( ArgumentErr() << "stereo_corr: D_sub and D_sub_spread must have equal sizes.\n");
+        }
+
+        if (has_sub_disp_spread){
+          // Expand the disparity range by m_sub_disp_spread.
+          SpreadImageType spread_in_box = crop( m_sub_disp_spread, seed_bbox );
+
+          if (!use_local_homography){
+            BBox2f spread = stereo::get_disparity_range( spread_in_box );
+            local_search_range.min() -= spread.max();
+            local_search_range.max() += spread.max();
+          }else{
+            DispSeedImageType upper_disp = stereo::transform_disparities(do_round, seed_bbox, lowres_hom,
+                                                                         disparity_in_box + spread_in_box);
+            DispSeedImageType lower_disp = stereo::transform_disparities(do_round, seed_bbox, lowres_hom,
+                                                                         disparity_in_box - spread_in_box);
+            BBox2f upper_range = stereo::get_disparity_range(upper_disp);
+            BBox2f lower_range = stereo::get_disparity_range(lower_disp);
+
+            local_search_range = upper_range;
+            local_search_range.grow(lower_range);
+          } //endif use_local_homography
+        } //endif has_sub_disp_spread
+
+        if (use_local_homography){
+          Vector3 upscale(     m_upscale_factor[0],     m_upscale_factor[1], 1 );
+          Vector3 dnscale( 1.0/m_upscale_factor[0], 1.0/m_upscale_factor[1], 1 );
+          fullres_hom = diagonal_matrix(upscale)*lowres_hom*diagonal_matrix(dnscale);
+
+          ImageViewRef< PixelMask<InputPixelType> >
+            right_trans_masked_img
+            = transform (copy_mask( m_right_image.impl(),
+  			          create_mask(m_right_mask.impl()) ),
+  	               HomographyTransform(fullres_hom),
+  	               m_left_image.impl().cols(), m_left_image.impl().rows());
+          right_trans_img  = apply_mask(right_trans_masked_img);
+          right_trans_mask = channel_cast_rescale<uint8>(select_channel(right_trans_masked_img, 1));
+        } //endif use_local_homography
+
+        local_search_range = grow_bbox_to_int(local_search_range);
+        // Expand local_search_range by 1. This is necessary since
+        // m_sub_disp is integer-valued, and perhaps the search
+        // range was supposed to be a fraction of integer bigger.
+        local_search_range.expand(1);
+
+        // Scale the search range to full-resolution
+        local_search_range.min() = floor(elem_prod(local_search_range.min(),m_upscale_factor));
+        local_search_range.max() = ceil (elem_prod(local_search_range.max(),m_upscale_factor));
+
+        VW_OUT(DebugMessage, "stereo") << "SeededCorrelatorView("
+  				     << bbox << ") search range "
+  				     << local_search_range << " vs "
+  				     << stereo_settings().search_range << "\n";
+
+      } else{
+        local_search_range = stereo_settings().search_range;
+        VW_OUT(DebugMessage,"stereo") << "Searching with "
+  				    << stereo_settings().search_range << "\n";
+      }
+
+      // Now we are ready to actually perform correlation
+      const int rm_half_kernel = 5; // Filter kernel size used by CorrelationView
+      if (use_local_homography){
+        typedef vw::stereo::PyramidCorrelationView<ImageType, ImageViewRef<InputPixelType>, 
+                                                   MaskType,  ImageViewRef<vw::uint8     > > CorrView;
+        CorrView corr_view( m_left_image,   right_trans_img,
+                            m_left_mask,    right_trans_mask,
+                            static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
+                            stereo_settings().slogW,
+                            local_search_range,
+                            m_kernel_size,  m_cost_mode,
+                            m_corr_timeout, m_seconds_per_op,
+                            stereo_settings().xcorr_threshold,
+                            rm_half_kernel,
+                            stereo_settings().corr_max_levels,
+                            static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
+                            stereo_settings().sgm_collar_size,
+                            stereo_settings().corr_blob_filter_area,
+                            SAVE_CORR_DEBUG );
+        return corr_view.prerasterize(bbox);
+      }else{
+        typedef vw::stereo::PyramidCorrelationView<ImageType, ImageType, MaskType, MaskType > CorrView;
+        CorrView corr_view( m_left_image,   m_right_image,
+                            m_left_mask,    m_right_mask,
+                            static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode),
+                            stereo_settings().slogW,
+                            local_search_range,
+                            m_kernel_size,  m_cost_mode,
+                            m_corr_timeout, m_seconds_per_op,
+                            stereo_settings().xcorr_threshold,
+                            rm_half_kernel,
+                            stereo_settings().corr_max_levels,
+                            static_cast<vw::stereo::CorrelationAlgorithm>(stereo_settings().stereo_algorithm), 
+                            stereo_settings().sgm_collar_size,
+                            stereo_settings().corr_blob_filter_area,
+                            SAVE_CORR_DEBUG );
+        return corr_view.prerasterize(bbox);
+      }
+
+    } // End function prerasterize_helper
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  }; // End class SeededCorrelatorView
+
+} // namespace asp
+
+#endif//__ASP_TOOLS_STEREO_CORR_H__
@@ -18,13 +18,9 @@
 
 /// \file stereo_fltr.cc
 ///
-#include <asp/Tools/stereo.h>
+#include <asp/Tools/stereo_fltr.h>
 
-#include <vw/Stereo/DisparityMap.h>
-#include <vw/Stereo/Algorithms.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
-#include <vw/Image/BlobIndex.h>
-#include <vw/Image/ErodeView.h>
 #include <vw/Image/InpaintView.h>
 
 #include <asp/Core/ThreadedEdgeMask.h>
@@ -39,210 +35,6 @@ namespace vw {
   template<> struct PixelFormatID<PixelMask<Vector<float, 5> > >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
 }
 
-
-
-
-/// Apply a set of smoothing filters to the subpixel disparity results.
-template <class ImageT, class DispImageT>
-class TextureAwareDisparityFilter: public ImageViewBase<TextureAwareDisparityFilter<ImageT, DispImageT> >{
-  ImageT     m_img;
-  DispImageT m_disp_img;
-  
-  int   m_median_filter_size;     ///< Step 1: Apply a median filter of this size
-  int   m_texture_smooth_range;   ///< Step 2: Compute texture measure of input image with this kernel size
-  float m_texture_max;            ///< Step 3: Perform texture-aware smoothing of the disparity.  m_texture_max
-  int   m_max_smooth_kernel_size; ///<         smooths more pixels, and the smooth_kernel_size increases the smoothing intensity.
-  
-public:
-  TextureAwareDisparityFilter( ImageViewBase<ImageT    > const& img,
-                               ImageViewBase<DispImageT> const& disp_img,
-                               int   median_filter_size,
-                               int   texture_smooth_range,
-                               float texture_max,
-                               int   max_smooth_kernel_size):
-    m_img(img.impl()), m_disp_img(disp_img.impl()),
-    m_median_filter_size(median_filter_size),
-    m_texture_smooth_range(texture_smooth_range),
-    m_texture_max(texture_max),
-    m_max_smooth_kernel_size(max_smooth_kernel_size)
-     {}
-
-  // Image View interface
-  typedef typename DispImageT::pixel_type pixel_type;
-  typedef pixel_type                      result_type;
-  typedef ProceduralPixelAccessor<TextureAwareDisparityFilter> pixel_accessor;
-
-  inline int32 cols  () const { return m_disp_img.cols(); }
-  inline int32 rows  () const { return m_disp_img.rows(); }
-  inline int32 planes() const { return 1; }
-
-  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
-
-  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
-    vw_throw(NoImplErr() << "TextureAwareDisparityFilter::operator()(...) is not implemented");
-    return pixel_type();
-  }
-
-  typedef CropView<ImageView<pixel_type> > prerasterize_type;
-  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
-
-    // Figure out the largest kernel expansion we need to support the filtering
-    int max_half_kernel = m_texture_smooth_range;
-    if (m_max_smooth_kernel_size > max_half_kernel)
-      max_half_kernel = m_max_smooth_kernel_size;
-    max_half_kernel = (max_half_kernel-1) / 2;
-
-    //std::cout << "Rasterizing input images...\n";
-    // Rasterize both input image regions
-    BBox2i bbox2 = bbox;
-    bbox2.expand(max_half_kernel);
-    bbox2.crop(bounding_box(m_img)); // Restrict to valid input area
-    //std::cout << "bbox2 = " << bbox2 << std::endl;
-    ImageView<typename ImageT::pixel_type> input_tile      = crop(m_img,      bbox2);
-    ImageView<pixel_type                 > input_disp_tile = crop(m_disp_img, bbox2);
-
-    //std::cout << "Generating texture image...\n";
-    ImageView<float> texture_image;
-    vw::stereo::texture_measure(input_tile, texture_image, m_texture_smooth_range);
-    //write_image( "texture_image.tif", texture_image );
-
-
-    ImageView<pixel_type > disp_tile_median;
-    vw::stereo::disparity_median_filter(input_disp_tile, disp_tile_median, m_median_filter_size);
-    
-    //std::cout << "Filtering disparity image...\n";
-    ImageView<pixel_type > disp_tile_filtered;
-    vw::stereo::texture_preserving_disparity_filter(disp_tile_median, disp_tile_filtered, texture_image, 
-                                                    m_texture_max, m_max_smooth_kernel_size);
-    //std::cout << "Done!\n";
-
-
-    // Fake the bounds on the returned image region
-    return prerasterize_type(disp_tile_filtered,
-                             -bbox2.min().x(), -bbox2.min().y(),
-                             cols(), rows() );
-  }
-
-  template <class DestT>
-  inline void rasterize(DestT const& dest, BBox2i bbox) const {
-    vw::rasterize(prerasterize(bbox), dest, bbox);
-  }
-};
-
-template <class ImageT, class DispImageT>
-TextureAwareDisparityFilter<ImageT, DispImageT>
-texture_aware_disparity_filter( ImageViewBase<ImageT    > const& img,
-                                ImageViewBase<DispImageT> const& disp_img,
-                                int   median_filter_size,
-                                int   texture_smooth_range,
-                                float texture_max,
-                                int   max_smooth_kernel_size) {
-  typedef TextureAwareDisparityFilter<ImageT, DispImageT> return_type;
-  return return_type(img.impl(), disp_img.impl(), median_filter_size, 
-                     texture_smooth_range, texture_max, max_smooth_kernel_size);
-}
-
-
-
-
-
-
-
-// Erode blobs from given image by iterating through tiles, biasing
-// each tile by a factor of blob size, removing blobs in the tile,
-// then shrinking the tile back. The bias is necessary to help avoid
-// fragmenting (and then unnecessarily removing) blobs.
-template <class ImageT>
-class PerTileErode: public ImageViewBase<PerTileErode<ImageT> >{
-  ImageT m_img;
-public:
-  PerTileErode( ImageViewBase<ImageT>   const& img):
-    m_img(img.impl()){}
-
-  // Image View interface
-  typedef typename ImageT::pixel_type pixel_type;
-  typedef pixel_type                  result_type;
-  typedef ProceduralPixelAccessor<PerTileErode> pixel_accessor;
-
-  inline int32 cols  () const { return m_img.cols(); }
-  inline int32 rows  () const { return m_img.rows(); }
-  inline int32 planes() const { return 1; }
-
-  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
-
-  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
-    vw_throw(NoImplErr() << "PerTileErode::operator()(...) is not implemented");
-    return pixel_type();
-  }
-
-  typedef CropView<ImageView<pixel_type> > prerasterize_type;
-  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
-
-    int area = stereo_settings().erode_max_size;
-
-    // We look a beyond the current tile, to avoid cutting blobs
-    // if possible. Skinny blobs will be cut though.
-    int bias = 2*int(ceil(sqrt(double(area))));
-
-    BBox2i bbox2 = bbox;
-    bbox2.expand(bias);
-    bbox2.crop(bounding_box(m_img));
-    ImageView<pixel_type> tile_img = crop(m_img, bbox2);
-
-    int tile_size = max(bbox2.width(), bbox2.height()); // don't subsplit
-    BlobIndexThreaded smallBlobIndex(tile_img, area, tile_size);
-    ImageView<pixel_type> clean_tile_img = applyErodeView(tile_img,
-                                                          smallBlobIndex);
-    return prerasterize_type(clean_tile_img,
-                             -bbox2.min().x(), -bbox2.min().y(),
-                             cols(), rows() );
-  }
-
-  template <class DestT>
-  inline void rasterize(DestT const& dest, BBox2i bbox) const {
-    vw::rasterize(prerasterize(bbox), dest, bbox);
-  }
-};
-
-template <class ImageT>
-PerTileErode<ImageT>
-per_tile_erode( ImageViewBase<ImageT> const& img) {
-  typedef PerTileErode<ImageT> return_type;
-  return return_type( img.impl() );
-}
-
-// Run several cleanup passes with desired cleanup mode.
-template <class ViewT>
-struct MultipleDisparityCleanUp {
-  typedef ImageViewRef< typename ViewT::pixel_type > result_type;
-
-  inline result_type operator()( ImageViewBase<ViewT> const& input, int N) {
-
-    result_type out = input;
-    for (int i = 0; i < N; i++){
-      int mode = stereo_settings().filter_mode;
-      if (mode == 1){
-        out = stereo::disparity_cleanup_using_mean
-          (out.impl(),
-           stereo_settings().rm_half_kernel.x(),
-           stereo_settings().rm_half_kernel.y(),
-           stereo_settings().max_mean_diff);
-      }else if (mode == 2){
-        out = stereo::disparity_cleanup_using_thresh
-          (out.impl(),
-           stereo_settings().rm_half_kernel.x(),
-           stereo_settings().rm_half_kernel.y(),
-           stereo_settings().rm_threshold,
-           stereo_settings().rm_min_matches/100.0);
-      }else
-        vw_throw( ArgumentErr() << "\nExpecting value of 1 or 2 for filter-mode. "
-                  << "Got: " << mode << "\n" );
-    }
-
-    return out;
-  }
-};
-
 template <class ImageT>
 void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
                                     ASPGlobalOptions const& opt ) {
@@ -425,30 +217,13 @@ void stereo_filtering( ASPGlobalOptions& opt ) {
                                                          bindex ), opt );
     } else { // mask_flatfield == false
       // No Erosion step
-      if ( stereo_settings().rm_cleanup_passes >= 1 ) {
-        // Apply an outlier removal filter
-        write_good_pixel_and_filtered
-          (stereo::disparity_mask
-            (MultipleDisparityCleanUp<input_type>()
-              (disparity_disk_image, stereo_settings().rm_cleanup_passes),
-               apply_mask(asp::threaded_edge_mask(left_mask, 0,mask_buffer,1024)),
-               apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024))),
-             opt);
-      }
-      else { // No cleanup passes
+      if ( stereo_settings().rm_cleanup_passes < 1 )
         std::cout << "Using smoothing filter!\n";
-        write_good_pixel_and_filtered
-          (stereo::disparity_mask
-            (
-             texture_aware_disparity_filter(left_disk_image, disparity_disk_image, 
-                                            stereo_settings().median_filter_size,
-                                            stereo_settings().disp_smooth_size+2, // Compute texture a little larger than smooth radius
-                                            stereo_settings().disp_smooth_texture, 
-                                            stereo_settings().disp_smooth_size),
-              apply_mask(asp::threaded_edge_mask(left_mask, 0,mask_buffer,1024)),
-              apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024))),
-            opt);
-      } // End cleanup passes check
+      write_good_pixel_and_filtered
+        (filter_disparity(left_disk_image, disparity_disk_image,
+                          apply_mask(asp::threaded_edge_mask(left_mask, 0,mask_buffer,1024)),
+                          apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024))),
+         opt);
     } // End mask_flatfield check
 
   } catch (IOErr const& e) {
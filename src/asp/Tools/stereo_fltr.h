@@ -0,0 +1,288 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file stereo_fltr.h
+///
+/// Disparity filters, shared by stereo_fltr and by the fused mode
+/// of stereo_tri.
+
+#ifndef __ASP_TOOLS_STEREO_FLTR_H__
+#define __ASP_TOOLS_STEREO_FLTR_H__
+
+#include <vw/Stereo/DisparityMap.h>
+#include <vw/Stereo/Algorithms.h>
+#include <vw/Image/BlobIndex.h>
+#include <vw/Image/ErodeView.h>
+#include <asp/Tools/stereo.h>
+
+namespace asp {
+
+  using namespace vw;
+
+
+  /// Apply a set of smoothing filters to the subpixel disparity results.
+  template <class ImageT, class DispImageT>
+  class TextureAwareDisparityFilter: public ImageViewBase<TextureAwareDisparityFilter<ImageT, DispImageT> >{
+    ImageT     m_img;
+    DispImageT m_disp_img;
+
+    int   m_median_filter_size;     ///< Step 1: Apply a median filter of this size
+    int   m_texture_smooth_range;   ///< Step 2: Compute texture measure of input image with this kernel size
+    float m_texture_max;            ///< Step 3: Perform texture-aware smoothing of the disparity.  m_texture_max
+    int   m_max_smooth_kernel_size; ///<         smooths more pixels, and the smooth_kernel_size increases the smoothing intensity.
+
+  public:
+    TextureAwareDisparityFilter( ImageViewBase<ImageT    > const& img,
+                                 ImageViewBase<DispImageT> const& disp_img,
+                                 int   median_filter_size,
+                                 int   texture_smooth_range,
+                                 float texture_max,
+                                 int   max_smooth_kernel_size):
+      m_img(img.impl()), m_disp_img(disp_img.impl()),
+      m_median_filter_size(median_filter_size),
+      m_texture_smooth_range(texture_smooth_range),
+      m_texture_max(texture_max),
+      m_max_smooth_kernel_size(max_smooth_kernel_size)
+       {}
+
+    // Image View interface
+    typedef typename DispImageT::pixel_type pixel_type;
+    typedef pixel_type                      result_type;
+    typedef ProceduralPixelAccessor<TextureAwareDisparityFilter> pixel_accessor;
+
+    inline int32 cols  () const { return m_disp_img.cols(); }
+    inline int32 rows  () const { return m_disp_img.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+    inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+      vw_throw(NoImplErr() << "TextureAwareDisparityFilter::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+      // Figure out the largest kernel expansion we need to support the filtering
+      int max_half_kernel = m_texture_smooth_range;
+      if (m_max_smooth_kernel_size > max_half_kernel)
+        max_half_kernel = m_max_smooth_kernel_size;
+      max_half_kernel = (max_half_kernel-1) / 2;
+
+      //std::cout << "Rasterizing input images...\n";
+      // Rasterize both input image regions
+      BBox2i bbox2 = bbox;
+      bbox2.expand(max_half_kernel);
+      bbox2.crop(bounding_box(m_img)); // Restrict to valid input area
+      //std::cout << "bbox2 = " << bbox2 << std::endl;
+      ImageView<typename ImageT::pixel_type> input_tile      = crop(m_img,      bbox2);
+      ImageView<pixel_type                 > input_disp_tile = crop(m_disp_img, bbox2);
+
+      //std::cout << "Generating texture image...\n";
+      ImageView<float> texture_image;
+      vw::stereo::texture_measure(input_tile, texture_image, m_texture_smooth_range);
+      //write_image( "texture_image.tif", texture_image );
+
+
+      ImageView<pixel_type > disp_tile_median;
+      vw::stereo::disparity_median_filter(input_disp_tile, disp_tile_median, m_median_filter_size);
+
+      //std::cout << "Filtering disparity image...\n";
+      ImageView<pixel_type > disp_tile_filtered;
+      vw::stereo::texture_preserving_disparity_filter(disp_tile_median, disp_tile_filtered, texture_image, 
+                                                      m_texture_max, m_max_smooth_kernel_size);
+      //std::cout << "Done!\n";
+
+
+      // Fake the bounds on the returned image region
+      return prerasterize_type(disp_tile_filtered,
+                               -bbox2.min().x(), -bbox2.min().y(),
+                               cols(), rows() );
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  template <class ImageT, class DispImageT>
+  TextureAwareDisparityFilter<ImageT, DispImageT>
+  texture_aware_disparity_filter( ImageViewBase<ImageT    > const& img,
+                                  ImageViewBase<DispImageT> const& disp_img,
+                                  int   median_filter_size,
+                                  int   texture_smooth_range,
+                                  float texture_max,
+                                  int   max_smooth_kernel_size) {
+    typedef TextureAwareDisparityFilter<ImageT, DispImageT> return_type;
+    return return_type(img.impl(), disp_img.impl(), median_filter_size, 
+                       texture_smooth_range, texture_max, max_smooth_kernel_size);
+  }
+
+
+  /// How far beyond a tile the blob erosion looks, to avoid cutting
+  /// blobs if possible. Skinny blobs will be cut though.
+  inline int erode_bias() {
+    int area = stereo_settings().erode_max_size;
+    if (area <= 0)
+      return 0;
+    return 2*int(ceil(sqrt(double(area))));
+  }
+
+
+  // Erode blobs from given image by iterating through tiles, biasing
+  // each tile by a factor of blob size, removing blobs in the tile,
+  // then shrinking the tile back. The bias is necessary to help avoid
+  // fragmenting (and then unnecessarily removing) blobs.
+  template <class ImageT>
+  class PerTileErode: public ImageViewBase<PerTileErode<ImageT> >{
+    ImageT m_img;
+  public:
+    PerTileErode( ImageViewBase<ImageT>   const& img):
+      m_img(img.impl()){}
+
+    // Image View interface
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type                  result_type;
+    typedef ProceduralPixelAccessor<PerTileErode> pixel_accessor;
+
+    inline int32 cols  () const { return m_img.cols(); }
+    inline int32 rows  () const { return m_img.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+    inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+      vw_throw(NoImplErr() << "PerTileErode::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+      int area = stereo_settings().erode_max_size;
+      int bias = erode_bias();
+
+      BBox2i bbox2 = bbox;
+      bbox2.expand(bias);
+      bbox2.crop(bounding_box(m_img));
+      ImageView<pixel_type> tile_img = crop(m_img, bbox2);
+
+      int tile_size = std::max(bbox2.width(), bbox2.height()); // don't subsplit
+      BlobIndexThreaded smallBlobIndex(tile_img, area, tile_size);
+      ImageView<pixel_type> clean_tile_img = applyErodeView(tile_img,
+                                                            smallBlobIndex);
+      return prerasterize_type(clean_tile_img,
+                               -bbox2.min().x(), -bbox2.min().y(),
+                               cols(), rows() );
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  template <class ImageT>
+  PerTileErode<ImageT>
+  per_tile_erode( ImageViewBase<ImageT> const& img) {
+    typedef PerTileErode<ImageT> return_type;
+    return return_type( img.impl() );
+  }
+
+  // Run several cleanup passes with desired cleanup mode.
+  template <class ViewT>
+  struct MultipleDisparityCleanUp {
+    typedef ImageViewRef< typename ViewT::pixel_type > result_type;
+
+    inline result_type operator()( ImageViewBase<ViewT> const& input, int N) {
+
+      result_type out = input;
+      for (int i = 0; i < N; i++){
+        int mode = stereo_settings().filter_mode;
+        if (mode == 1){
+          out = stereo::disparity_cleanup_using_mean
+            (out.impl(),
+             stereo_settings().rm_half_kernel.x(),
+             stereo_settings().rm_half_kernel.y(),
+             stereo_settings().max_mean_diff);
+        }else if (mode == 2){
+          out = stereo::disparity_cleanup_using_thresh
+            (out.impl(),
+             stereo_settings().rm_half_kernel.x(),
+             stereo_settings().rm_half_kernel.y(),
+             stereo_settings().rm_threshold,
+             stereo_settings().rm_min_matches/100.0);
+        }else
+          vw_throw( ArgumentErr() << "\nExpecting value of 1 or 2 for filter-mode. "
+                    << "Got: " << mode << "\n" );
+      }
+
+      return out;
+    }
+  };
+
+  /// The number of pixels around a tile of the filtered disparity
+  /// which filter_disparity() reads from the input disparity, before
+  /// the blob erosion.
+  inline int disparity_filter_collar() {
+    int passes = stereo_settings().rm_cleanup_passes;
+    if (stereo_settings().filter_mode == 0)
+      passes = 0;
+    if (passes >= 1)
+      return passes*max(stereo_settings().rm_half_kernel);
+
+    // The texture aware filter
+    int smooth_size = stereo_settings().disp_smooth_size;
+    return (smooth_size + 1)/2 + stereo_settings().median_filter_size/2;
+  }
+
+  /// The filtering done by stereo_fltr, without the blob erosion, hole
+  /// filling, and Apollo flat-field masking. The edge masks are the
+  /// left and right image masks eroded by the mask buffer.
+  template <class ImageT, class DispT>
+  ImageViewRef<PixelMask<Vector2f> >
+  filter_disparity(ImageViewBase<ImageT> const& left_image,
+                   ImageViewBase<DispT > const& disparity,
+                   ImageViewRef<vw::uint8> const& left_edge_mask,
+                   ImageViewRef<vw::uint8> const& right_edge_mask) {
+
+    // If the user wants to do no filtering at all, that amounts
+    // to doing no passes.
+    int passes = stereo_settings().rm_cleanup_passes;
+    if (stereo_settings().filter_mode == 0)
+      passes = 0;
+
+    // Apply an outlier removal filter
+    if (passes >= 1)
+      return stereo::disparity_mask(MultipleDisparityCleanUp<DispT>()(disparity.impl(), passes),
+                                    left_edge_mask, right_edge_mask);
+
+    return stereo::disparity_mask
+      (texture_aware_disparity_filter(left_image.impl(), disparity.impl(),
+                                      stereo_settings().median_filter_size,
+                                      stereo_settings().disp_smooth_size+2, // Compute texture a little larger than smooth radius
+                                      stereo_settings().disp_smooth_texture,
+                                      stereo_settings().disp_smooth_size),
+       left_edge_mask, right_edge_mask);
+  }
+
+} // namespace asp
+
+#endif//__ASP_TOOLS_STEREO_FLTR_H__
@@ -126,6 +126,8 @@ int main( int argc, char* argv[] ) {
       vw_out() << "collar_size," << 0 << endl;
     else
       vw_out() << "collar_size," << stereo_settings().sgm_collar_size << endl;
+    vw_out() << "fuse_stages," << stereo_settings().fuse_stages << endl;
+    vw_out() << "blend_all_tiles," << stereo_settings().blend_all_tiles << endl;
 
     // This block of code should be in its own executable but I am
     // reluctant to create one just for it. This functionality will be
@@ -19,13 +19,7 @@
 /// \file stereo_rfne.cc
 ///
 
-#include <asp/Tools/stereo.h>
-#include <vw/Stereo/PreFilter.h>
-#include <vw/Stereo/CostFunctions.h>
-#include <vw/Stereo/SubpixelView.h>
-#include <vw/Stereo/EMSubpixelCorrelatorView.h>
-#include <vw/Stereo/DisparityMap.h>
-#include <asp/Core/LocalHomography.h>
+#include <asp/Tools/stereo_rfne.h>
 #include <asp/Sessions/StereoSession.h>
 #include <xercesc/util/PlatformUtils.hpp>
 
@@ -34,251 +28,6 @@ using namespace vw::stereo;
 using namespace asp;
 using namespace std;
 
-namespace vw {
-  template<> struct PixelFormatID<PixelMask<Vector<float, 5> > >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
-}
-
-template <class Image1T, class Image2T>
-ImageViewRef<PixelMask<Vector2f> >
-refine_disparity(Image1T const& left_image,
-                 Image2T const& right_image,
-                 ImageViewRef< PixelMask<Vector2f> > const& integer_disp,
-                 ASPGlobalOptions const& opt, bool verbose){
-
-  ImageViewRef<PixelMask<Vector2f> > refined_disp = integer_disp;
-
-  PrefilterModeType prefilter_mode = 
-    static_cast<vw::stereo::PrefilterModeType>(stereo_settings().pre_filter_mode);
-
-  if (stereo_settings().subpixel_mode == 0) {
-    // Do nothing
-    if (verbose)
-      vw_out() << "\t--> Skipping subpixel mode.\n";
-  }
-  if (stereo_settings().subpixel_mode == 1) {
-    // Parabola
-    
-    if (verbose) {
-      vw_out() << "\t--> Using parabola subpixel mode.\n";
-      if (stereo_settings().pre_filter_mode == 2)
-        vw_out() << "\t--> Using LOG pre-processing filter with "
-                 << stereo_settings().slogW << " sigma blur.\n";
-      else if (stereo_settings().pre_filter_mode == 1)
-        vw_out() << "\t--> Using Subtracted Mean pre-processing filter with "
-                 << stereo_settings().slogW << " sigma blur.\n";
-      else
-        vw_out() << "\t--> NO preprocessing" << endl;
-    } 
-    
-    refined_disp = parabola_subpixel( integer_disp,
-                                      left_image, right_image,
-                                      prefilter_mode, stereo_settings().slogW,
-                                      stereo_settings().subpixel_kernel );
-    
-  } // End parabola cases
-  if (stereo_settings().subpixel_mode == 2) {
-    // Bayes EM
-    if (verbose){
-      vw_out() << "\t--> Using affine adaptive subpixel mode\n";
-      vw_out() << "\t--> Forcing use of LOG filter with "
-               << stereo_settings().slogW << " sigma blur.\n";
-    }
-    refined_disp =
-      bayes_em_subpixel( integer_disp,
-                         left_image, right_image,
-                         prefilter_mode, stereo_settings().slogW,
-                         stereo_settings().subpixel_kernel,
-                         stereo_settings().subpixel_max_levels );
-
-  } // End Bayes EM cases
-  if (stereo_settings().subpixel_mode == 3) {
-    // Fast affine
-    if (verbose){
-      vw_out() << "\t--> Using affine subpixel mode\n";
-      vw_out() << "\t--> Forcing use of LOG filter with "
-               << stereo_settings().slogW << " sigma blur.\n";
-    }
-    refined_disp =
-      affine_subpixel( integer_disp,
-                       left_image, right_image,
-                       prefilter_mode, stereo_settings().slogW,
-                       stereo_settings().subpixel_kernel,
-                       stereo_settings().subpixel_max_levels );
-
-  } // End Fast affine cases
-  if (stereo_settings().subpixel_mode == 4) {
-    // Lucas-Kanade
-    if (verbose){
-      vw_out() << "\t--> Using Lucas-Kanade subpixel mode\n";
-      vw_out() << "\t--> Forcing use of LOG filter with "
-               << stereo_settings().slogW << " sigma blur.\n";
-    }
-    refined_disp =
-      lk_subpixel( integer_disp,
-                   left_image, right_image,
-                   prefilter_mode, stereo_settings().slogW,
-                   stereo_settings().subpixel_kernel,
-                   stereo_settings().subpixel_max_levels );
-
-  } // End Lucas-Kanade cases
-  if (stereo_settings().subpixel_mode == 5) {
-    // Affine and Bayes subpixel refinement always use the LogPreprocessingFilter...
-    if (verbose){
-      vw_out() << "\t--> Using EM Subpixel mode "
-               << stereo_settings().subpixel_mode << endl;
-      vw_out() << "\t--> Mode 3 does internal preprocessing;"
-               << " settings will be ignored. " << endl;
-    }
-
-    typedef stereo::EMSubpixelCorrelatorView<float32> EMCorrelator;
-    EMCorrelator em_correlator(channels_to_planes(left_image),
-                               channels_to_planes(right_image),
-                               pixel_cast<PixelMask<Vector2f> >(integer_disp), -1);
-    em_correlator.set_em_iter_max   (stereo_settings().subpixel_em_iter       );
-    em_correlator.set_inner_iter_max(stereo_settings().subpixel_affine_iter   );
-    em_correlator.set_kernel_size   (stereo_settings().subpixel_kernel        );
-    em_correlator.set_pyramid_levels(stereo_settings().subpixel_pyramid_levels);
-
-    DiskImageResourceOpenEXR em_disparity_map_rsrc(opt.out_prefix + "-F6.exr", em_correlator.format());
-
-    block_write_image(em_disparity_map_rsrc, em_correlator,
-                      TerminalProgressCallback("asp", "\t--> EM Refinement :"));
-
-    DiskImageResource *em_disparity_map_rsrc_2 =
-      DiskImageResourceOpenEXR::construct_open(opt.out_prefix + "-F6.exr");
-    DiskImageView<PixelMask<Vector<float, 5> > > em_disparity_disk_image(em_disparity_map_rsrc_2);
-
-    ImageViewRef<Vector<float, 3> > disparity_uncertainty =
-      per_pixel_filter(em_disparity_disk_image,
-                       EMCorrelator::ExtractUncertaintyFunctor());
-    ImageViewRef<float> spectral_uncertainty =
-      per_pixel_filter(disparity_uncertainty,
-                       EMCorrelator::SpectralRadiusUncertaintyFunctor());
-    write_image(opt.out_prefix+"-US.tif", spectral_uncertainty);
-    write_image(opt.out_prefix+"-U.tif", disparity_uncertainty);
-
-    refined_disp =
-      per_pixel_filter(em_disparity_disk_image,
-                       EMCorrelator::ExtractDisparityFunctor());
-  } // End EM subpixel cases 
-  if ((stereo_settings().subpixel_mode < 0) || (stereo_settings().subpixel_mode > 5)){
-    if (verbose) {
-      vw_out() << "\t--> Invalid Subpixel mode selection: " << stereo_settings().subpixel_mode << endl;
-      vw_out() << "\t--> Doing nothing\n";
-    }
-  }
-
-  return refined_disp;
-}
-
-// Perform refinement in each tile. If using local homography,
-// apply the local homography transform for the given tile
-// to the right image before doing refinement in that tile.
-template <class Image1T, class Image2T, class SeedDispT>
-class PerTileRfne: public ImageViewBase<PerTileRfne<Image1T, Image2T, SeedDispT> >{
-  Image1T              m_left_image;
-  Image2T              m_right_image;
-  ImageViewRef<uint8>  m_right_mask;
-  SeedDispT            m_integer_disp;
-  SeedDispT            m_sub_disp;
-  ImageView<Matrix3x3> m_local_hom;
-  ASPGlobalOptions const&       m_opt;
-  Vector2              m_upscale_factor;
-
-public:
-  PerTileRfne( ImageViewBase<Image1T>   const& left_image,
-               ImageViewBase<Image2T>   const& right_image,
-               ImageViewRef <uint8>     const& right_mask,
-               ImageViewBase<SeedDispT> const& integer_disp,
-               ImageViewBase<SeedDispT> const& sub_disp,
-               ImageView    <Matrix3x3> const& local_hom,
-               ASPGlobalOptions const& opt):
-    m_left_image(left_image.impl()), m_right_image(right_image.impl()),
-    m_right_mask(right_mask),
-    m_integer_disp( integer_disp.impl() ), m_sub_disp( sub_disp.impl() ),
-    m_local_hom(local_hom), m_opt(opt){
-
-    m_upscale_factor = Vector2(double(m_left_image.impl().cols()) / m_sub_disp.cols(),
-                               double(m_left_image.impl().rows()) / m_sub_disp.rows());
-  }
-
-  // Image View interface
-  typedef PixelMask<Vector2f>                  pixel_type;
-  typedef pixel_type                           result_type;
-  typedef ProceduralPixelAccessor<PerTileRfne> pixel_accessor;
-
-  inline int32 cols  () const { return m_left_image.cols(); }
-  inline int32 rows  () const { return m_left_image.rows(); }
-  inline int32 planes() const { return 1; }
-
-  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
-
-  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
-    vw_throw(NoImplErr() << "PerTileRfne::operator()(...) is not implemented");
-    return pixel_type();
-  }
-
-  typedef CropView<ImageView<pixel_type> > prerasterize_type;
-  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
-
-    ImageView<pixel_type> tile_disparity;
-    bool verbose = false;
-    if (stereo_settings().seed_mode > 0 && stereo_settings().use_local_homography){
-
-      int ts = ASPGlobalOptions::corr_tile_size();
-      Matrix<double>  lowres_hom = m_local_hom(bbox.min().x()/ts, bbox.min().y()/ts);
-      Vector3 upscale( m_upscale_factor[0],     m_upscale_factor[1],     1 );
-      Vector3 dnscale( 1.0/m_upscale_factor[0], 1.0/m_upscale_factor[1], 1 );
-      Matrix<double>  fullres_hom = diagonal_matrix(upscale)*lowres_hom*diagonal_matrix(dnscale);
-
-      // Must transform the right image by the local disparity
-      // to be in the same conditions as for stereo correlation.
-      typedef typename Image2T::pixel_type right_pix_type;
-      ImageViewRef< PixelMask<right_pix_type> > right_trans_masked_img
-        = transform (copy_mask( m_right_image.impl(), create_mask(m_right_mask) ),
-                     HomographyTransform(fullres_hom),
-                     m_left_image.impl().cols(), m_left_image.impl().rows());
-      ImageViewRef<right_pix_type> right_trans_img = apply_mask(right_trans_masked_img);
-
-
-      tile_disparity = crop(refine_disparity(m_left_image, right_trans_img,
-                                             m_integer_disp, m_opt, verbose), bbox);
-
-      // Must undo the local homography transform
-      bool do_round = false; // don't round floating point disparities
-      tile_disparity = transform_disparities(do_round, bbox, inverse(fullres_hom),
-                                             tile_disparity);
-
-    }else{
-      tile_disparity = crop(refine_disparity(m_left_image, m_right_image,
-                                             m_integer_disp, m_opt, verbose), bbox);
-    }
-    
-    prerasterize_type disparity = prerasterize_type(tile_disparity,
-                                                    -bbox.min().x(), -bbox.min().y(),
-                                                    cols(), rows() );
-    return disparity;
-  }
-
-  template <class DestT>
-  inline void rasterize(DestT const& dest, BBox2i bbox) const {
-    vw::rasterize(prerasterize(bbox), dest, bbox);
-  }
-};
-
-template <class Image1T, class Image2T, class SeedDispT>
-PerTileRfne<Image1T, Image2T, SeedDispT>
-per_tile_rfne( ImageViewBase<Image1T  > const& left,
-               ImageViewBase<Image2T  > const& right,
-               ImageViewRef<uint8     > const& right_mask,
-               ImageViewBase<SeedDispT> const& integer_disp,
-               ImageViewBase<SeedDispT> const& sub_disp,
-               ImageView<Matrix3x3    > const& local_hom,
-               ASPGlobalOptions const& opt) {
-  typedef PerTileRfne<Image1T, Image2T, SeedDispT> return_type;
-  return return_type( left.impl(), right.impl(), right_mask,
-                      integer_disp.impl(), sub_disp.impl(), local_hom, opt );
-}
 
 void stereo_refinement( ASPGlobalOptions const& opt ) {
 
@@ -312,7 +61,7 @@ void stereo_refinement( ASPGlobalOptions const& opt ) {
          stereo_settings().use_local_homography ){
       sub_disp = DiskImageView<PixelMask<Vector2f> >(opt.out_prefix+"-D_sub.tif");
 
-      string local_hom_file = opt.out_prefix + "-local_hom.txt";
+      string local_hom_file = opt.out_prefix + "-local_hom.bin";
       read_local_homographies(local_hom_file, local_hom);
     }
 
@@ -394,7 +143,12 @@ int main(int argc, char* argv[]) {
 
     // Internal Processes
     //---------------------------------------------------------
-    stereo_refinement( opt );
+    if (stereo_settings().tile_worker) {
+      while (read_worker_tile(opt))
+        stereo_refinement( opt );
+    } else {
+      stereo_refinement( opt );
+    }
 
     vw_out() << "\n[ " << current_posix_time_string()
              << " ] : REFINEMENT FINISHED \n";
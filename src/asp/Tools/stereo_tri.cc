@@ -27,8 +27,12 @@
 
 #include <asp/Camera/RPCModel.h>
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/stereo_corr.h>
+#include <asp/Tools/stereo_rfne.h>
+#include <asp/Tools/stereo_fltr.h>
 #include <asp/Tools/jitter_adjust.h>
 #include <asp/Tools/ccd_adjust.h>
+#include <asp/Core/ThreadedEdgeMask.h>
 
 // We must have the implementations of all sessions for triangulation
 #include <asp/Sessions/StereoSessionFactory.h>
@@ -49,11 +53,12 @@ using namespace std;
 // These are used to read and write tif images with vector pixels
 namespace vw {
   typedef Vector<double, 6> Vector6;
-  template<> struct PixelFormatID<PixelMask<Vector<float, 5> > >  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
   template<> struct PixelFormatID<Vector<double, 6> >  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
   template<> struct PixelFormatID<Vector<double, 4> >  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
   template<> struct PixelFormatID<Vector<float,  6> >  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
   template<> struct PixelFormatID<Vector<float,  4> >  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
+  template<> struct PixelFormatID<Vector<int32,  6> >  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
+  template<> struct PixelFormatID<Vector<int32,  4> >  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
   template<> struct PixelFormatID<Vector<float,  2> >  { static const PixelFormatEnum value = VW_PIXEL_GENERIC_2_CHANNEL; };
 }
 
@@ -282,6 +287,162 @@ void compute_matches_from_disp(vector<DisparityT> const& disparities,
   ip::write_binary_match_file(match_file, left_ip, right_ip);
 }
 
+/// With --fuse-stages, produce the filtered disparity of each tile
+/// directly from correlation, refinement, and filtering, instead of
+/// reading F.tif. Each stage is computed in memory over the tile
+/// grown by the collar the stages after it read. The result is
+/// equivalent to running the stages separately up to tiling effects,
+/// as the correlation search range and pyramid depth depend on the
+/// region being correlated.
+class FusedDisparityView : public ImageViewBase<FusedDisparityView> {
+  DiskImageView<PixelGray<float> >   m_left_image, m_right_image;
+  DiskImageView<vw::uint8>           m_left_mask,  m_right_mask;
+  ImageViewRef<vw::uint8>            m_left_edge_mask, m_right_edge_mask;
+  ImageViewRef<PixelMask<Vector2f> > m_sub_disp;
+  ImageViewRef<PixelMask<Vector2i> > m_sub_disp_spread;
+  ImageView<Matrix3x3>               m_local_hom; // Not used, see fused_stages_checks()
+  ASPGlobalOptions const&            m_opt;
+  stereo::CostFunctionType           m_cost_mode;
+  double                             m_seconds_per_op;
+
+public:
+  typedef PixelMask<Vector2f> pixel_type;
+  typedef pixel_type          result_type;
+  typedef ProceduralPixelAccessor<FusedDisparityView> pixel_accessor;
+
+  FusedDisparityView(ASPGlobalOptions const& opt):
+    m_left_image (opt.out_prefix + "-L.tif"),     m_right_image(opt.out_prefix + "-R.tif"),
+    m_left_mask  (opt.out_prefix + "-lMask.tif"), m_right_mask (opt.out_prefix + "-rMask.tif"),
+    m_opt(opt), m_cost_mode(get_cost_mode_value()), m_seconds_per_op(0.0) {
+
+    std::string dsub_file   = opt.out_prefix + "-D_sub.tif";
+    std::string spread_file = opt.out_prefix + "-D_sub_spread.tif";
+    if (stereo_settings().seed_mode > 0)
+      m_sub_disp = DiskImageView<PixelMask<Vector2f> >(dsub_file);
+    if (stereo_settings().seed_mode == 2 || stereo_settings().seed_mode == 3){
+      // D_sub_spread is mandatory for seed_mode 2 and 3.
+      m_sub_disp_spread = DiskImageView<PixelMask<Vector2i> >(spread_file);
+    }else if (stereo_settings().seed_mode == 1 && fs::exists(spread_file)){
+      // D_sub_spread is optional for seed_mode 1, we use it only if it is provided.
+      try {
+        m_sub_disp_spread = DiskImageView<PixelMask<Vector2i> >(spread_file);
+      }
+      catch (...) {}
+    }
+
+    if (stereo_settings().corr_timeout > 0)
+      m_seconds_per_op = calc_seconds_per_op(m_cost_mode, m_left_image, m_right_image,
+                                             stereo_settings().corr_kernel);
+
+    // The edge masks are found over the entire image, so do it once here.
+    // As in stereo_fltr, use new mask files for these.
+    int32 mask_buffer = stereo_settings().mask_buffer_size;
+    if (mask_buffer < 0) // If Unset, set to the subpixel kernel size.
+      mask_buffer = max( stereo_settings().subpixel_kernel );
+    DiskImageView<vw::uint8> left_mask (opt.out_prefix + "-lMask.tif");
+    DiskImageView<vw::uint8> right_mask(opt.out_prefix + "-rMask.tif");
+    m_left_edge_mask  = apply_mask(asp::threaded_edge_mask(left_mask, 0,mask_buffer,1024));
+    m_right_edge_mask = apply_mask(asp::threaded_edge_mask(right_mask,0,mask_buffer,1024));
+  }
+
+  inline int32 cols  () const { return m_left_image.cols(); }
+  inline int32 rows  () const { return m_left_image.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "FusedDisparityView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    // The erosion reads its input around the tile, and the filters
+    // read the refined disparity around that.
+    BBox2i filter_box = bbox;
+    filter_box.expand(erode_bias());
+    filter_box.crop(bounding_box(*this));
+    BBox2i corr_box = filter_box;
+    corr_box.expand(disparity_filter_collar());
+    corr_box.crop(bounding_box(*this));
+
+    // Correlation and refinement. Refinement does not look beyond
+    // the pixels it refines.
+    SeededCorrelatorView correlator(m_left_image, m_right_image, m_left_mask, m_right_mask,
+                                    m_sub_disp, m_sub_disp_spread, m_local_hom,
+                                    stereo_settings().corr_kernel, m_cost_mode,
+                                    stereo_settings().corr_timeout, m_seconds_per_op);
+    ImageView<pixel_type> integer_disp = crop(correlator, corr_box);
+    ImageView<pixel_type> refined_disp
+      = crop(per_tile_rfne(m_left_image, m_right_image, m_right_mask,
+                           full_size(integer_disp, corr_box), m_sub_disp, m_local_hom, m_opt),
+             corr_box);
+
+    // Filtering, and then blob erosion
+    ImageView<pixel_type> filtered_disp
+      = crop(filter_disparity(m_left_image, full_size(refined_disp, corr_box),
+                              m_left_edge_mask, m_right_edge_mask),
+             filter_box);
+    ImageView<pixel_type> tile_disp;
+    if (stereo_settings().erode_max_size > 0)
+      tile_disp = crop(per_tile_erode(full_size(filtered_disp, filter_box)), bbox);
+    else
+      tile_disp = crop(full_size(filtered_disp, filter_box), bbox);
+
+    return prerasterize_type(tile_disp, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+
+private:
+  /// Pretend an in-memory tile covering the given box is the entire
+  /// image. Pixels outside the box are invalid.
+  ImageViewRef<pixel_type> full_size(ImageView<pixel_type> const& tile, BBox2i const& box) const {
+    return crop(edge_extend(tile, ZeroEdgeExtension()),
+                -box.min().x(), -box.min().y(), cols(), rows());
+  }
+}; // End class FusedDisparityView
+
+/// Throw if any of the stereo settings needs the correlation,
+/// refinement, or filtering of the entire image at once, which
+/// --fuse-stages cannot do.
+void fused_stages_checks(vector<ASPGlobalOptions> const& opt_vec) {
+
+  if (opt_vec.size() > 1)
+    vw_throw( ArgumentErr() << "The option --fuse-stages is not supported "
+                            << "for multiview triangulation.\n" );
+  if (stereo_settings().seed_mode == 0 && !stereo_settings().is_search_defined())
+    vw_throw( ArgumentErr() << "With --fuse-stages and --corr-seed-mode 0, "
+                            << "the search range must be set with --corr-search.\n" );
+  if (stereo_settings().seed_mode > 0 && !fs::exists(opt_vec[0].out_prefix + "-D_sub.tif"))
+    vw_throw( ArgumentErr() << "The option --fuse-stages needs the low-resolution "
+                            << "disparity: " << opt_vec[0].out_prefix + "-D_sub.tif\n" );
+
+  // SGM and MGM need a collar around each tile and blending of the
+  // tiles, which the fused stages do not do, so there would be seams.
+  std::string bad_option;
+  if (stereo_settings().stereo_algorithm > vw::stereo::CORRELATION_WINDOW)
+    bad_option = "SGM or MGM (--stereo-algorithm 1, 2, or 3)";
+  if (stereo_settings().use_local_homography)
+    bad_option = "--corr-seed-mode with local homography";
+  if (stereo_settings().subpixel_mode == 5)
+    bad_option = "--subpixel-mode 5";
+  if (stereo_settings().enable_fill_holes)
+    bad_option = "--enable-fill-holes";
+  if (stereo_settings().mask_flatfield)
+    bad_option = "--mask-flatfield";
+  if (stereo_settings().image_lines_per_piecewise_adjustment > 0)
+    bad_option = "--image-lines-per-piecewise-adjustment";
+  if (bad_option != "")
+    vw_throw( ArgumentErr() << "The option --fuse-stages cannot be used with "
+                            << bad_option << ".\n" );
+}
+
 namespace asp{
 
   // TODO: Move some of these functions to a class or something!
@@ -315,9 +476,44 @@ namespace asp{
     bool has_nodata = false;
     double nodata = -std::numeric_limits<float>::max(); // smallest float
 
-    // TODO: Replace this with with a function call!
-    if ( (opt.session->name() == "isis") || (opt.session->name() == "isismapisis")){
-      // ISIS does not support multi-threading
+    if (stereo_settings().save_quantized_point_cloud){
+
+      // Store the points relative to the cloud center as integer
+      // multiples of the rounding error. Unlike floats, the
+      // precision does not degrade away from the center, and
+      // integers compress well with horizontal differencing.
+      if (shift == Vector3())
+        vw_throw( ArgumentErr() << "Cannot save a quantized point cloud "
+                  << "without the point cloud center.\n" );
+      double scale = get_rounding_error(shift, stereo_settings().point_cloud_rounding_error);
+
+      std::map<std::string, std::string> keywords;
+      keywords[ASP_POINT_OFFSET_TAG_STR] = vec_to_str(shift);
+      std::ostringstream os;
+      os.precision(17);
+      os << scale;
+      keywords[ASP_POINT_SCALE_TAG_STR] = os.str();
+
+      vw::cartography::GdalWriteOptions opt_pred = opt;
+      opt_pred.gdal_options["PREDICTOR"] = "2";
+
+      if (!opt.session->supports_multi_threading()){
+        write_gdal_image(point_cloud_file,
+                         asp::quantize_image_pixels(point_cloud, shift, scale),
+                         has_georef, georef, has_nodata, nodata, opt_pred,
+                         TerminalProgressCallback("asp", "\t--> Triangulating: "),
+                         keywords);
+      }else{
+        block_write_gdal_image(point_cloud_file,
+                               asp::quantize_image_pixels(point_cloud, shift, scale),
+                               has_georef, georef, has_nodata, nodata, opt_pred,
+                               TerminalProgressCallback("asp", "\t--> Triangulating: "),
+                               keywords);
+      }
+      return;
+    }
+
+    if (!opt.session->supports_multi_threading()){
       asp::write_approx_gdal_image
         ( point_cloud_file, shift,
           stereo_settings().point_cloud_rounding_error,
@@ -505,7 +701,10 @@ void stereo_triangulation( string          const& output_prefix,
 
     vector<PVImageT> disparity_maps;
     for (int p = 0; p < (int)opt_vec.size(); p++){
-      disparity_maps.push_back(opt_vec[p].session->pre_pointcloud_hook(opt_vec[p].out_prefix+"-F.tif"));
+      if (stereo_settings().fuse_stages)
+        disparity_maps.push_back(FusedDisparityView(opt_vec[p]));
+      else
+        disparity_maps.push_back(opt_vec[p].session->pre_pointcloud_hook(opt_vec[p].out_prefix+"-F.tif"));
     }
 
     // Piecewise adjustments for jitter
@@ -516,7 +715,7 @@ void stereo_triangulation( string          const& output_prefix,
       compute_matches_from_disp(disparity_maps, transforms, match_file);
 
       int num_threads = opt_vec[0].num_threads;
-      if (opt_vec[0].session->name() == "isis" || opt_vec[0].session->name() == "isismapisis")
+      if (!opt_vec[0].session->supports_multi_threading())
         num_threads = 1;
       asp::jitter_adjust(image_files, camera_files, cameras,
 			 output_prefix, opt_vec[0].session->name(),
@@ -641,27 +840,59 @@ int main( int argc, char* argv[] ) {
                        output_prefix);
     }
 
-    // Keep only those stereo pairs for which filtered disparity exists
-    vector<ASPGlobalOptions> opt_vec_new;
-    for (int p = 0; p < (int)opt_vec.size(); p++){
-      if (fs::exists(opt_vec[p].out_prefix+"-F.tif"))
-        opt_vec_new.push_back(opt_vec[p]);
-    }
-    opt_vec = opt_vec_new;
-    if (opt_vec.empty())
-      vw_throw( ArgumentErr() << "No valid F.tif files found.\n" );
+    if (stereo_settings().save_quantized_point_cloud &&
+        stereo_settings().save_double_precision_point_cloud)
+      vw_throw( ArgumentErr() << "Cannot use both --save-quantized-point-cloud "
+                              << "and --save-double-precision-point-cloud.\n" );
 
-    // Triangulation uses small tiles.
-    //---------------------------------------------------------
-    int ts = ASPGlobalOptions::tri_tile_size();
-    for (int s = 0; s < (int)opt_vec.size(); s++)
-      opt_vec[s].raster_tile_size = Vector2i(ts, ts);
+    if (stereo_settings().fuse_stages) {
+      fused_stages_checks(opt_vec);
+
+      // Each tile is correlated too, so use the correlation tile size.
+      int ts = stereo_settings().corr_tile_size_ovr;
+      const int TILE_MULTIPLE = 16;
+      if (ts % TILE_MULTIPLE != 0)
+        ts = ((ts / TILE_MULTIPLE) + 1) * TILE_MULTIPLE;
+      opt_vec[0].raster_tile_size = Vector2i(ts, ts);
+
+      read_search_range_from_dsub(opt_vec[0]);
+    } else {
+
+      // Keep only those stereo pairs for which filtered disparity exists
+      vector<ASPGlobalOptions> opt_vec_new;
+      for (int p = 0; p < (int)opt_vec.size(); p++){
+        if (fs::exists(opt_vec[p].out_prefix+"-F.tif"))
+          opt_vec_new.push_back(opt_vec[p]);
+      }
+      opt_vec = opt_vec_new;
+      if (opt_vec.empty())
+        vw_throw( ArgumentErr() << "No valid F.tif files found.\n" );
+
+      // Triangulation uses small tiles.
+      //---------------------------------------------------------
+      int ts = ASPGlobalOptions::tri_tile_size();
+      for (int s = 0; s < (int)opt_vec.size(); s++)
+        opt_vec[s].raster_tile_size = Vector2i(ts, ts);
+    }
 
     // Internal Processes
     //---------------------------------------------------------
 
    // TODO: De-template these classes!
 
+    // With --tile-worker, triangulate each tile read from standard input
+    // with the same session and cameras.
+    if (stereo_settings().tile_worker && opt_vec.size() > 1)
+      vw_throw( ArgumentErr() << "The option --tile-worker is not supported "
+                              << "for multiview triangulation.\n" );
+    bool have_tile = true;
+    if (stereo_settings().tile_worker)
+      have_tile = read_worker_tile(opt_vec[0]);
+    while (have_tile) {
+
+      if (stereo_settings().tile_worker)
+        output_prefix = opt_vec[0].out_prefix;
+
 #define INSTANTIATE(T,NAME) if ( opt_vec[0].session->name() == NAME ) { \
       stereo_triangulation<T>(output_prefix, opt_vec); }
 
@@ -681,6 +912,9 @@ int main( int argc, char* argv[] ) {
     INSTANTIATE(StereoSessionIsisMapIsis,  "isismapisis"            );
 #endif
 
+      have_tile = stereo_settings().tile_worker && read_worker_tile(opt_vec[0]);
+    }
+
 #undef INSTANTIATE
 
     vw_out() << "\n[ " << current_posix_time_string() << " ] : TRIANGULATION FINISHED \n";
@@ -456,6 +456,12 @@ void get_offsets(int tdi, bool is_wv01, bool is_forward,
   
 }
 
+/// Shift each image column by the accumulated CCD offsets, with
+/// bilinear interpolation. The offsets depend only on the column, so
+/// the integer part of the shift and the interpolation weights are
+/// tabulated once per column, and each tile is then produced row by
+/// row with a fixed set of multiply-adds per pixel, in a loop the
+/// compiler can vectorize.
 template <class ImageT>
 class WVCorrectView: public ImageViewBase< WVCorrectView<ImageT> >{
   ImageT m_img;
@@ -464,6 +470,14 @@ class WVCorrectView: public ImageViewBase< WVCorrectView<ImageT> >{
   double m_pitch_ratio;
   std::vector<double> m_posx, m_ccdx, m_posy, m_ccdy;
 
+  // For each column, the integer part of the shift and the fractional
+  // part, which is the interpolation weight.
+  std::vector<int>   m_shiftx, m_shifty;
+  std::vector<float> m_weightx, m_weighty;
+
+  // How far beyond a tile we read the input image
+  int m_bias;
+
   typedef typename ImageT::pixel_type PixelT;
 
 public:
@@ -483,6 +497,33 @@ public:
               m_posy.size() == m_ccdy.size(),
               ArgumentErr() << "wv_correct: Expecting the arrays of positions "
               << "and offsets to have the same sizes.");
+
+    int num_cols = m_img.cols();
+    m_shiftx.resize(num_cols);  m_shifty.resize(num_cols);
+    m_weightx.resize(num_cols); m_weighty.resize(num_cols);
+    double max_offset = 0.0;
+    for (int col = 0; col < num_cols; col++){
+
+      // Accumulate the corrections up to the current column
+      double valx = 0.0, valy = 0.0;
+      for (size_t t = 0; t < m_ccdx.size(); t++){
+        if (m_posx[t] < col)
+          valx -= m_ccdx[t];
+      }
+      for (size_t t = 0; t < m_ccdy.size(); t++){
+        if (m_posy[t] < col)
+          valy -= m_ccdy[t];
+      }
+
+      m_shiftx[col]  = (int)floor(valx);
+      m_shifty[col]  = (int)floor(valy);
+      m_weightx[col] = valx - m_shiftx[col];
+      m_weighty[col] = valy - m_shifty[col];
+      max_offset = std::max(max_offset, std::max(fabs(valx), fabs(valy)));
+    }
+
+    // CCD offsets are always under 1 pix, but be safe
+    m_bias = (int)ceil(max_offset) + BilinearInterpolation::pixel_buffer;
   }
   
   typedef PixelT pixel_type;
@@ -503,45 +544,35 @@ public:
   typedef CropView<ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize(BBox2i const& bbox) const {
 
-    // Need to see a bit more of the input image for the purpose
-    // of interpolation.
-    int max_offset = 5; // CCD offsets are always under 1 pix
-    int bias = BilinearInterpolation::pixel_buffer + max_offset;
+    // Need to see a bit more of the input image for the purpose of
+    // interpolation. Beyond the image edges use the nearest image
+    // pixel, so that all lookups below are in bounds.
     BBox2i biased_box = bbox;
-    biased_box.expand(bias);
-    biased_box.crop(bounding_box(m_img));
-    
-    ImageView<result_type> cropped_img = crop(m_img, biased_box);
-    InterpolationView<EdgeExtensionView< ImageView<result_type>,
-      ConstantEdgeExtension >, BilinearInterpolation> interp_img
-      = interpolate(cropped_img, BilinearInterpolation(),
-                    ConstantEdgeExtension());
+    biased_box.expand(m_bias);
+    ImageView<result_type> cropped_img
+      = crop(edge_extend(m_img, ConstantEdgeExtension()), biased_box);
+
+    // For each column of the tile, the offset in the cropped image of
+    // the upper-left interpolation neighbor, relative to the row start.
+    int width = bbox.width(), in_width = cropped_img.cols();
+    std::vector<ptrdiff_t> offsets(width);
+    std::vector<float> wx(width), wy(width);
+    for (int col = 0; col < width; col++){
+      int img_col = col + bbox.min().x();
+      offsets[col] = ptrdiff_t(m_bias + m_shifty[img_col])*in_width
+        + col + m_bias + m_shiftx[img_col];
+      wx[col] = m_weightx[img_col];
+      wy[col] = m_weighty[img_col];
+    }
 
-    
     ImageView<result_type> tile(bbox.width(), bbox.height());
-    for (int col = bbox.min().x(); col < bbox.max().x(); col++){
-
-      // Accumulate the corrections up to the current column
-      double valx = 0, valy = 0;
-      if (m_ccdx.size() > 0){
-        valx = 0.0;
-        for (size_t t = 0; t < m_ccdx.size(); t++){
-          if (m_posx[t] < col){
-            valx -= m_ccdx[t];
-          }
-        }
-        valy = 0.0;
-        for (size_t t = 0; t < m_ccdy.size(); t++){
-          if (m_posy[t] < col){
-            valy -= m_ccdy[t];
-          }
-        }
-      }
-      
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++){
-        tile(col - bbox.min().x(), row - bbox.min().y() )
-          = interp_img(col - biased_box.min().x() + valx,
-                       row - biased_box.min().y() + valy);
+    for (int row = 0; row < bbox.height(); row++){
+      result_type const* in = &cropped_img(0, row);
+      result_type * out = &tile(0, row);
+      for (int col = 0; col < width; col++){
+        result_type const* p = in + offsets[col];
+        out[col] = result_type((1 - wy[col])*((1 - wx[col])*p[0]        + wx[col]*p[1]) +
+                               wy[col]      *((1 - wx[col])*p[in_width] + wx[col]*p[in_width + 1]));
       }
     }
     